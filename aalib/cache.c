@@ -0,0 +1,253 @@
+/**
+ * Cache mode: a table that holds no more than a given number of
+ * entries, or of bytes, and makes room for a new entry by evicting
+ * one that has not been looked up lately.
+ *
+ * Recency is tracked with the CLOCK approximation of LRU.  Every
+ * slot has a reference bit, which a lookup sets, and the table has
+ * a "hand" that sweeps round the slots in order.  To choose a
+ * victim, the hand moves on past entries whose bit is set, clearing
+ * it as it goes, and stops at the first entry whose bit is clear:
+ * one that has not been looked up since the hand last came by.
+ *
+ * Unlike a true LRU list, nothing is linked between entries, so a
+ * lookup only writes a bit in the slot it has already read, and
+ * entries stay where the layout put them.
+ *
+ * A cache holds one copy of each key: inserting a key it holds
+ * already replaces the old copy.  So an eviction can be logged as a
+ * delete of its key, and replaying the log removes the same entry.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtools.h"
+
+struct TableCache {
+	size_t maxEntries;			/** zero for no limit */
+	size_t maxBytes;			/** zero for no limit */
+	AAValueLength valueLength;
+	AAEvictCallback evict;
+	void *userdata;
+	size_t nBytes;				/** only counted if maxBytes is set */
+	size_t hand;				/** the slot the clock looks at next */
+	uint64_t nEvictions;
+};
+
+/** the bytes an entry counts for: its key, and its value if it has a length */
+static size_t entryBytes(const TableCache *cache, size_t keylen, void *value)
+{
+	if (value == NULL || cache->valueLength == NULL)
+		return keylen;
+	return keylen + cache->valueLength(value);
+}
+
+/** is there room for another entry of the given size? */
+static int hasRoom(const AssociativeArray *aarray, size_t bytes)
+{
+	const TableCache *cache = aarray->cache;
+
+	if (cache->maxEntries > 0 && aarray->nEntries + 1 > cache->maxEntries)
+		return 0;
+	if (cache->maxBytes > 0 && cache->nBytes + bytes > cache->maxBytes)
+		return 0;
+	return 1;
+}
+
+/**
+ * Take an entry out of the cache, logging it as a delete of its key,
+ * and hand its value to the evict callback -- unless it is the value
+ * being inserted again.
+ */
+static void dropEntry(AssociativeArray *aarray, KeyDataPair *slot, void *keptValue)
+{
+	TableCache *cache = aarray->cache;
+	void *value = slot->value;
+
+	if (aarray->log != NULL)
+		logOperation(aarray->log, 0, slotKey(slot), slot->keylen, NULL);
+	if (cache->maxBytes > 0)
+		cache->nBytes -= entryBytes(cache, slot->keylen, value);
+	if (cache->evict != NULL && value != keptValue)
+		cache->evict(slotKey(slot), slot->keylen, value, cache->userdata);
+
+	releaseSlotKey(aarray, slot);
+	aarray->layout->remove(aarray, slot);
+	aarray->nEntries--;
+}
+
+/**
+ * Move the clock hand on to the next entry whose reference bit is
+ * clear, and evict it.  Two turns of the hand clear every bit on
+ * the way, so a victim is always found in a table with entries.
+ *
+ *  @return      1 if an entry was evicted, or 0 if the table is empty
+ */
+static int evictOne(AssociativeArray *aarray)
+{
+	TableCache *cache = aarray->cache;
+	KeyDataPair *slot;
+	size_t nLooked;
+
+	if (aarray->nEntries == 0)
+		return 0;
+
+	for (nLooked = 0; nLooked < 2 * aarray->size; nLooked++) {
+		if (cache->hand >= aarray->size)
+			cache->hand = 0;
+		slot = &aarray->table[cache->hand++];
+
+		if (slot->validity != HASH_USED)
+			continue;
+		if (slot->referenced) {
+			slot->referenced = 0;
+			continue;
+		}
+
+		dropEntry(aarray, slot, NULL);
+		cache->nEvictions++;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Make room for the given entry: take out the copy of its key the
+ * cache holds already, if there is one, and then evict entries until
+ * there is room.  An entry bigger than the whole byte capacity can
+ * never fit, so is refused without taking anything out.
+ *
+ *  @return      1 if there is room, or -1 if the entry is refused
+ */
+int cacheMakeRoom(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		void *value, HashValue hash)
+{
+	TableCache *cache = aarray->cache;
+	KeyDataPair *slot;
+	size_t bytes = 0;
+	int nEvicted = 0, probes = 0;
+
+	if (cache->maxBytes > 0) {
+		bytes = entryBytes(cache, keylen, value);
+		if (bytes > cache->maxBytes) {
+			fprintf(stderr, "Cannot cache an entry of %zu bytes in %zu bytes\n",
+					bytes, cache->maxBytes);
+			return -1;
+		}
+	}
+
+	if ((slot = aarray->layout->find(aarray, key, keylen, hash, &probes)) != NULL) {
+		dropEntry(aarray, slot, value);
+		nEvicted++;
+	}
+
+	while ( ! hasRoom(aarray, bytes) && evictOne(aarray) > 0)
+		nEvicted++;
+
+	if (nEvicted > 0 && aarray->keysInArena)
+		compactKeyArena(aarray, 0);
+	return 1;
+}
+
+/** count an entry that has been added to the table */
+void cacheAdded(AssociativeArray *aarray, size_t keylen, void *value)
+{
+	if (aarray->cache->maxBytes > 0)
+		aarray->cache->nBytes += entryBytes(aarray->cache, keylen, value);
+}
+
+/** count an entry that has been deleted from the table */
+void cacheRemoved(AssociativeArray *aarray, size_t keylen, void *value)
+{
+	if (aarray->cache->maxBytes > 0)
+		aarray->cache->nBytes -= entryBytes(aarray->cache, keylen, value);
+}
+
+/** how many entries have been evicted, for aaGetStats() */
+uint64_t cacheEvictions(AssociativeArray *aarray)
+{
+	return (aarray->cache == NULL) ? 0 : aarray->cache->nEvictions;
+}
+
+/** the cache line of aaPrintSummary() */
+void cachePrintSummary(FILE *fp, AssociativeArray *aarray)
+{
+	const TableCache *cache = aarray->cache;
+
+	fprintf(fp, "Cache of at most ");
+	if (cache->maxEntries > 0)
+		fprintf(fp, "%zu entries%s", cache->maxEntries, (cache->maxBytes > 0) ? " and " : "");
+	if (cache->maxBytes > 0)
+		fprintf(fp, "%zu bytes (%zu in use)", cache->maxBytes, cache->nBytes);
+	fprintf(fp, ", %llu evicted\n", (unsigned long long) cache->nEvictions);
+}
+
+void releaseCache(TableCache *cache)
+{
+	free(cache);
+}
+
+static int countEntryBytes(AAKeyType key, size_t keylen, void *value, void *userdata)
+{
+	TableCache *cache = (TableCache *) userdata;
+
+	cache->nBytes += entryBytes(cache, keylen, value);
+	return 0;
+}
+
+/**
+ * Put the table in cache mode, or change the capacity of a table
+ * already in it.  The table is sized up front for maxEntries, so
+ * that a full cache neither grows nor shrinks; if it holds more
+ * than the capacity already, the excess is evicted at once.
+ *
+ *  @return      1 on success, or -1 if the table cannot be a cache
+ */
+int aaSetCacheMode(AssociativeArray *aarray, const AACacheConfig *config)
+{
+	TableCache *cache;
+
+	if (aarray->snapshot != NULL) {
+		fprintf(stderr, "Cannot use a table opened from a snapshot as a cache\n");
+		return -1;
+	}
+	if (config->maxEntries == 0 && config->maxBytes == 0) {
+		fprintf(stderr, "Cannot use a table as a cache without a capacity\n");
+		return -1;
+	}
+
+	cache = aarray->cache;
+	if (cache == NULL) {
+		cache = (TableCache *) calloc(1, sizeof(TableCache));
+		if (cache == NULL) {
+			fprintf(stderr, "Cannot allocate cache for table\n");
+			return -1;
+		}
+	}
+	cache->maxEntries = config->maxEntries;
+	cache->maxBytes = config->maxBytes;
+	cache->valueLength = config->valueLength;
+	cache->evict = config->evict;
+	cache->userdata = config->userdata;
+
+	cache->nBytes = 0;
+	if (cache->maxBytes > 0)
+		aaIterateAction(aarray, countEntryBytes, cache);
+	aarray->cache = cache;
+
+	/** evictions keep a full cache the same size, so it need never shrink */
+	aarray->minLoadFactor = 0;
+	if (cache->maxEntries > aarray->nEntries)
+		reserveTable(aarray, cache->maxEntries - aarray->nEntries);
+
+	while ((cache->maxEntries > 0 && aarray->nEntries > cache->maxEntries)
+			|| (cache->maxBytes > 0 && cache->nBytes > cache->maxBytes)) {
+		if (evictOne(aarray) == 0)
+			break;
+	}
+	if (aarray->keysInArena)
+		compactKeyArena(aarray, 0);
+
+	return 1;
+}
@@ -0,0 +1,509 @@
+/**
+ * A table that can be shared between threads.
+ *
+ * The keys are split over a power of two number of segments, each
+ * an ordinary AssociativeArray guarded by its own reader-writer
+ * lock, so threads working on different segments never wait for
+ * each other, and lookups in the same segment share its lock.
+ * The segment is chosen from the top bits of a remix of the key's
+ * hash, which are independent of the bits the segment itself uses
+ * to place the key, and the hash is only computed once.
+ *
+ * Lookups do not write to the table at all; the probing costs that
+ * a single-threaded table accumulates in the table itself are kept
+ * instead in per-thread counters, each on its own cache line, which
+ * are only added up when the summary is printed.
+ *
+ * With lock-free reads, lookups take no lock at all: only writers
+ * take the segment lock, and they publish each slot with a release
+ * store of its validity.  For that to be safe, a slot is never
+ * reused while a reader might be comparing against it -- deleted
+ * slots stay tombstones until the segment is rehashed -- and the
+ * segment is never rehashed in place: a rehashed copy is published
+ * instead, and the old one retired.  Anything a reader might still
+ * hold (old tables, deleted keys, and values the user retires) is
+ * released through epoch-based reclamation.  Only the open
+ * addressing layout publishes its slots this way.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hashtools.h"
+#include "epoch.h"
+
+/** the most threads that get a set of counters to themselves */
+#define	STAT_SLOTS			256
+
+#define	DEFAULT_SEGMENTS	64
+#define	MAX_SEGMENTS		65536
+
+typedef struct Segment {
+	pthread_rwlock_t lock;
+	AssociativeArray *table;
+} Segment;
+
+/** one segment per cache line, so taking one lock does not slow down its neighbours */
+typedef union PaddedSegment {
+	Segment segment;
+	unsigned char pad[(sizeof(Segment) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE];
+} PaddedSegment;
+
+typedef struct ThreadStats {
+	uint64_t nInserts;
+	uint64_t nLookups;
+	uint64_t nDeletes;
+	uint64_t insertCost;
+	uint64_t searchCost;
+	uint64_t deleteCost;
+} ThreadStats;
+
+typedef union PaddedStats {
+	ThreadStats stats;
+	unsigned char pad[(sizeof(ThreadStats) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE];
+} PaddedStats;
+
+struct AAConcurrentArray {
+	PaddedSegment *segments;
+	size_t nSegments;
+	int segmentShift;
+	HashAlgorithm hashAlgorithm;
+	HashSeed seed;
+	PaddedStats *stats;
+	int lockFreeReads;
+	EpochDomain epochs;
+};
+
+/** which set of counters this thread uses, assigned on first use */
+static __thread int statSlot = -1;
+static int nextStatSlot = 0;
+
+static inline ThreadStats *threadStats(AAConcurrentArray *carray)
+{
+	if (statSlot < 0)
+		statSlot = __atomic_fetch_add(&nextStatSlot, 1, __ATOMIC_RELAXED) % STAT_SLOTS;
+	return &carray->stats[statSlot].stats;
+}
+
+/**
+ * Each thread only updates its own counters, so a plain load and
+ * store will do, with no locked instruction.  Beyond STAT_SLOTS
+ * threads the counters are shared, and the counts approximate.
+ */
+static inline void countOperation(uint64_t *counter, uint64_t *cost, int opCost)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1,
+			__ATOMIC_RELAXED);
+	__atomic_store_n(cost, __atomic_load_n(cost, __ATOMIC_RELAXED) + (uint64_t) opCost,
+			__ATOMIC_RELAXED);
+}
+
+static inline Segment *segmentFor(AAConcurrentArray *carray, HashValue hash)
+{
+	return &carray->segments[partOfHash(hash, carray->segmentShift)].segment;
+}
+
+static void *allocateAligned(size_t size)
+{
+	void *memory;
+
+	if (posix_memalign(&memory, CACHE_LINE, size) != 0)
+		return NULL;
+	memset(memory, 0, size);
+	return memory;
+}
+
+/**
+ * Create a table that may be used from many threads at once.
+ *
+ *  @param  size  the initial size of the whole table, shared
+ *				out between the segments
+ *  @param  nSegments  how many independently locked parts to split
+ *				the table into, rounded up to a power of two; zero
+ *				chooses a default suitable for a few dozen threads
+ *  @return the new table, or NULL if it could not be created
+ *
+ *  @see    aaCreateAssociativeArrayWithConfig
+ */
+AAConcurrentArray *
+aaCreateConcurrentArray(
+		size_t size,
+		size_t nSegments,
+		char *probingStrategy,
+		char *hashPrimary,
+		char *hashSecondary,
+		const AAConfig *config
+	)
+{
+	AAConcurrentArray *carray;
+	AAConfig segmentConfig = *config;
+	size_t i, segmentSize;
+	int log2 = 0;
+
+	if (nSegments == 0)
+		nSegments = DEFAULT_SEGMENTS;
+	if (nSegments > MAX_SEGMENTS)
+		nSegments = MAX_SEGMENTS;
+	while (((size_t) 1 << log2) < nSegments)
+		log2++;
+	nSegments = (size_t) 1 << log2;
+
+	carray = (AAConcurrentArray *) malloc(sizeof(AAConcurrentArray));
+	if (carray == NULL)
+		return NULL;
+
+	carray->nSegments = nSegments;
+	carray->segmentShift = 64 - log2;
+	carray->segments = (PaddedSegment *) allocateAligned(nSegments * sizeof(PaddedSegment));
+	carray->stats = (PaddedStats *) allocateAligned(STAT_SLOTS * sizeof(PaddedStats));
+	if (carray->segments == NULL || carray->stats == NULL
+			|| initEpochDomain(&carray->epochs) < 0) {
+		fprintf(stderr, "Cannot allocate concurrent table of %zu segments\n", nSegments);
+		free(carray->segments);
+		free(carray->stats);
+		free(carray);
+		return NULL;
+	}
+
+	/** every segment must hash a key the same way, so they share one seed */
+	segmentConfig.seed = sharedTableSeed(config->seed);
+
+	segmentSize = size / nSegments;
+	if (segmentSize < 1)
+		segmentSize = 1;
+
+	for (i = 0; i < nSegments; i++) {
+		Segment *segment = &carray->segments[i].segment;
+
+		segment->table = aaCreateAssociativeArrayWithConfig(segmentSize,
+				probingStrategy, hashPrimary, hashSecondary, &segmentConfig);
+		if (segment->table == NULL
+				|| pthread_rwlock_init(&segment->lock, NULL) != 0) {
+			fprintf(stderr, "Cannot create segment %zu of concurrent table\n", i);
+			aaDeleteAssociativeArray(segment->table);
+			carray->nSegments = i;
+			aaDeleteConcurrentArray(carray);
+			return NULL;
+		}
+	}
+
+	carray->hashAlgorithm = carray->segments[0].segment.table->hashAlgorithmPrimary;
+	carray->seed = carray->segments[0].segment.table->seedPrimary;
+
+	carray->lockFreeReads = config->lockFreeReads;
+	if (carray->lockFreeReads
+			&& carray->segments[0].segment.table->layout != &probingLayout) {
+		fprintf(stderr, "Lock-free reads need linear, quadratic or double hash"
+				" probing - using locked reads\n");
+		carray->lockFreeReads = 0;
+	}
+	for (i = 0; i < nSegments; i++)
+		carray->segments[i].segment.table->lockFreeReads = carray->lockFreeReads;
+
+	return carray;
+}
+
+/**
+ * Deallocate the table and all of its segments.  No other thread
+ * may be using the table while this is done.
+ */
+void
+aaDeleteConcurrentArray(AAConcurrentArray *carray)
+{
+	size_t i;
+
+	if (carray == NULL)
+		return;
+
+	for (i = 0; i < carray->nSegments; i++) {
+		pthread_rwlock_destroy(&carray->segments[i].segment.lock);
+		aaDeleteAssociativeArray(carray->segments[i].segment.table);
+	}
+	free(carray->segments);
+	free(carray->stats);
+	releaseEpochDomain(&carray->epochs);
+	free(carray);
+}
+
+static void releaseRetiredTable(void *table)
+{
+	releaseTableShell((AssociativeArray *) table);
+}
+
+static void retireKey(void *key, void *epochs)
+{
+	retireMemory((EpochDomain *) epochs, key, free);
+}
+
+/**
+ * Publish a rehashed copy of the segment's table in place of the
+ * current one, which is retired.  Called with the segment locked.
+ *
+ *  @return      the segment's table, which is unchanged if the
+ *				 copy could not be built
+ */
+static AssociativeArray *replaceTable(AAConcurrentArray *carray,
+		Segment *segment, size_t newSize)
+{
+	AssociativeArray *table = segment->table;
+	AssociativeArray *clone = cloneTable(table, newSize);
+
+	if (clone == NULL)
+		return table;
+
+	__atomic_store_n(&segment->table, clone, __ATOMIC_RELEASE);
+	retireMemory(&carray->epochs, table, releaseRetiredTable);
+	return clone;
+}
+
+/**
+ * insertHashed(), for a segment with lock-free readers: rather than
+ * rehashing in place, the table is replaced by a rehashed copy.
+ * Called with the segment locked.
+ */
+static long lockFreeInsert(AAConcurrentArray *carray, Segment *segment,
+		AAKeyType key, size_t keylen, void *value, HashValue hash, int *cost)
+{
+	AssociativeArray *table = segment->table;
+	AssociativeArray *grown;
+	KeyDataPair entry;
+	size_t newSize;
+	long index;
+
+	newSize = grownTableSize(table);
+	if (newSize > 0)
+		table = replaceTable(carray, segment, newSize);
+
+	memset(&entry, 0, sizeof(entry));
+	if (storeSlotKey(table, &entry, key, keylen) < 0)
+		return -1;
+	entry.value = value;
+	entry.hash = hash;
+	index = table->layout->insert(table, &entry, hash, cost);
+
+	/** as in insertHashed(), only grow for a failure if reasonably full */
+	if (index < 0 && table->nEntries + 1 > table->maxLoadFactor * table->size / 2) {
+		grown = replaceTable(carray, segment, table->size * 2);
+		if (grown != table) {
+			table = grown;
+			index = table->layout->insert(table, &entry, hash, cost);
+		}
+	}
+
+	/** the entry was never published, so its key can go straight away */
+	if (index < 0)
+		releaseSlotKey(table, &entry);
+	return index;
+}
+
+/**
+ * deleteHashed(), for a segment with lock-free readers: the slot is
+ * left a tombstone with its key intact, and the key retired.  The
+ * table never shrinks.  Called with the segment locked.
+ */
+static void *lockFreeDelete(AAConcurrentArray *carray, Segment *segment,
+		AAKeyType key, size_t keylen, HashValue hash, int *cost)
+{
+	AssociativeArray *table = segment->table;
+	KeyDataPair *slot;
+
+	slot = table->layout->find(table, key, keylen, hash, cost);
+	if (slot == NULL)
+		return NULL;
+
+	retireSlotKey(table, slot, retireKey, &carray->epochs);
+	table->layout->remove(table, slot);
+	table->nEntries--;
+
+	return slot->value;
+}
+
+/**
+ * Add a key and value to the table, as aaInsert().
+ *
+ *  @return      non-negative if the key was added, or a negative
+ *				 number if no place can be found
+ */
+long aaConcurrentInsert(AAConcurrentArray *carray,
+		AAKeyType key, size_t keylen, void *value)
+{
+	HashValue hash = carray->hashAlgorithm(key, keylen, &carray->seed);
+	Segment *segment = segmentFor(carray, hash);
+	ThreadStats *stats = threadStats(carray);
+	int cost = 0;
+	long index;
+
+	pthread_rwlock_wrlock(&segment->lock);
+	if (carray->lockFreeReads)
+		index = lockFreeInsert(carray, segment, key, keylen, value, hash, &cost);
+	else
+		index = insertHashed(segment->table, key, keylen, value, hash, &cost);
+	pthread_rwlock_unlock(&segment->lock);
+
+	countOperation(&stats->nInserts, &stats->insertCost, cost);
+	return index;
+}
+
+/**
+ * Locate the value stored with a key, as aaLookup().  Any number
+ * of threads may look up keys in the same segment at once.
+ *
+ * With lock-free reads, a value deleted by another thread may be
+ * returned; it stays valid as long as it is only released through
+ * aaConcurrentRetire() and the lookup is made between
+ * aaConcurrentEnterRead() and aaConcurrentExitRead().
+ */
+void *aaConcurrentLookup(AAConcurrentArray *carray, AAKeyType key, size_t keylen)
+{
+	HashValue hash = carray->hashAlgorithm(key, keylen, &carray->seed);
+	Segment *segment = segmentFor(carray, hash);
+	ThreadStats *stats = threadStats(carray);
+	AssociativeArray *table;
+	EpochRecord *record;
+	KeyDataPair *slot;
+	void *value = NULL;
+	int cost = 0;
+
+	if (carray->lockFreeReads) {
+		record = epochEnter(&carray->epochs);
+		table = __atomic_load_n(&segment->table, __ATOMIC_ACQUIRE);
+		slot = table->layout->find(table, key, keylen, hash, &cost);
+		if (slot != NULL)
+			value = slot->value;
+		epochExit(record);
+
+	} else {
+		pthread_rwlock_rdlock(&segment->lock);
+		slot = segment->table->layout->find(segment->table, key, keylen, hash, &cost);
+		if (slot != NULL)
+			value = slot->value;
+		pthread_rwlock_unlock(&segment->lock);
+	}
+
+	countOperation(&stats->nLookups, &stats->searchCost, cost);
+	return value;
+}
+
+/**
+ * Remove a key from the table, as aaDelete().
+ *
+ *  @return      the value that was stored with the key, or NULL
+ */
+void *aaConcurrentDelete(AAConcurrentArray *carray, AAKeyType key, size_t keylen)
+{
+	HashValue hash = carray->hashAlgorithm(key, keylen, &carray->seed);
+	Segment *segment = segmentFor(carray, hash);
+	ThreadStats *stats = threadStats(carray);
+	void *value;
+	int cost = 0;
+
+	pthread_rwlock_wrlock(&segment->lock);
+	if (carray->lockFreeReads)
+		value = lockFreeDelete(carray, segment, key, keylen, hash, &cost);
+	else
+		value = deleteHashed(segment->table, key, keylen, hash, &cost);
+	pthread_rwlock_unlock(&segment->lock);
+
+	countOperation(&stats->nDeletes, &stats->deleteCost, cost);
+	return value;
+}
+
+/**
+ * Release a value (removed from the table by aaConcurrentDelete())
+ * once no thread can still be using it: that is, once every thread
+ * that might have looked it up has left its read section.  The
+ * release function is called on the value at that point.
+ */
+void aaConcurrentRetire(AAConcurrentArray *carray, void *value, void (*release)(void *value))
+{
+	retireMemory(&carray->epochs, value, release);
+}
+
+/**
+ * Bracket a series of lookups whose values will be used after
+ * the lookups return: values retired in the meantime are not
+ * released until aaConcurrentExitRead().  Sections may be nested,
+ * but must be short, as they hold up all reclamation.
+ */
+void aaConcurrentEnterRead(AAConcurrentArray *carray)
+{
+	epochEnter(&carray->epochs);
+}
+
+void aaConcurrentExitRead(AAConcurrentArray *carray)
+{
+	epochExit(epochRecord(&carray->epochs));
+}
+
+/**
+ * Call the user function on every entry, as aaIterateAction(),
+ * one segment at a time.  Each segment is locked for reading while
+ * it is visited, so the user function must not change the table.
+ */
+int aaConcurrentIterateAction(
+		AAConcurrentArray *carray,
+		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
+		void *userdata
+	)
+{
+	size_t i;
+	int status = 1;
+
+	for (i = 0; i < carray->nSegments && status > 0; i++) {
+		Segment *segment = &carray->segments[i].segment;
+
+		pthread_rwlock_rdlock(&segment->lock);
+		status = aaIterateAction(segment->table, userfunction, userdata);
+		pthread_rwlock_unlock(&segment->lock);
+	}
+	return status;
+}
+
+/** print the totals over all segments and all threads */
+void aaConcurrentPrintSummary(FILE *fp, AAConcurrentArray *carray)
+{
+	ThreadStats total;
+	size_t i, nEntries = 0, size = 0, largest = 0;
+	int nResizes = 0;
+
+	for (i = 0; i < carray->nSegments; i++) {
+		Segment *segment = &carray->segments[i].segment;
+
+		pthread_rwlock_rdlock(&segment->lock);
+		nEntries += segment->table->nEntries;
+		size += segment->table->size;
+		nResizes += segment->table->nResizes;
+		if (segment->table->nEntries > largest)
+			largest = segment->table->nEntries;
+		pthread_rwlock_unlock(&segment->lock);
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < STAT_SLOTS; i++) {
+		ThreadStats *stats = &carray->stats[i].stats;
+
+		total.nInserts += __atomic_load_n(&stats->nInserts, __ATOMIC_RELAXED);
+		total.nLookups += __atomic_load_n(&stats->nLookups, __ATOMIC_RELAXED);
+		total.nDeletes += __atomic_load_n(&stats->nDeletes, __ATOMIC_RELAXED);
+		total.insertCost += __atomic_load_n(&stats->insertCost, __ATOMIC_RELAXED);
+		total.searchCost += __atomic_load_n(&stats->searchCost, __ATOMIC_RELAXED);
+		total.deleteCost += __atomic_load_n(&stats->deleteCost, __ATOMIC_RELAXED);
+	}
+
+	fprintf(fp, "Concurrent table: %zu entries in %zu segments, total size %zu\n",
+			nEntries, carray->nSegments, size);
+	fprintf(fp, "Largest segment holds %zu entries, segments resized %d times\n",
+			largest, nResizes);
+	fprintf(fp, "Strategies used: '%s' hash, '%s' secondary hash and '%s' probing\n",
+			carray->segments[0].segment.table->hashNamePrimary,
+			carray->segments[0].segment.table->hashNameSecondary,
+			carray->segments[0].segment.table->probeName);
+	fprintf(fp, "Table layout: %s\n", carray->segments[0].segment.table->layout->name);
+	fprintf(fp, "Operations over all threads:\n");
+	fprintf(fp, "  Insertion : %llu (cost %llu)\n",
+			(unsigned long long) total.nInserts, (unsigned long long) total.insertCost);
+	fprintf(fp, "  Search    : %llu (cost %llu)\n",
+			(unsigned long long) total.nLookups, (unsigned long long) total.searchCost);
+	fprintf(fp, "  Deletion  : %llu (cost %llu)\n",
+			(unsigned long long) total.nDeletes, (unsigned long long) total.deleteCost);
+}
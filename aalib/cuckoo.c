@@ -0,0 +1,213 @@
+/**
+ * Bucketized cuckoo hashing: the table is divided into buckets of
+ * four slots, and every key lives in one of exactly two buckets,
+ * both chosen from the primary and secondary hashes together.  A
+ * search therefore never looks at more than eight slots, in two
+ * runs of four adjacent slots.
+ *
+ * At most eight keys can be placed that share both buckets, so
+ * keys must rarely do so.  The simple unkeyed hashes ("sum",
+ * "length" and "xor") give the same value to whole families of
+ * keys -- every two-digit number whose digits add up to 9, say --
+ * so when one of them is the secondary hash, a keyed hash of the
+ * key is used in its place, and both buckets are taken from it as
+ * well as from the primary hash, which may be just as weak.  Only
+ * copies of the same key, inserted more than eight times, still
+ * cannot be placed.
+ *
+ * If both of a new key's buckets are full, a randomly chosen entry
+ * in one of them is kicked out to make room, and is moved to its
+ * own other bucket, possibly kicking out another entry in turn.
+ * If this random walk goes on too long, every move is undone and
+ * the insert fails, so that the table can be grown and the insert
+ * tried again.
+ */
+#include <string.h>
+
+#include "hashtools.h"
+
+#define	BUCKET_SLOTS	4
+
+/** the longest random walk tried before giving up on an insert */
+#define	MAX_KICKS		256
+
+/** xorshift64* generator, used to pick which entry to kick out */
+static inline uint64_t nextRandom(AssociativeArray *aarray)
+{
+	uint64_t x = aarray->randomState;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	aarray->randomState = x;
+	return x * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+/**
+ * The bits of the secondary hash we keep in each slot, which are
+ * from wyhash, keyed with the secondary seed, if the secondary hash
+ * cannot tell similar keys apart
+ */
+static inline uint32_t alternateHash(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+{
+	HashAlgorithm secondary = aarray->hashAlgorithmSecondary;
+
+	if (secondary == hashBySum || secondary == hashByLength || secondary == hashByXOR)
+		secondary = hashByWy;
+	return (uint32_t) secondary(key, keylen, &aarray->seedSecondary);
+}
+
+/**
+ * The two buckets a key may live in, each taken from the primary
+ * and alternate hashes mixed together in a different way, so that
+ * keys sharing either hash are still spread over different buckets.
+ *
+ * Both hashes are stored in the slot, so the buckets of an entry
+ * that has to be moved can be found without looking at its key.
+ */
+static void candidateBuckets(AssociativeArray *aarray,
+		HashValue hash, uint32_t alternate,
+		HashIndex *first, HashIndex *second)
+{
+	size_t nBuckets = aarray->sizer.size;
+
+	*first = reduceHash(&aarray->sizer, mixHash(hash ^ ((HashValue) alternate << 32)));
+	*second = reduceHash(&aarray->sizer, mixHash(alternate ^ mixHash(hash)));
+	if (*second == *first && nBuckets > 1)
+		*second = (*first + 1 == nBuckets) ? 0 : *first + 1;
+}
+
+/** index of a free slot in the bucket, or -1 if it is full */
+static long freeSlot(AssociativeArray *aarray, HashIndex bucket)
+{
+	HashIndex index = bucket * BUCKET_SLOTS;
+	int i;
+
+	for (i = 0; i < BUCKET_SLOTS; i++) {
+		if (aarray->table[index + i].validity != HASH_USED)
+			return (long) (index + i);
+	}
+	return -1;
+}
+
+static void placeInSlot(AssociativeArray *aarray, long index, KeyDataPair *entry)
+{
+	aarray->table[index] = *entry;
+	aarray->table[index].validity = HASH_USED;
+	aarray->nEntries++;
+}
+
+static long cuckooInsert(AssociativeArray *aarray,
+		KeyDataPair *entry, HashValue hash, int *cost)
+{
+	HashIndex path[MAX_KICKS];
+	HashIndex first, second, bucket;
+	KeyDataPair carried, swap;
+	long index;
+	int kicks;
+
+	/** entries moved from an old table during a rehash have this already */
+	if (entry->validity != HASH_USED)
+		entry->aux.alternateHash = alternateHash(aarray, slotKey(entry), entry->keylen);
+
+	candidateBuckets(aarray, hash, entry->aux.alternateHash, &first, &second);
+
+	if ((index = freeSlot(aarray, first)) >= 0) {
+		placeInSlot(aarray, index, entry);
+		return index;
+	}
+
+	/** looking at the second bucket costs a step, as in a search */
+	(*cost)++;
+	if ((index = freeSlot(aarray, second)) >= 0) {
+		placeInSlot(aarray, index, entry);
+		return index;
+	}
+
+	/** both buckets full: start a random walk from one of them */
+	carried = *entry;
+	bucket = (nextRandom(aarray) & 1) ? first : second;
+
+	for (kicks = 0; kicks < MAX_KICKS; kicks++) {
+		path[kicks] = bucket * BUCKET_SLOTS + (nextRandom(aarray) % BUCKET_SLOTS);
+
+		swap = aarray->table[path[kicks]];
+		aarray->table[path[kicks]] = carried;
+		aarray->table[path[kicks]].validity = HASH_USED;
+		carried = swap;
+		(*cost)++;
+
+		/** the entry we kicked out must go to its other bucket */
+		candidateBuckets(aarray, carried.hash, carried.aux.alternateHash,
+				&first, &second);
+		bucket = (first == bucket) ? second : first;
+
+		if ((index = freeSlot(aarray, bucket)) >= 0) {
+			placeInSlot(aarray, index, &carried);
+			return (long) path[0];
+		}
+	}
+
+	/** undo the walk, leaving the table as it was */
+	while (kicks-- > 0) {
+		swap = aarray->table[path[kicks]];
+		aarray->table[path[kicks]] = carried;
+		carried = swap;
+	}
+	return -1;
+}
+
+static KeyDataPair *cuckooFind(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash, int *cost)
+{
+	HashIndex buckets[2];
+	KeyDataPair *slot;
+	int b, i;
+
+	candidateBuckets(aarray, hash, alternateHash(aarray, key, keylen),
+			&buckets[0], &buckets[1]);
+
+	for (b = 0; b < 2; b++) {
+		slot = &aarray->table[buckets[b] * BUCKET_SLOTS];
+		for (i = 0; i < BUCKET_SLOTS; i++, slot++) {
+			if (slot->validity == HASH_USED && slotHoldsKey(slot, key, keylen, hash))
+				return slot;
+		}
+		if (b == 0)
+			(*cost)++;
+	}
+
+	return NULL;
+}
+
+/** searches always look at every slot of both buckets, so no tombstone is needed */
+static void cuckooRemove(AssociativeArray *aarray, KeyDataPair *slot)
+{
+	memset(slot, 0, sizeof(KeyDataPair));
+	slot->validity = HASH_EMPTY;
+}
+
+/** both candidate buckets, as a miss has to look at each of them */
+static void cuckooPrefetch(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash)
+{
+	HashIndex buckets[2];
+
+	candidateBuckets(aarray, hash, alternateHash(aarray, key, keylen),
+			&buckets[0], &buckets[1]);
+	PREFETCH_READ(&aarray->table[buckets[0] * BUCKET_SLOTS]);
+	PREFETCH_READ(&aarray->table[buckets[1] * BUCKET_SLOTS]);
+}
+
+/** the cuckoo layout; the table sizer counts buckets rather than slots */
+const TableLayout cuckooLayout = {
+		"bucketized cuckoo (2 choices of 4 slot buckets)",
+		0,
+		BUCKET_SLOTS,
+		NULL,
+		NULL,
+		cuckooInsert,
+		cuckooFind,
+		cuckooPrefetch,
+		cuckooRemove
+	};
@@ -0,0 +1,216 @@
+/**
+ * Epoch-based reclamation, after Fraser's design.
+ *
+ * There is a global epoch counter.  A reader entering a critical
+ * section copies the global epoch into its own record and marks
+ * itself active; leaving, it marks itself inactive.  The global
+ * epoch may only advance once every active reader has caught up
+ * with it, so while a reader stays active the global epoch can
+ * move at most one past the epoch the reader announced.
+ *
+ * Memory is retired in the epoch current at the time, after it has
+ * been unlinked.  A reader that could still reach it must have
+ * announced that epoch or an earlier one, so once the global epoch
+ * is three further on, no such reader can remain.
+ *
+ * Readers only ever store to their own record (plus one fence on
+ * entry), so any number of them can run without contending; the
+ * writers' retiring and advancing is serialized by a mutex.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtools.h"
+#include "epoch.h"
+
+/** try to advance the epoch once this many allocations are waiting */
+#define	ADVANCE_THRESHOLD	64
+
+/** domains this thread has a record in, to avoid searching the list */
+#define	RECORD_CACHE		8
+
+static __thread struct {
+	uint64_t id;
+	EpochRecord *record;
+} recordCache[RECORD_CACHE];
+
+/** domain ids are never reused, so a stale cache entry cannot match */
+static uint64_t nextDomainId = 1;
+
+int initEpochDomain(EpochDomain *domain)
+{
+	memset(domain, 0, sizeof(EpochDomain));
+	domain->id = __atomic_fetch_add(&nextDomainId, 1, __ATOMIC_RELAXED);
+	if (pthread_mutex_init(&domain->lock, NULL) != 0)
+		return -1;
+	return 1;
+}
+
+static void releaseRetiredList(RetiredMemory *list)
+{
+	RetiredMemory *next;
+
+	for ( ; list != NULL; list = next) {
+		next = list->next;
+		list->release(list->memory);
+		free(list);
+	}
+}
+
+/**
+ * Release everything still waiting, and the records.  No thread may
+ * be using the domain any more.
+ */
+void releaseEpochDomain(EpochDomain *domain)
+{
+	EpochRecord *record, *next;
+	int i;
+
+	for (i = 0; i < EPOCH_LISTS; i++) {
+		releaseRetiredList(domain->retired[i]);
+		domain->retired[i] = NULL;
+	}
+
+	for (record = domain->records; record != NULL; record = next) {
+		next = record->next;
+		free(record);
+	}
+	domain->records = NULL;
+
+	pthread_mutex_destroy(&domain->lock);
+}
+
+/**
+ * The calling thread's record in the domain, which is created and
+ * linked in on the thread's first read.  Records are kept until the
+ * domain is released; an idle record does not hold up the epoch.
+ */
+EpochRecord *epochRecord(EpochDomain *domain)
+{
+	int slot = (int) (domain->id % RECORD_CACHE);
+	pthread_t self = pthread_self();
+	EpochRecord *record;
+	void *memory;
+
+	if (recordCache[slot].id == domain->id)
+		return recordCache[slot].record;
+
+	/** we may have a record already, pushed out of the cache by another domain */
+	record = __atomic_load_n(&domain->records, __ATOMIC_ACQUIRE);
+	for ( ; record != NULL; record = record->next) {
+		if (pthread_equal(record->owner, self))
+			break;
+	}
+
+	if (record == NULL) {
+		if (posix_memalign(&memory, CACHE_LINE,
+				(sizeof(EpochRecord) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE) != 0) {
+			fprintf(stderr, "Cannot allocate epoch record\n");
+			abort();
+		}
+		record = (EpochRecord *) memory;
+		memset(record, 0, sizeof(EpochRecord));
+		record->owner = self;
+
+		record->next = __atomic_load_n(&domain->records, __ATOMIC_RELAXED);
+		while ( ! __atomic_compare_exchange_n(&domain->records, &record->next, record,
+				0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	recordCache[slot].id = domain->id;
+	recordCache[slot].record = record;
+	return record;
+}
+
+/**
+ * Start a read: until the matching epochExit(), nothing retired
+ * from now on will be released.  Reads may be nested.
+ */
+EpochRecord *epochEnter(EpochDomain *domain)
+{
+	EpochRecord *record = epochRecord(domain);
+	uint64_t epoch;
+
+	if (record->nesting++ == 0) {
+		epoch = __atomic_load_n(&domain->globalEpoch, __ATOMIC_ACQUIRE);
+		__atomic_store_n(&record->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+
+		/** the announcement must be visible before we read anything shared */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+	return record;
+}
+
+void epochExit(EpochRecord *record)
+{
+	if (--record->nesting == 0)
+		__atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Move the global epoch on by one if every active reader has
+ * announced the current epoch, releasing the memory retired three
+ * epochs ago.  Called with the domain locked.
+ */
+static void tryAdvance(EpochDomain *domain)
+{
+	uint64_t epoch = domain->globalEpoch;
+	uint64_t state;
+	EpochRecord *record;
+	RetiredMemory *expired;
+
+	/** pairs with the fence in epochEnter() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	record = __atomic_load_n(&domain->records, __ATOMIC_ACQUIRE);
+	for ( ; record != NULL; record = record->next) {
+		state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+		if ((state & 1) && (state >> 1) != epoch)
+			return;
+	}
+
+	__atomic_store_n(&domain->globalEpoch, epoch + 1, __ATOMIC_RELEASE);
+
+	/** the list for the new epoch holds what was retired in epoch - 2 */
+	expired = domain->retired[(epoch + 1) % EPOCH_LISTS];
+	domain->retired[(epoch + 1) % EPOCH_LISTS] = NULL;
+	for ( ; expired != NULL; ) {
+		RetiredMemory *next = expired->next;
+
+		expired->release(expired->memory);
+		free(expired);
+		domain->nRetired--;
+		expired = next;
+	}
+}
+
+/**
+ * Hand over memory that has been unlinked from everything readers
+ * can reach; the release function is called on it once no reader
+ * can still be using it.
+ */
+void retireMemory(EpochDomain *domain, void *memory, void (*release)(void *memory))
+{
+	RetiredMemory *retired;
+
+	if (memory == NULL)
+		return;
+
+	retired = (RetiredMemory *) malloc(sizeof(RetiredMemory));
+	if (retired == NULL) {
+		/** freeing it now could pull it out from under a reader */
+		fprintf(stderr, "Cannot retire memory - leaking it\n");
+		return;
+	}
+	retired->memory = memory;
+	retired->release = release;
+
+	pthread_mutex_lock(&domain->lock);
+	retired->next = domain->retired[domain->globalEpoch % EPOCH_LISTS];
+	domain->retired[domain->globalEpoch % EPOCH_LISTS] = retired;
+	if (++domain->nRetired >= ADVANCE_THRESHOLD)
+		tryAdvance(domain);
+	pthread_mutex_unlock(&domain->lock);
+}
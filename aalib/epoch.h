@@ -0,0 +1,51 @@
+#ifndef	__EPOCH_HEADER__
+#define	__EPOCH_HEADER__
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * Epoch-based reclamation: memory that readers taking no locks may
+ * still be looking at is "retired" rather than freed, and only
+ * released once every reader that could have seen it has finished.
+ *
+ * Readers bracket their accesses with epochEnter() and epochExit(),
+ * which only store to the reader's own record.  Writers hand memory
+ * to retireMemory(), which frees it once the global epoch has moved
+ * on far enough that no reader can still hold it.
+ */
+
+/** one per thread and domain, on a cache line of its own */
+typedef struct EpochRecord {
+	uint64_t state;				/** (epoch << 1) | 1 inside a read, 0 outside */
+	unsigned int nesting;		/** only the owning thread touches this */
+	pthread_t owner;
+	struct EpochRecord *next;
+} EpochRecord;
+
+typedef struct RetiredMemory {
+	struct RetiredMemory *next;
+	void *memory;
+	void (*release)(void *memory);
+} RetiredMemory;
+
+/** memory retired in epoch e is kept on list e % EPOCH_LISTS */
+#define	EPOCH_LISTS		3
+
+typedef struct EpochDomain {
+	uint64_t globalEpoch;
+	uint64_t id;
+	EpochRecord *records;
+	pthread_mutex_t lock;		/** serializes retiring and advancing */
+	RetiredMemory *retired[EPOCH_LISTS];
+	size_t nRetired;
+} EpochDomain;
+
+int initEpochDomain(EpochDomain *domain);
+void releaseEpochDomain(EpochDomain *domain);
+EpochRecord *epochRecord(EpochDomain *domain);
+EpochRecord *epochEnter(EpochDomain *domain);
+void epochExit(EpochRecord *record);
+void retireMemory(EpochDomain *domain, void *memory, void (*release)(void *memory));
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h> // for strcmp()
 #include <ctype.h> // for isprint()
+#include <time.h> // for seeding from the clock
 
 #include "hashtools.h"
 
@@ -42,7 +43,7 @@ printableKey(char *buffer, int bufferlen, AAKeyType key, size_t printlen)
 	}
 
 	if (allChars) {
-		snprintf(buffer, bufferlen, "char key:[%s]", (char *) key);
+		snprintf(buffer, bufferlen, "char key:[%.*s]", (int) printlen, (char *) key);
 	} else {
 		snprintf(buffer, bufferlen, "hex key:[0x");
 		loadptr = &buffer[strlen(buffer)];
@@ -59,18 +60,20 @@ printableKey(char *buffer, int bufferlen, AAKeyType key, size_t printlen)
 /**
  * Calculate a hash value based on the length of the key
  *
- * Calculate an integer index in the range [0...size-1] for
- * 		the given string key
+ * The table reduces the value returned to an index in the
+ * range [0...size-1] itself, using the method it was sized for.
  *
  *  @param  key  key to calculate mapping upon
- *  @param  size boundary for range of allowable return values
- *  @return      integer index associated with key
+ *  @param  keyLength  number of bytes in the key
+ *  @param  seed  the table's secret, ignored as this hash is not keyed
+ *  @return      hash value associated with key
  *
  *  @see    HashAlgorithm
+ *  @see    reduceHash
  */
-HashIndex hashByLength(AAKeyType key, size_t keyLength, HashIndex size)
+HashValue hashByLength(AAKeyType key, size_t keyLength, const HashSeed *seed)
 {
-	return keyLength % size;
+	return keyLength;
 }
 
 
@@ -78,215 +81,475 @@ HashIndex hashByLength(AAKeyType key, size_t keyLength, HashIndex size)
 /**
  * Calculate a hash value based on the sum of the values in the key
  *
- * Calculate an integer index in the range [0...size-1] for
- * 		the given string key, based on the sum of the values
- *		in the key
- *
  *  @param  key  key to calculate mapping upon
- *  @param  size boundary for range of allowable return values
- *  @return      integer index associated with key
+ *  @param  keyLength  number of bytes in the key
+ *  @return      hash value associated with key
  */
 
-HashIndex hashBySum(AAKeyType key, size_t keyLength, HashIndex size)
+HashValue hashBySum(AAKeyType key, size_t keyLength, const HashSeed *seed)
 {
-	HashIndex sum = 0;
+	HashValue sum = 0;
 
-	for(int i = 0; i<keyLength; i++)
+	for(size_t i = 0; i<keyLength; i++)
 	{
-		sum += (HashIndex)key[i];
+		sum += (HashValue)key[i];
 	}
-	return sum % size;
+	return sum;
 }
 
 /**
  * Calculate a hash value based on the sum of the values, flipped in biinary, in the key
  *
- * Calculate an integer index in the range [0...size-1] for
- * 		the given string key, based on the sum of the values
- *		in the key
- *
  *  @param  key  key to calculate mapping upon
- *  @param  size boundary for range of allowable return values
- *  @return      integer index associated with key
+ *  @param  keyLength  number of bytes in the key
+ *  @return      hash value associated with key
  */
 
-HashIndex hashByXOR(AAKeyType key, size_t keyLength, HashIndex size)
+HashValue hashByXOR(AAKeyType key, size_t keyLength, const HashSeed *seed)
 {
-	HashIndex value = 0;
+	HashValue value = 0;
 
-	for(int i = 0; i<keyLength; i++)
+	for(size_t i = 0; i<keyLength; i++)
 	{
-		value ^= (HashIndex)key[i];
+		value ^= (HashValue)key[i];
 	}
-	return value % size;
+	return value;
+}
+
+
+/**
+ * Unaligned little-endian loads of 8, 4 and 1-3 bytes, used by
+ * the hash functions below to consume a key a word at a time.
+ */
+static inline uint64_t read64(const unsigned char *p)
+{
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t read32(const unsigned char *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/** 1 to 3 bytes, read as first, middle and last so that every byte counts */
+static inline uint64_t readSmall(const unsigned char *p, size_t len)
+{
+	return (((uint64_t) p[0]) << 16) | (((uint64_t) p[len >> 1]) << 8) | p[len - 1];
+}
+
+static inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+/** the 128 bit product of a and b, returned as its low and high halves */
+static inline void multiplyWide(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 product = (unsigned __int128) *a * *b;
+	*a = (uint64_t) product;
+	*b = (uint64_t) (product >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t hi, lo;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32);
+	uint64_t c = t < rl;
+
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+/** fold the 128 bit product of a and b back down to 64 bits */
+static inline uint64_t multiplyMix(uint64_t a, uint64_t b)
+{
+	multiplyWide(&a, &b);
+	return a ^ b;
 }
 
+static const uint64_t wySecret[4] = {
+		UINT64_C(0x2d358dccaa6c78a5), UINT64_C(0x8bb84b93962eacc9),
+		UINT64_C(0x4b33a62ed433d4a3), UINT64_C(0x4d5a2da51de1aa47)
+	};
 
 /**
- * Locate an empty position in the given array, starting the
- * search at the indicated index, and restricting the search
- * to locations in the range [0...size-1]
+ * Calculate a hash value following wyhash (final version 4).
+ * Keys are consumed 16 or 48 bytes per step, each pair of words
+ * being folded together by a 64x64->128 bit multiplication, which
+ * mixes every input bit into the whole result.  Keys of up to 16
+ * bytes are handled without a loop.
  *
- *  @param  index where to begin the search
- *  @param  AssociativeArray associated AssociativeArray we are probing
- *  @param  invalidEndsSearch should the identification of a
- *				KeyDataPair marked invalid end our search?
- *				This is true if we are looking for a location
- *				to insert new data
- *  @return index of location where search stopped, or -1 if
- *				search failed
+ *  @param  key  key to calculate mapping upon
+ *  @param  keyLength  number of bytes in the key
+ *  @param  tableSeed  the table's secret; only k0 is used
+ *  @return      hash value associated with key
+ */
+HashValue hashByWy(AAKeyType key, size_t keyLength, const HashSeed *tableSeed)
+{
+	const unsigned char *p = key;
+	uint64_t seed = tableSeed->k0 ^ multiplyMix(tableSeed->k0 ^ wySecret[0], wySecret[1]);
+	uint64_t a, b;
+
+	if (keyLength <= 16) {
+		if (keyLength >= 4) {
+			size_t middle = (keyLength >> 3) << 2;
+			a = (read32(p) << 32) | read32(p + middle);
+			b = (read32(p + keyLength - 4) << 32) | read32(p + keyLength - 4 - middle);
+		} else if (keyLength > 0) {
+			a = readSmall(p, keyLength);
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t remaining = keyLength;
+
+		if (remaining > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+
+			do {
+				seed = multiplyMix(read64(p) ^ wySecret[1], read64(p + 8) ^ seed);
+				seed1 = multiplyMix(read64(p + 16) ^ wySecret[2], read64(p + 24) ^ seed1);
+				seed2 = multiplyMix(read64(p + 32) ^ wySecret[3], read64(p + 40) ^ seed2);
+				p += 48;
+				remaining -= 48;
+			} while (remaining > 48);
+			seed ^= seed1 ^ seed2;
+		}
+
+		while (remaining > 16) {
+			seed = multiplyMix(read64(p) ^ wySecret[1], read64(p + 8) ^ seed);
+			p += 16;
+			remaining -= 16;
+		}
+
+		/** the last 16 bytes, which may overlap those already used */
+		a = read64(p + remaining - 16);
+		b = read64(p + remaining - 8);
+	}
+
+	a ^= wySecret[1];
+	b ^= seed;
+	multiplyWide(&a, &b);
+	return multiplyMix(a ^ wySecret[0] ^ keyLength, b ^ wySecret[1]);
+}
+
+
+#define	XXH_PRIME1	UINT64_C(0x9E3779B185EBCA87)
+#define	XXH_PRIME2	UINT64_C(0xC2B2AE3D27D4EB4F)
+#define	XXH_PRIME3	UINT64_C(0x165667B19E3779F9)
+#define	XXH_PRIME4	UINT64_C(0x85EBCA77C2B2AE63)
+#define	XXH_PRIME5	UINT64_C(0x27D4EB2F165667C5)
+
+static inline uint64_t xxhRound(uint64_t accumulator, uint64_t input)
+{
+	accumulator += input * XXH_PRIME2;
+	accumulator = rotateLeft(accumulator, 31);
+	return accumulator * XXH_PRIME1;
+}
+
+static inline uint64_t xxhMergeRound(uint64_t accumulator, uint64_t value)
+{
+	accumulator ^= xxhRound(0, value);
+	return accumulator * XXH_PRIME1 + XXH_PRIME4;
+}
+
+/**
+ * Calculate a hash value using XXH64.  Long keys are consumed 32
+ * bytes at a time by four independent accumulators, which lets
+ * the processor work on all four at once.
  *
- *  @see    HashProbe
+ *  @param  key  key to calculate mapping upon
+ *  @param  keyLength  number of bytes in the key
+ *  @param  tableSeed  the table's secret; k0 is the XXH64 seed
+ *  @return      hash value associated with key
+ */
+HashValue hashByXXH64(AAKeyType key, size_t keyLength, const HashSeed *tableSeed)
+{
+	const unsigned char *p = key;
+	const unsigned char *end = p + keyLength;
+	uint64_t seed = tableSeed->k0;
+	uint64_t hash;
+
+	if (keyLength >= 32) {
+		const unsigned char *limit = end - 32;
+		uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+		uint64_t v2 = seed + XXH_PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - XXH_PRIME1;
+
+		do {
+			v1 = xxhRound(v1, read64(p));
+			v2 = xxhRound(v2, read64(p + 8));
+			v3 = xxhRound(v3, read64(p + 16));
+			v4 = xxhRound(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		hash = rotateLeft(v1, 1) + rotateLeft(v2, 7)
+				+ rotateLeft(v3, 12) + rotateLeft(v4, 18);
+		hash = xxhMergeRound(hash, v1);
+		hash = xxhMergeRound(hash, v2);
+		hash = xxhMergeRound(hash, v3);
+		hash = xxhMergeRound(hash, v4);
+	} else {
+		hash = seed + XXH_PRIME5;
+	}
+
+	hash += (uint64_t) keyLength;
+
+	while (p + 8 <= end) {
+		hash ^= xxhRound(0, read64(p));
+		hash = rotateLeft(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+		p += 8;
+	}
+
+	if (p + 4 <= end) {
+		hash ^= read32(p) * XXH_PRIME1;
+		hash = rotateLeft(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+		p += 4;
+	}
+
+	while (p < end) {
+		hash ^= (*p) * XXH_PRIME5;
+		hash = rotateLeft(hash, 11) * XXH_PRIME1;
+		p++;
+	}
+
+	/** final avalanche */
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+
+/**
+ * Calculate a hash value for a key that is a 4 or 8 byte integer,
+ * taking the whole value in one load and scrambling it with a
+ * single multiply-xorshift avalanche.  Keys of any other length are
+ * passed on to hashByWy(), so this is safe to use on any data.
+ *
+ *  @param  key  key to calculate mapping upon
+ *  @param  keyLength  number of bytes in the key
+ *  @param  seed  the table's secret
+ *  @return      hash value associated with key
  */
+HashValue hashByInteger(AAKeyType key, size_t keyLength, const HashSeed *seed)
+{
+	if (keyLength == 8)
+		return mixHash((read64(key) ^ seed->k0) * (seed->k1 | 1));
 
+	if (keyLength == 4)
+		return mixHash((read32(key) ^ seed->k0) * (seed->k1 | 1));
+
+	return hashByWy(key, keyLength, seed);
+}
 
-HashIndex linearProbe(AssociativeArray *hashTable,
-		AAKeyType key, size_t keylength,
-		int index, int invalidEndsSearch, int *cost
-	)
+
+#define	SIP_ROUND(v0, v1, v2, v3)	do { \
+		v0 += v1; v1 = rotateLeft(v1, 13); v1 ^= v0; v0 = rotateLeft(v0, 32); \
+		v2 += v3; v3 = rotateLeft(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = rotateLeft(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = rotateLeft(v1, 17); v1 ^= v2; v2 = rotateLeft(v2, 32); \
+	} while (0)
+
+/**
+ * Calculate a hash value using SipHash-1-3, a keyed hash designed
+ * so that without the 128 bit key there is no practical way to find
+ * keys that collide.  This is the hash to use for key sets that come
+ * from outside, as no crafted input can force the keys into one
+ * probe chain.  It is slower than wyhash, as it does one round of
+ * mixing per 8 bytes and three more at the end.
+ *
+ *  @param  key  key to calculate mapping upon
+ *  @param  keyLength  number of bytes in the key
+ *  @param  seed  the table's secret, used as the SipHash key
+ *  @return      hash value associated with key
+ */
+HashValue hashBySip(AAKeyType key, size_t keyLength, const HashSeed *seed)
 {
-	/**
-	 * We will need to implement an algorithm
-	 * that probes until it finds an "empty" slot in
-	 * the hashTable.  Note that because of tombstones,
-	 * there are multiple ways of a slot being empty.
-	 * Additionally, the "index" value may
-	 * already be valid on entry.
-	 *
-	 * Note that if an empty place cannot be found,
-	 * we are to return (-1).
-	 *
-	 * For this routine, we will implement a "linear" probing
-	 * strategy.
-	 */
-
-    // Initial step size for linear probing (1 means moving to the next slot)
-    int start = index;
-
-	// Note that 0 represents HASH_EMPTY, 1 representents HASH_USED, and 2 HASH_DELETED, as seen in hashtools.h
-    while (hashTable->table[start].validity != 0 && (invalidEndsSearch || hashTable->table[start].validity == 2)) 
-	{
-        start = (start + 1) % hashTable->size;
-        (*cost)++;
-
-        if (start == index) 
-		{
-            fprintf(stderr, "Hash table full\n");
-            return -1;
-        }
-    }
-	return start;
+	const unsigned char *p = key;
+	const unsigned char *end = p + (keyLength & ~(size_t) 7);
+	uint64_t v0 = seed->k0 ^ UINT64_C(0x736f6d6570736575);
+	uint64_t v1 = seed->k1 ^ UINT64_C(0x646f72616e646f6d);
+	uint64_t v2 = seed->k0 ^ UINT64_C(0x6c7967656e657261);
+	uint64_t v3 = seed->k1 ^ UINT64_C(0x7465646279746573);
+	uint64_t m;
+	int i;
+
+	for ( ; p < end; p += 8) {
+		m = read64(p);
+		v3 ^= m;
+		SIP_ROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	/** the last 0-7 bytes, with the length in the top byte */
+	m = ((uint64_t) keyLength) << 56;
+	for (i = (int) (keyLength & 7) - 1; i >= 0; i--)
+		m |= ((uint64_t) p[i]) << (8 * i);
+
+	v3 ^= m;
+	SIP_ROUND(v0, v1, v2, v3);
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
+/** one step of the splitmix64 generator */
+static uint64_t splitMix(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+/**
+ * A seed no one can guess: from the system's random source if it
+ * has one, or else from whatever varies between runs.
+ */
+static uint64_t randomSeed(void)
+{
+	static uint64_t counter = 0;
+	uint64_t seed = 0;
+	FILE *fp;
+
+	fp = fopen("/dev/urandom", "rb");
+	if (fp != NULL) {
+		if (fread(&seed, sizeof(seed), 1, fp) != 1)
+			seed = 0;
+		fclose(fp);
+	}
+
+	if (seed == 0) {
+		seed = (uint64_t) time(NULL) ^ ((uint64_t) clock() << 32)
+				^ (uint64_t) (uintptr_t) &seed ^ mixHash(++counter);
+	}
+	return seed;
+}
+
+/**
+ * The seed to give to several tables that must all hash a key the
+ * same way: the configured seed, or one random seed for them all.
+ */
+uint64_t sharedTableSeed(uint64_t seed)
+{
+	HashSeed primary, secondary;
+
+	if (seed != 0)
+		return seed;
+
+	expandHashSeeds(0, &primary, &secondary);
+	return (primary.k0 != 0) ? primary.k0 : 1;
+}
+
+/**
+ * Turn the seed given in a table's configuration (zero meaning
+ * "pick one at random") into independent secrets for the primary
+ * and secondary hash functions.
+ *
+ *  @return a non-zero value to start the table's random number
+ *				generator with
+ */
+uint64_t expandHashSeeds(uint64_t seed, HashSeed *primary, HashSeed *secondary)
+{
+	uint64_t state = (seed != 0) ? seed : randomSeed();
+	uint64_t random;
+
+	primary->k0 = splitMix(&state);
+	primary->k1 = splitMix(&state);
+	secondary->k0 = splitMix(&state);
+	secondary->k1 = splitMix(&state);
+
+	random = splitMix(&state);
+	return (random != 0) ? random : 1;
 }
 
 
 /**
- * Locate an empty position in the given array, starting the
- * search at the indicated index, and restricting the search
- * to locations in the range [0...size-1]
+ * Move a probe sequence on to the next slot, one slot at a time,
+ * wrapping around at the end of the table.  Visits every slot.
  *
- *  @param  index where to begin the search
- *  @param  hashTable associated HashTable we are probing
- *  @param  invalidEndsSearch should the identification of a
- *				KeyDataPair marked invalid end our search?
- *				This is true if we are looking for a location
- *				to insert new data
- *  @return index of location where search stopped, or -1 if
- *				search failed
+ *  @param  hashTable associated AssociativeArray we are probing
+ *  @param  probe  the sequence to advance
  *
  *  @see    HashProbe
  */
-
-HashIndex quadraticProbe(AssociativeArray *hashTable, AAKeyType key, size_t keylen,
-		int startIndex, int invalidEndsSearch,
-		int *cost
-	)
+void linearProbe(AssociativeArray *hashTable, ProbeSequence *probe)
 {
-	/**
-	 * We will need to implement an algorithm
-	 * that probes until it finds an "empty" slot in
-	 * the hashTable.  Note that because of tombstones,
-	 * there are multiple ways of a slot being empty.
-	 * Additionally, the "index" value may
-	 * already be valid on entry.
-	 *
-	 * Note that if an empty place cannot be found,
-	 * we are to return (-1).
-	 *
-	 * For this routine, we will implement a "quadratic" probing
-	 * strategy.
-	 */
-
-
-    int start = startIndex;
-
-	// Note that 0 represents HASH_EMPTY, 1 representents HASH_USED, and 2 HASH_DELETED, as seen in hashtools.h
-    while (hashTable->table[start].validity != 0 && (invalidEndsSearch || hashTable->table[start].validity == 2)) 
-	{
-        start = (start *2) % hashTable->size;
-        (*cost)++;
-
-        if (start == startIndex) 
-		{
-            fprintf(stderr, "Hash table full\n");
-            return -1;
-        }
-    }
-	return start;
+	// wrap around at the end of the table without a division
+	probe->index = (probe->index + 1 == hashTable->size) ? 0 : probe->index + 1;
+	probe->nProbes++;
 }
 
 
 /**
- * Locate an empty position in the given array, starting the
- * search at the indicated index, and restricting the search
- * to locations in the range [0...size-1]
+ * Move a probe sequence on by 1, 2, 3, ... slots in turn, so the
+ * offsets from the home slot are the triangular numbers i(i+1)/2.
+ * This visits every slot of a power of two sized table, and at
+ * least half of the slots of a prime sized one.
  *
- *  @param  index where to begin the search
- *  @param  hashTable associated HashTable we are probing
- *  @param  invalidEndsSearch should the identification of a
- *				KeyDataPair marked invalid end our search?
- *				This is true if we are looking for a location
- *				to insert new data
- *  @return index of location where search stopped, or -1 if
- *				search failed
+ *  @param  hashTable associated AssociativeArray we are probing
+ *  @param  probe  the sequence to advance
  *
  *  @see    HashProbe
  */
+void quadraticProbe(AssociativeArray *hashTable, ProbeSequence *probe)
+{
+	probe->nProbes++;
+
+	// the increment is always less than the size, so one subtraction wraps
+	probe->index += probe->nProbes % hashTable->size;
+	if (probe->index >= hashTable->size)
+		probe->index -= hashTable->size;
+}
 
-HashIndex doubleHashProbe(AssociativeArray *hashTable, AAKeyType key, size_t keylen,
-		int startIndex, int invalidEndsSearch,
-		int *cost
-	)
+
+/**
+ * Move a probe sequence on by a stride taken from the secondary
+ * hash of the key.  The stride is chosen to be relatively prime to
+ * the table size -- anything in [1...size-1] for a prime size, or
+ * any odd value for a power of two -- so that every slot is visited.
+ * The secondary hash is only computed on the first collision.
+ *
+ *  @param  hashTable associated AssociativeArray we are probing
+ *  @param  probe  the sequence to advance
+ *
+ *  @see    HashProbe
+ */
+void doubleHashProbe(AssociativeArray *hashTable, ProbeSequence *probe)
 {
-	/**
-	 * We will need to implement an algorithm
-	 * that calls a second hash function (listed
-	 * in the hashTable) and uses the value obtained
-	 * as a result from that as the step size.
-	 *
-	 * Beyond that, the algorithm proceeds as with
-	 * the above strategies.
-	 */
-
-	while(1)
-	{
-		KeyDataPair *pair = &hashTable->table[startIndex];
-
-        // Check if current slot is empty or deleted
-		// Note that 0 represents HASH_EMPTY, 1 representents HASH_USED, and 2 HASH_DELETED, as seen in hashtools.h
-        if (pair->validity == 0 || pair->validity == 2) 
-		{
-            return startIndex;  // Empty or deleted slot
-        }
-
-        // Check if the current slot is invalid and should end the search
-        if (invalidEndsSearch && pair->validity == 1) 
-		{
-            return -1;  // Search should end
-        }	
-
-		startIndex = hashTable->hashAlgorithmSecondary(key, keylen, hashTable->size);
-		(*cost)++;
+	if (probe->step == 0) {
+		HashValue secondary = hashTable->hashAlgorithmSecondary(probe->key, probe->keylen,
+				&hashTable->seedSecondary);
+
+		if (hashTable->sizer.mask != 0)
+			probe->step = (secondary & hashTable->sizer.mask) | 1;
+		else
+			probe->step = 1 + secondary % (hashTable->size - 1);
 	}
 
-	return -1;
+	probe->index += probe->step;
+	if (probe->index >= hashTable->size)
+		probe->index -= hashTable->size;
+	probe->nProbes++;
 }
@@ -7,8 +7,23 @@
 #include "hashtools.h"
 
 /** forward declaration */
-static HashAlgorithm lookupNamedHashStrategy(const char *name);
-static HashProbe lookupNamedProbingStrategy(const char *name);
+static const TableLayout *lookupNamedProbingStrategy(const char *name, HashProbe *probe);
+static size_t sizeTable(TableSizer *sizer, const TableLayout *layout,
+		size_t requestedSize, AASizingMode mode);
+
+/**
+ * Fill in a configuration structure with the default settings
+ */
+void
+aaInitConfig(AAConfig *config)
+{
+	config->maxLoadFactor = AA_DEFAULT_MAX_LOAD_FACTOR;
+	config->minLoadFactor = AA_DEFAULT_MIN_LOAD_FACTOR;
+	config->sizingMode = AA_SIZE_PRIME;
+	config->keyStorage = AA_KEYS_HEAP;
+	config->seed = 0;
+	config->lockFreeReads = 0;
+}
 
 /**
  * Create a hash table of the given size,
@@ -19,14 +34,13 @@ static HashProbe lookupNamedProbingStrategy(const char *name);
  *  @param  probingStrategy algorithm used for probing in the case of
  *				collisions
  *  @param  newHashSize  the size of the table (will be rounded up
- *				to the next-nearest larger prime, but see exception)
+ *				to the next-nearest larger prime)
  *  @see         HashAlgorithm
  *  @see         HashProbe
  *  @see         Primes
  *
- *  @throws java.lang.IndexOutOfBoundsException if no prime number larger
- *				than newHashSize can be found (currently only primes
- *				less than 5000 are known)
+ *  @return      the new table, or NULL if no table of that size
+ *				can be allocated
  */
 AssociativeArray *
 aaCreateAssociativeArray(
@@ -35,8 +49,32 @@ aaCreateAssociativeArray(
 		char *hashPrimary,
 		char *hashSecondary
 	)
+{
+	AAConfig config;
+
+	aaInitConfig(&config);
+	return aaCreateAssociativeArrayWithConfig(size,
+			probingStrategy, hashPrimary, hashSecondary, &config);
+}
+
+/**
+ * Create a hash table as above, but using the load factor limits
+ * given in the configuration to decide when the table should
+ * grow or shrink, and the sizing mode to decide whether the table
+ * is a prime or a power of two in size.  The initial size is also
+ * the smallest size the table will ever shrink back down to.
+ */
+AssociativeArray *
+aaCreateAssociativeArrayWithConfig(
+		size_t size,
+		char *probingStrategy,
+		char *hashPrimary,
+		char *hashSecondary,
+		const AAConfig *config
+	)
 {
 	AssociativeArray *newTable;
+	AASizingMode sizingMode;
 
 	newTable = (AssociativeArray *) malloc(sizeof(AssociativeArray));
 
@@ -44,25 +82,79 @@ aaCreateAssociativeArray(
 	newTable->hashNamePrimary = strdup(hashPrimary);
 	newTable->hashAlgorithmSecondary = lookupNamedHashStrategy(hashSecondary);
 	newTable->hashNameSecondary = strdup(hashSecondary);
-	newTable->hashProbe = lookupNamedProbingStrategy(probingStrategy);
+	newTable->layout = lookupNamedProbingStrategy(probingStrategy, &newTable->hashProbe);
 	newTable->probeName = strdup(probingStrategy);
+	newTable->control = NULL;
+	newTable->snapshot = NULL;
+	newTable->log = NULL;
+	newTable->cache = NULL;
+
+	/** some layouts only work with tables that are a power of two in size */
+	sizingMode = config->sizingMode;
+	if (newTable->layout->minimumSize > 0) {
+		if (sizingMode == AA_SIZE_PRIME)
+			sizingMode = AA_SIZE_POW2_MASK;
+		if (size < newTable->layout->minimumSize)
+			size = newTable->layout->minimumSize;
+	}
 
-	newTable->size = getLargerPrime(size);
+	newTable->size = sizeTable(&newTable->sizer, newTable->layout, size, sizingMode);
 
 	if (newTable->size < 1) {
 		fprintf(stderr, "Cannot create table of size %ld\n", (long) size);
+		free(newTable->hashNamePrimary);
+		free(newTable->hashNameSecondary);
+		free(newTable->probeName);
 		free(newTable);
 		return NULL;
 	}
 
-	newTable->table = (KeyDataPair *) malloc(newTable->size * sizeof(KeyDataPair));
-
-	/** initialize everything with zeros */
-	memset(newTable->table, 0, newTable->size * sizeof(KeyDataPair));
+	newTable->table = (KeyDataPair *) calloc(newTable->size, sizeof(KeyDataPair));
+	if (newTable->table == NULL
+			|| (newTable->layout->allocate != NULL
+				&& newTable->layout->allocate(newTable) < 0)) {
+		fprintf(stderr, "Cannot allocate table of size %zu\n", newTable->size);
+		free(newTable->table);
+		free(newTable->hashNamePrimary);
+		free(newTable->hashNameSecondary);
+		free(newTable->probeName);
+		free(newTable);
+		return NULL;
+	}
 
 	newTable->nEntries = 0;
+	newTable->nDeleted = 0;
+	newTable->randomState = expandHashSeeds(config->seed,
+			&newTable->seedPrimary, &newTable->seedSecondary);
+	newTable->keysInArena = (config->keyStorage == AA_KEYS_ARENA);
+	newTable->lockFreeReads = 0;
+	memset(&newTable->arena, 0, sizeof(KeyArena));
+	newTable->minimumSize = newTable->size;
+	newTable->nResizes = 0;
+
+	/**
+	 * the maximum must leave at least one free slot, and the minimum
+	 * must be less than half of the maximum, so that a table that
+	 * has just shrunk by half is not immediately over the limit
+	 */
+	newTable->maxLoadFactor = config->maxLoadFactor;
+	if (newTable->maxLoadFactor <= 0 || newTable->maxLoadFactor >= 1) {
+		fprintf(stderr, "Invalid maximum load factor %g - using %g\n",
+				config->maxLoadFactor, AA_DEFAULT_MAX_LOAD_FACTOR);
+		newTable->maxLoadFactor = AA_DEFAULT_MAX_LOAD_FACTOR;
+	}
+	newTable->minLoadFactor = config->minLoadFactor;
+	if (newTable->minLoadFactor < 0
+			|| newTable->minLoadFactor >= newTable->maxLoadFactor / 2) {
+		fprintf(stderr, "Invalid minimum load factor %g - disabling shrinking\n",
+				config->minLoadFactor);
+		newTable->minLoadFactor = 0;
+	}
 
-	newTable->insertCost = newTable->searchCost = newTable->deleteCost = 0;
+	memset(&newTable->insertStats, 0, sizeof(AAOperationStats));
+	memset(&newTable->hitStats, 0, sizeof(AAOperationStats));
+	memset(&newTable->missStats, 0, sizeof(AAOperationStats));
+	memset(&newTable->deleteStats, 0, sizeof(AAOperationStats));
 
 	return newTable;
 }
@@ -81,21 +173,43 @@ aaDeleteAssociativeArray(AssociativeArray *aarray)
         return; // nothing to delete
     }
 
+    //write out whatever is still waiting to be logged
+    aaDetachLog(aarray);
+    releaseCache(aarray->cache);
+
     //free dynamically allocated strings
     free(aarray->hashNamePrimary);
     free(aarray->hashNameSecondary);
     free(aarray->probeName);
 
-    //free memory for keys and values
-    for (int i = 0; i < aarray->size; i++) 
-	{
-        if (aarray->table[i].validity == HASH_USED) 
-		{
-            free(aarray->table[i].key);
+    //a snapshot owns no keys, just the mapping they are in
+    if (aarray->snapshot != NULL)
+    {
+        releaseSnapshot(aarray->snapshot);
+        free(aarray);
+        return;
+    }
+
+    //free memory for keys that did not fit in their slots; keys
+    //in the arena all go at once, without visiting every slot
+    if (aarray->keysInArena)
+    {
+        releaseKeyArena(&aarray->arena);
+    }
+    else
+    {
+        for (size_t i = 0; i < aarray->size; i++) 
+        {
+            if (aarray->table[i].validity == HASH_USED) 
+            {
+                releaseSlotKey(aarray, &aarray->table[i]);
+            }
         }
     }
 
-    //free table of KeyDataPairs
+    //free table of KeyDataPairs, and anything the layout keeps alongside it
+    if (aarray->layout->release != NULL)
+        aarray->layout->release(aarray);
     free(aarray->table);
 
     //free the AssociativeArray
@@ -111,12 +225,15 @@ int aaIterateAction(
 		void *userdata
 	)
 {
-	int i;
+	size_t i;
+
+	if (aarray->snapshot != NULL)
+		return snapshotIterate(aarray, userfunction, userdata);
 
 	for (i = 0; i < aarray->size; i++) {
 		if (aarray->table[i].validity == HASH_USED) {
 			if ((*userfunction)(
-					aarray->table[i].key,
+					slotKey(&aarray->table[i]),
 					aarray->table[i].keylen,
 					aarray->table[i].value,
 					userdata) < 0) {
@@ -128,7 +245,7 @@ int aaIterateAction(
 }
 
 /** utilities to change names into functions, used in the function above */
-static HashAlgorithm lookupNamedHashStrategy(const char *name)
+HashAlgorithm lookupNamedHashStrategy(const char *name)
 {
 	if (strncmp(name, "sum", 3) == 0) 
 	{
@@ -144,208 +261,676 @@ static HashAlgorithm lookupNamedHashStrategy(const char *name)
 		return hashByXOR;
 	}
 
+	else if (strncmp(name, "wyh", 3) == 0) {
+		return hashByWy;
+	}
+
+	else if (strncmp(name, "xxh", 3) == 0) {
+		return hashByXXH64;
+	}
+
+	else if (strncmp(name, "int", 3) == 0) {
+		return hashByInteger;
+	}
+
+	else if (strncmp(name, "sip", 3) == 0) {
+		return hashBySip;
+	}
+
 	fprintf(stderr, "Invalid hash strategy '%s' - using 'sum'\n", name);
 	return hashBySum;
 }
 
-/** utilities to change names into functions, used in the function above */
-static HashProbe lookupNamedProbingStrategy(const char *name)
+/**
+ * utilities to change names into functions, used in the function above.
+ * Besides the probe strategies used by plain open addressing, the
+ * name may select an entirely different table layout.
+ */
+static const TableLayout *lookupNamedProbingStrategy(const char *name, HashProbe *probe)
 {
+	*probe = NULL;
+
 	if (strncmp(name, "lin", 3) == 0) {
-		return linearProbe;
+		*probe = linearProbe;
 	} 
 	
 	else if (strncmp(name, "qua", 3) == 0) {
-		return quadraticProbe;
+		*probe = quadraticProbe;
 	} 
 	
 	else if (strncmp(name, "dou", 3) == 0) {
-		return doubleHashProbe;
+		*probe = doubleHashProbe;
+	}
+
+	else if (strncmp(name, "swi", 3) == 0) {
+		return &swissLayout;
+	}
+
+	else if (strncmp(name, "rob", 3) == 0) {
+		return &robinHoodLayout;
+	}
+
+	else if (strncmp(name, "cuc", 3) == 0) {
+		return &cuckooLayout;
+	}
+
+	else {
+		fprintf(stderr, "Invalid hash probe strategy '%s' - using 'linear'\n", name);
+		*probe = linearProbe;
+	}
+
+	return &probingLayout;
+}
+
+/**
+ * Start a probe sequence at the home slot of a key.
+ */
+static inline void startProbe(AssociativeArray *aarray, ProbeSequence *probe,
+		AAKeyType key, size_t keylen, HashValue hash)
+{
+	probe->index = reduceHash(&aarray->sizer, hash);
+	probe->step = 0;
+	probe->nProbes = 0;
+	probe->key = key;
+	probe->keylen = keylen;
+}
+
+/**
+ * Place an entry (whose key memory the table already owns)
+ * in the first free slot found along the probe sequence.
+ * Gives up once the sequence has been followed for as many
+ * steps as there are slots.
+ *
+ *  @return      the location the data is placed within the hash table,
+ *				 or a negative number if no place can be found
+ */
+static long probingInsert(AssociativeArray *aarray,
+		KeyDataPair *entry, HashValue hash, int *insertCost)
+{
+	ProbeSequence probe;
+	KeyDataPair *slot;
+
+	startProbe(aarray, &probe, slotKey(entry), entry->keylen, hash);
+
+	while (probe.nProbes < aarray->size) {
+		slot = &aarray->table[probe.index];
+
+		/**
+		 * Either an empty slot or a tombstone can be reused -- unless
+		 * readers that take no lock may still be comparing the key
+		 * left in the tombstone
+		 */
+		if (slot->validity == HASH_EMPTY
+				|| (slot->validity == HASH_DELETED && ! aarray->lockFreeReads)) {
+			if (slot->validity == HASH_DELETED)
+				aarray->nDeleted--;
+
+			publishSlot(slot, entry);
+			aarray->nEntries++;
+			(*insertCost) += probe.nProbes;
+
+			return (long) probe.index;
+		}
+
+		aarray->hashProbe(aarray, &probe);
+	}
+
+	(*insertCost) += probe.nProbes;
+	return -1;
+}
+
+/**
+ * Locates the KeyDataPair associated with the given key, if
+ * present in the table, following the same probe sequence as
+ * probingInsert() and walking past any tombstones.
+ *
+ *  @param  key  the key to search for
+ *  @param  hash  the primary hash value of the key
+ *  @return      the KeyDataPair containing the key, if the key
+ *				 was present in the table, or NULL, if it was not
+ */
+static KeyDataPair *probingFind(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash, int *cost)
+{
+	ProbeSequence probe;
+	KeyDataPair *slot;
+	int validity;
+
+	startProbe(aarray, &probe, key, keylen, hash);
+
+	while (probe.nProbes < aarray->size) {
+		slot = &aarray->table[probe.index];
+		validity = slotValidity(slot);
+
+		// An empty slot means the key was never placed further on
+		if (validity == HASH_EMPTY)
+			return NULL;
+
+		if (validity == HASH_USED && slotHoldsKey(slot, key, keylen, hash))
+			return slot;
+
+		aarray->hashProbe(aarray, &probe);
+		(*cost)++;
+	}
+
+	// The whole sequence has been searched, key not found
+	return NULL;
+}
+
+/**
+ * Deletion algorithm based on tombstones: the slot must still
+ * be stepped over by searches, but may be reused by inserts.
+ */
+static void probingRemove(AssociativeArray *aarray, KeyDataPair *slot)
+{
+	__atomic_store_n(&slot->validity, HASH_DELETED, __ATOMIC_RELEASE);
+	aarray->nDeleted++;
+}
+
+/** the open addressing layout that uses the named probe strategies */
+const TableLayout probingLayout = {
+		"open addressing",
+		0,
+		1,
+		NULL,
+		NULL,
+		probingInsert,
+		probingFind,
+		prefetchHomeSlot,
+		probingRemove
+	};
+
+/**
+ * Size the table for at least the requested number of slots,
+ * rounding up to whole buckets for layouts that use them.
+ *
+ *  @return      the number of slots, or zero if no table of that
+ *				 size can be described
+ */
+static size_t sizeTable(TableSizer *sizer, const TableLayout *layout,
+		size_t requestedSize, AASizingMode mode)
+{
+	size_t buckets = (requestedSize + layout->bucketSlots - 1) / layout->bucketSlots;
+
+	return initTableSizer(sizer, buckets, mode) * layout->bucketSlots;
+}
+
+/**
+ * The slot to start a sweep over the whole table at: an empty one,
+ * so that no run of slots in use is split across the end of the
+ * table.  Copies of a key in a linear probing run then come out in
+ * the order a search reaches them, and inserting them in that order
+ * into an empty table lines them up the same way again.
+ */
+size_t sweepStart(AssociativeArray *aarray)
+{
+	size_t i;
+
+	for (i = 0; i < aarray->size; i++) {
+		if (aarray->table[i].validity == HASH_EMPTY)
+			return i;
+	}
+	return 0;
+}
+
+/** free the slot array, and anything the layout keeps alongside it */
+static void releaseSlotArrays(AssociativeArray *aarray)
+{
+	if (aarray->layout->release != NULL)
+		aarray->layout->release(aarray);
+	free(aarray->table);
+}
+
+/**
+ * Give the table freshly allocated slot arrays of (at least) the
+ * given size, and move every entry into them, dropping all of the
+ * tombstones on the way.  The keys are owned by the table already,
+ * so are simply moved.  The old slot arrays are left as they were;
+ * it is up to the caller to release them.
+ *
+ *  @return      1 on success, or -1 if the new table could not be
+ *				 built, in which case the table is left untouched
+ */
+static int rehashInto(AssociativeArray *aarray, size_t newSize)
+{
+	AssociativeArray oldTable = *aarray;
+	const TableLayout *layout = aarray->layout;
+	int rehashCost = 0;
+	KeyDataPair entry;
+	size_t start, n, i;
+
+	newSize = sizeTable(&aarray->sizer, layout, newSize, oldTable.sizer.mode);
+	if (newSize < 1 || newSize <= oldTable.nEntries) {
+		*aarray = oldTable;
+		return -1;
+	}
+
+	aarray->table = (KeyDataPair *) calloc(newSize, sizeof(KeyDataPair));
+	if (aarray->table == NULL) {
+		*aarray = oldTable;
+		return -1;
+	}
+	aarray->size = newSize;
+	aarray->nEntries = 0;
+	aarray->nDeleted = 0;
+
+	if (layout->allocate != NULL && layout->allocate(aarray) < 0) {
+		free(aarray->table);
+		*aarray = oldTable;
+		return -1;
+	}
+
+	start = sweepStart(&oldTable);
+	for (n = 0; n < oldTable.size; n++) {
+		i = (start + n) % oldTable.size;
+		if (oldTable.table[i].validity != HASH_USED)
+			continue;
+
+		/** the stored hash saves us from touching the key at all */
+		entry = oldTable.table[i];
+		if (layout->insert(aarray, &entry, entry.hash, &rehashCost) < 0) {
+			/** put the old table back and leave it as it was */
+			if (layout->release != NULL)
+				layout->release(aarray);
+			free(aarray->table);
+			*aarray = oldTable;
+			return -1;
+		}
+	}
+
+	aarray->nResizes++;
+	return 1;
+}
+
+/**
+ * Rehash the table into new slot arrays of (at least) the given size.
+ *
+ *  @return      1 on success, or -1 if the new table could not be
+ *				 built, in which case the old table is left untouched
+ */
+static int rehashTable(AssociativeArray *aarray, size_t newSize)
+{
+	AssociativeArray oldTable = *aarray;
+
+	if (rehashInto(aarray, newSize) < 0)
+		return -1;
+
+	releaseSlotArrays(&oldTable);
+	return 1;
+}
+
+/**
+ * Build a rehashed copy of the table, leaving the original intact
+ * so that readers may carry on using it.  The copy takes over the
+ * keys, names and key arena of the original, so once the copy has
+ * replaced it, the original must only be freed with
+ * releaseTableShell().
+ *
+ *  @return      the copy, or NULL if it could not be built
+ */
+AssociativeArray *cloneTable(AssociativeArray *aarray, size_t newSize)
+{
+	AssociativeArray *clone;
+
+	clone = (AssociativeArray *) malloc(sizeof(AssociativeArray));
+	if (clone == NULL)
+		return NULL;
+
+	*clone = *aarray;
+	if (rehashInto(clone, newSize) < 0) {
+		free(clone);
+		return NULL;
 	}
+	return clone;
+}
+
+/** free a table whose contents have been taken over by cloneTable() */
+void releaseTableShell(AssociativeArray *aarray)
+{
+	releaseSlotArrays(aarray);
+	free(aarray);
+}
+
+/**
+ * The size to rehash to if the slots in use (live entries plus
+ * tombstones) would pass the maximum load factor with one more
+ * entry, or zero if there is room as it stands.  If the live
+ * entries alone are well under the limit, rehashing at the same
+ * size is enough to clear out the tombstones; otherwise the
+ * table doubles.
+ */
+size_t grownTableSize(AssociativeArray *aarray)
+{
+	double limit = aarray->maxLoadFactor * aarray->size;
+
+	if (aarray->nEntries + aarray->nDeleted + 1 <= limit)
+		return 0;
 
-	fprintf(stderr, "Invalid hash probe strategy '%s' - using 'linear'\n", name);
-	return linearProbe;
+	if (aarray->nEntries + 1 <= limit / 2)
+		return aarray->size;
+	return aarray->size * 2;
+}
+
+/**
+ * Size the table up front for the given number of further entries,
+ * so that adding them one at a time does not rehash the table again
+ * and again on the way.  If the table cannot be grown, it is left as
+ * it is, and will grow as the entries are added in the usual way.
+ */
+void reserveTable(AssociativeArray *aarray, size_t nMore)
+{
+	double needed = (aarray->nEntries + nMore) / aarray->maxLoadFactor;
+
+	if (aarray->nEntries + aarray->nDeleted + nMore <= aarray->maxLoadFactor * aarray->size)
+		return;
+
+	rehashTable(aarray, (size_t) needed + 1);
+}
+
+/**
+ * Make room for one more entry if the table is too full.
+ *
+ * If the table cannot be grown we simply carry on with the
+ * current table, which may well still have room.
+ */
+static void growIfNeeded(AssociativeArray *aarray)
+{
+	size_t newSize = grownTableSize(aarray);
+
+	if (newSize > 0)
+		rehashTable(aarray, newSize);
+}
+
+/**
+ * Halve the table if the live entries have dropped below the
+ * minimum load factor, but never below the size it was created with
+ */
+static void shrinkIfNeeded(AssociativeArray *aarray)
+{
+	size_t newSize;
+
+	if (aarray->minLoadFactor <= 0 || aarray->size <= aarray->minimumSize)
+		return;
+
+	if (aarray->nEntries >= aarray->minLoadFactor * aarray->size)
+		return;
+
+	newSize = aarray->size / 2;
+	if (newSize < aarray->minimumSize)
+		newSize = aarray->minimumSize;
+
+	rehashTable(aarray, newSize);
 }
 
 /**
  * Add another key and data value to the table, provided there is room.
+ * The table will grow to make room if it is loaded past its
+ * maximum load factor, or if the layout cannot find a place
+ * for the key in the table as it stands.
  *
  *  @param  key  a string value used for searching later
  *  @param  value a data value associated with the key
  *  @return      the location the data is placed within the hash table,
  *				 or a negative number if no place can be found
  */
-int aaInsert(AssociativeArray *aarray, AAKeyType key, size_t keylen, void *value)
-{
-	// Compute the initial hash index using the primary hash function
-    HashIndex index = aarray->hashAlgorithmPrimary(key, keylen, aarray->size);
-    
-    // Initialize insert cost and record the initial index
-	int cost =0;
-    HashIndex initialindex = index;
-
-    // Allocate memory for a copied key
-    AAKeyType copiedKey = malloc(keylen + 1);
-    if (copiedKey == NULL) {
-        return -1; // Memory allocation failure
-    }
+long aaInsert(AssociativeArray *aarray, AAKeyType key, size_t keylen, void *value)
+{
+	long index;
 
-    // Copy the key and null-terminate the copied key
-    memcpy(copiedKey, key, keylen);
+	if (aarray->snapshot != NULL) {
+		fprintf(stderr, "Cannot insert into a table opened from a snapshot\n");
+		return -1;
+	}
 
-    while (1) {
-        // Check if the current slot is empty (0) or has a tombstone (-1).
-        if (aarray->table[index].validity == HASH_EMPTY || aarray->table[index].validity == HASH_DELETED) 
-		{
-            // Insert the key, value, and update metadata
-            aarray->table[index].key = copiedKey;
-            aarray->table[index].keylen = keylen;
-            aarray->table[index].value = value;
-            aarray->table[index].validity = HASH_USED;
-            aarray->nEntries++;
-			cost++;
-			aarray->insertCost += cost;
-            
-            // Update insert cost and free the copied key memory before returning
-            return index;
-        }
+	index = insertHashed(aarray, key, keylen, value,
+			aarray->hashAlgorithmPrimary(key, keylen, &aarray->seedPrimary),
+			NULL);
+	if (index >= 0 && aarray->log != NULL)
+		logOperation(aarray->log, 1, key, keylen, value);
+	return index;
+}
 
-        // Use the hash probing strategy to find the next available slot
-        index = aarray->hashProbe(aarray, key, keylen, index, 1, &aarray->insertCost);
+/**
+ * The work of aaInsert(), for a key whose primary hash is already
+ * known.  The probing cost is counted in the table's statistics,
+ * and also added to the given counter, if there is one.
+ */
+long insertHashed(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		void *value, HashValue hash, int *cost)
+{
+	KeyDataPair entry;
+	int probes = 0;
+	long index;
 
-        // If we have cycled through the entire table and haven't found an empty slot, return -1
-        if (index == initialindex) {
-			aarray->insertCost += cost;
-            return -1;
-        }
-    }
-	free(copiedKey);
+	/** a full cache makes room by evicting, rather than growing */
+	if (aarray->cache != NULL && cacheMakeRoom(aarray, key, keylen, value, hash) < 0)
+		return -1;
+
+	growIfNeeded(aarray);
+
+	// Copy the key, into the slot itself if it is short enough
+	memset(&entry, 0, sizeof(entry));
+	if (storeSlotKey(aarray, &entry, key, keylen) < 0) {
+		return -1; // Memory allocation failure
+	}
+	entry.value = value;
+	entry.hash = hash;
+	index = aarray->layout->insert(aarray, &entry, hash, &probes);
+
+	/**
+	 * A failed insert leaves the table unchanged, so grow and try
+	 * again -- but only if the table is reasonably full, as in a
+	 * lightly loaded table the failure is down to the hash values
+	 * colliding, which a bigger table will not fix.
+	 */
+	if (index < 0 && aarray->nEntries + 1 > aarray->maxLoadFactor * aarray->size / 2
+			&& rehashTable(aarray, aarray->size * 2) > 0) {
+		index = aarray->layout->insert(aarray, &entry, hash, &probes);
+	}
+
+	countProbes(&aarray->insertStats, probes);
+	if (cost != NULL)
+		(*cost) += probes;
+
+	if (index < 0) {
+		releaseSlotKey(aarray, &entry);
+	} else if (aarray->cache != NULL) {
+		cacheAdded(aarray, keylen, value);
+	}
+	return index;
 }
 
 
 
 /**
- * Locates the KeyDataPair associated with the given key, if
+ * Locates the value associated with the given key, if
  * present in the table.
  *
  *  @param  key  the key to search for
- *  @return      the KeyDataPair containing the key, if the key
+ *  @return      the value stored with the key, if the key
  *				 was present in the table, or NULL, if it was not
  *  @see         KeyDataPair
  */
 void *aaLookup(AssociativeArray *aarray, AAKeyType key, size_t keylen)
 {
+	HashValue hash = aarray->hashAlgorithmPrimary(key, keylen, &aarray->seedPrimary);
+	KeyDataPair *slot;
 
-    HashIndex index = aarray->hashAlgorithmPrimary(key, keylen, aarray->size);
-    int startIndex = index;
-    int cost = 0;
+	if (aarray->snapshot != NULL)
+		return snapshotLookup(aarray, key, keylen, hash);
 
-    while (aarray->table[index].validity != HASH_EMPTY) 
-    {
-        // Check if the current slot is marked as deleted
-        if (aarray->table[index].validity == HASH_DELETED) 
-        {
-            // This means the key is not in the table
-            index++;
-			cost++;
-			aarray->searchCost+= cost;
-            if (index == startIndex) 
-            {
-                return NULL; // The entire table has been searched, key not found
-            }
-            continue;
-        }
+	slot = findHashed(aarray, key, keylen, hash);
+	if (slot == NULL) {
+		return NULL;
+	}
+	return slot->value;
+}
 
-        // Check if the current slot matches the key
-        if (aarray->table[index].keylen == keylen && memcmp(aarray->table[index].key, key, keylen) == 0) 
-        {
-            return aarray->table[index].value; // Key found, return the associated value
-        }
+/**
+ * The search of aaLookup(), for a key whose primary hash is already
+ * known, counting the probing cost as a hit or a miss.
+ */
+KeyDataPair *findHashed(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashValue hash)
+{
+	KeyDataPair *slot;
+	int probes = 0;
 
-        // If the current slot doesn't match the key, handle collision
-        // Use the same probing strategy as in aaInsert to find the next slot
-        index++;
-		cost++;
-		aarray->searchCost+= cost;
-        if (index == startIndex) 
-        {
-            return NULL; // The entire table has been searched, key not found
-        }
-    }
+	slot = aarray->layout->find(aarray, key, keylen, hash, &probes);
+	countProbes((slot != NULL) ? &aarray->hitStats : &aarray->missStats, probes);
 
-    // Key not found
-    return NULL;
+	/** only written when clear, so a hot entry's line is not dirtied again and again */
+	if (slot != NULL && aarray->cache != NULL && ! slot->referenced)
+		slot->referenced = 1;
+	return slot;
 }
 
+/**
+ * Looks up a batch of keys, each in the table the chooser picks for
+ * it.  The keys are taken a window at a time: every key in the
+ * window is hashed and the memory its search starts at is
+ * prefetched, and only then are the searches done, so that the
+ * cache misses of independent keys overlap rather than being waited
+ * for one after another.
+ *
+ *  @return      the number of keys that were found
+ */
+size_t lookupBatch(BatchTableChooser chooseTable, void *context,
+		AAKeyType keys[], size_t keylengths[], size_t nKeys,
+		void *values[])
+{
+	HashValue hashes[LOOKUP_WINDOW];
+	AssociativeArray *tables[LOOKUP_WINDOW];
+	KeyDataPair *slot;
+	size_t start, count, i, nFound = 0;
+
+	for (start = 0; start < nKeys; start += count) {
+		count = nKeys - start;
+		if (count > LOOKUP_WINDOW)
+			count = LOOKUP_WINDOW;
+
+		for (i = 0; i < count; i++) {
+			tables[i] = chooseTable(context, keys[start + i],
+					keylengths[start + i], &hashes[i]);
+			tables[i]->layout->prefetch(tables[i],
+					keys[start + i], keylengths[start + i], hashes[i]);
+		}
+
+		for (i = 0; i < count; i++) {
+			if (tables[i]->snapshot != NULL) {
+				values[start + i] = snapshotLookup(tables[i], keys[start + i],
+						keylengths[start + i], hashes[i]);
+				nFound += (values[start + i] != NULL);
+				continue;
+			}
+
+			slot = findHashed(tables[i], keys[start + i],
+					keylengths[start + i], hashes[i]);
+			if (slot == NULL) {
+				values[start + i] = NULL;
+			} else {
+				values[start + i] = slot->value;
+				nFound++;
+			}
+		}
+	}
+
+	return nFound;
+}
+
+/** the BatchTableChooser of a single table: every key is searched in it */
+static AssociativeArray *wholeTable(void *context,
+		AAKeyType key, size_t keylen, HashValue *hash)
+{
+	AssociativeArray *aarray = (AssociativeArray *) context;
+
+	*hash = aarray->hashAlgorithmPrimary(key, keylen, &aarray->seedPrimary);
+	return aarray;
+}
 
 /**
- * Locates the KeyDataPair associated with the given key, if
- * present in the table.
+ * Looks up a batch of keys at once, prefetching ahead of the
+ * searches, as lookupBatch() describes.
+ *
+ *  @param  keys  the keys to search for
+ *  @param  keylengths  the length of each key
+ *  @param  nKeys  the number of keys in the batch
+ *  @param  values  filled in with the value stored with each key,
+ *				 or NULL for each key that was not present
+ *  @return      the number of keys that were found
+ */
+size_t aaLookupBatch(AssociativeArray *aarray,
+		AAKeyType keys[], size_t keylengths[], size_t nKeys,
+		void *values[])
+{
+	return lookupBatch(wholeTable, aarray, keys, keylengths, nKeys, values);
+}
+
+
+/**
+ * Removes the given key from the table, if present.
  *
  *  @param  key  the key to search for
- *  @return      the index of the KeyDataPair containing the key,
- *				 if the key was present in the table, or (-1),
- *				 if no key was found
+ *  @return      the value that was stored with the key, if the key
+ *				 was present in the table, or NULL, if no key was found
  *  @see         KeyDataPair
  */
 void *aaDelete(AssociativeArray *aarray, AAKeyType key, size_t keylen)
+{
+	if (aarray->snapshot != NULL) {
+		fprintf(stderr, "Cannot delete from a table opened from a snapshot\n");
+		return NULL;
+	}
+
+	/** a delete of a missing key is logged too, as replaying it does no harm */
+	if (aarray->log != NULL)
+		logOperation(aarray->log, 0, key, keylen, NULL);
+
+	return deleteHashed(aarray, key, keylen,
+			aarray->hashAlgorithmPrimary(key, keylen, &aarray->seedPrimary),
+			NULL);
+}
+
+/**
+ * The work of aaDelete(), for a key whose primary hash is already
+ * known, counting the probing cost as insertHashed() does.
+ */
+void *deleteHashed(AssociativeArray *aarray, AAKeyType key, size_t keylen,
+		HashValue hash, int *cost)
 {
 	/**
 	 * Deletion is closely related to lookup;
 	 * we must find where the key is stored before
-	 * we delete it, after all.
-	 *
-	 * Deletion algorithm based on tombstones.
+	 * we delete it, after all.  How the slot is then
+	 * emptied is up to the table layout.
 	 */
+	KeyDataPair *slot;
+	void *value;
+	int probes = 0;
 
- HashIndex index = aarray->hashAlgorithmPrimary(key, keylen, aarray->size);
-    int startIndex = index;
-    int cost = 0;
-
-    while (aarray->table[index].validity != HASH_EMPTY) 
-    {
-        // Check if the current slot is marked as deleted
-        if (aarray->table[index].validity == HASH_DELETED) 
-        {
-            // This means the key is not in the table
-            index++;
-			cost++;
-			aarray->deleteCost += cost;
-            if (index == startIndex) 
-            {
-                return NULL; // The entire table has been searched, key not found
-            }
-            continue;
-        }
+	slot = aarray->layout->find(aarray, key, keylen, hash, &probes);
+	countProbes(&aarray->deleteStats, probes);
+	if (cost != NULL)
+		(*cost) += probes;
+	if (slot == NULL) {
+		return NULL;
+	}
 
-        // Check if the current slot matches the key
-        if (aarray->table[index].keylen == keylen && memcmp(aarray->table[index].key, key, keylen) == 0) 
-        {
-            // Mark the slot as deleted (tombstone)
-            aarray->table[index].validity = HASH_DELETED;
-            aarray->nEntries--;
-            cost++;
-            aarray->deleteCost += cost;
+	value = slot->value;
+	if (aarray->cache != NULL)
+		cacheRemoved(aarray, keylen, value);
 
-            // Free memory for keys when deleting or resizing the table
-            free(aarray->table[index].key);
+	// Free memory for keys when deleting or resizing the table
+	releaseSlotKey(aarray, slot);
 
-            return aarray->table[index].value; // Return the associated value
-        }
+	aarray->layout->remove(aarray, slot);
+	aarray->nEntries--;
 
-        // If the current slot doesn't match the key, handle collision (optional):
-        // We can use the same probing strategy as in aaInsert to find the next slot
-        index++;
-		cost++;
-		aarray->deleteCost += cost;
-        if (index == startIndex) 
-        {
-            return NULL; // The entire table has been searched, key not found
-        }
-    }
+	shrinkIfNeeded(aarray);
+	if (aarray->keysInArena)
+		compactKeyArena(aarray, 0);
 
-    // Key not found
-    return NULL;
+	return value; // Return the associated value
 }
 
 
@@ -356,38 +941,41 @@ void *aaDelete(AssociativeArray *aarray, AAKeyType key, size_t keylen)
 void aaPrintContents(FILE *fp, AssociativeArray *aarray, char * tag)
 {
 	char keybuffer[128];
-	int i;
+	size_t i;
 
-	fprintf(fp, "%sDumping aarray of %d entries:\n", tag, aarray->size);
+	if (aarray->snapshot != NULL) {
+		snapshotPrintContents(fp, aarray, tag);
+		return;
+	}
+
+	fprintf(fp, "%sDumping aarray of %zu entries:\n", tag, aarray->size);
 	for (i = 0; i < aarray->size; i++) 
 	{
 		fprintf(fp, "%s  ", tag);
 		if (aarray->table[i].validity == HASH_USED) 
 		{
 			printableKey(keybuffer, 128,
-					aarray->table[i].key,
+					slotKey(&aarray->table[i]),
 					aarray->table[i].keylen);
-			fprintf(fp, "%d : in use : '%s'\n", i, keybuffer);
+			fprintf(fp, "%zu : in use : '%s'\n", i, keybuffer);
 		} 
 		
 		else 
 		{
 			if (aarray->table[i].validity == HASH_EMPTY) 
 			{
-				fprintf(fp, "%d : empty (NULL)\n", i);
+				fprintf(fp, "%zu : empty (NULL)\n", i);
 			} 
 			
 			else if ( aarray->table[i].validity == HASH_DELETED) 
 			{
-				printableKey(keybuffer, 128,
-						aarray->table[i].key,
-						aarray->table[i].keylen);
-				fprintf(fp, "%d : empty (deleted - was '%s')\n", i, keybuffer);
+				/** the key itself was released when it was deleted */
+				fprintf(fp, "%zu : empty (deleted)\n", i);
 			} 
 			
 			else 
 			{
-				fprintf(fp, "%d : invalid validity state %d\n", i,
+				fprintf(fp, "%zu : invalid validity state %d\n", i,
 						aarray->table[i].validity);
 			}
 		}
@@ -400,18 +988,143 @@ void aaPrintContents(FILE *fp, AssociativeArray *aarray, char * tag)
  */
 void aaPrintSummary(FILE *fp, AssociativeArray *aarray)
 {
-	fprintf(fp, "Associative array contains %d entries in a table of %d size\n",
+	fprintf(fp, "Associative array contains %zu entries in a table of %zu size\n",
 			aarray->nEntries, aarray->size);
 
+	fprintf(fp, "Table sizing: %s\n",
+			tableSizerName(&aarray->sizer));
+
+	fprintf(fp, "Load factor limits %.2f to %.2f, %zu tombstones, resized %d times\n",
+			aarray->minLoadFactor, aarray->maxLoadFactor,
+			aarray->nDeleted, aarray->nResizes);
+
 	fprintf(fp, "Strategies used: '%s' hash, '%s' secondary hash and '%s' probing\n",
 			aarray->hashNamePrimary, aarray->hashNameSecondary, aarray->probeName);
 
+	fprintf(fp, "Table layout: %s\n", aarray->layout->name);
+
+	if (aarray->cache != NULL)
+		cachePrintSummary(fp, aarray);
+
+	if (aarray->keysInArena) {
+		fprintf(fp, "Key arena: %zu chunks, %zu bytes in use, %zu bytes deleted\n",
+				aarray->arena.nChunks, aarray->arena.liveBytes,
+				aarray->arena.deadBytes);
+	}
+
 	fprintf(fp, "Costs accrued due to probing:\n");
 
-	fprintf(fp, "  Insertion : %d\n", aarray->insertCost);
+	fprintf(fp, "  Insertion : %llu\n",
+			(unsigned long long) aarray->insertStats.probes);
 
-	fprintf(fp, "  Search    : %d\n", aarray->searchCost);
-	
-	fprintf(fp, "  Deletion  : %d\n", aarray->deleteCost);
+	fprintf(fp, "  Search    : %llu\n",
+			(unsigned long long) (aarray->hitStats.probes + aarray->missStats.probes));
+
+	fprintf(fp, "  Deletion  : %llu\n",
+			(unsigned long long) aarray->deleteStats.probes);
+}
+
+
+/**
+ * Fill in the statistics of a table.  The counters are simply
+ * copied, but the longest probe distance is found by searching for
+ * every entry in the table, so this takes time in proportion to
+ * the size of the table, and is not counted as searches.
+ *
+ *  @return      1, or 0 if the library was built without counters
+ */
+int aaGetStats(AssociativeArray *aarray, AAStats *stats)
+{
+	KeyDataPair *slot;
+	int probes;
+	size_t i;
+
+	memset(stats, 0, sizeof(AAStats));
+	stats->inserts = aarray->insertStats;
+	stats->hits = aarray->hitStats;
+	stats->misses = aarray->missStats;
+	stats->deletes = aarray->deleteStats;
+
+	stats->nEntries = aarray->nEntries;
+	stats->size = aarray->size;
+	stats->nTombstones = aarray->nDeleted;
+	stats->loadFactor = (double) aarray->nEntries / aarray->size;
+	stats->nResizes = (uint64_t) aarray->nResizes;
+	stats->nEvictions = cacheEvictions(aarray);
+
+	if (aarray->snapshot != NULL) {
+		stats->maxProbeDistance = snapshotMaxProbes(aarray);
+	} else {
+		for (i = 0; i < aarray->size; i++) {
+			slot = &aarray->table[i];
+			if (slot->validity != HASH_USED)
+				continue;
+
+			probes = 0;
+			aarray->layout->find(aarray, slotKey(slot), slot->keylen, slot->hash, &probes);
+			if ((uint64_t) probes > stats->maxProbeDistance)
+				stats->maxProbeDistance = (uint64_t) probes;
+		}
+	}
+
+#ifdef	AA_NO_STATS
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+/** one line of aaPrintStats() */
+static void printOperationStats(FILE *fp, const char *label, const AAOperationStats *op)
+{
+	fprintf(fp, "  %-11s : %llu operations, %llu steps, %.3f mean, %llu longest\n",
+			label, (unsigned long long) op->count, (unsigned long long) op->probes,
+			(op->count > 0) ? (double) op->probes / op->count : 0.0,
+			(unsigned long long) op->maxProbes);
+}
+
+/**
+ * Print statistics filled in by aaGetStats(), with a histogram of
+ * probe lengths for each kind of operation
+ */
+void aaPrintStats(FILE *fp, const AAStats *stats)
+{
+	char range[32];
+	int b;
+
+	fprintf(fp, "Table of %zu entries in %zu slots, load factor %.3f, %zu tombstones\n",
+			stats->nEntries, stats->size, stats->loadFactor, stats->nTombstones);
+	fprintf(fp, "Resized %llu times, longest probe distance %llu\n",
+			(unsigned long long) stats->nResizes,
+			(unsigned long long) stats->maxProbeDistance);
+	if (stats->nEvictions > 0)
+		fprintf(fp, "Evicted %llu entries to keep within capacity\n",
+				(unsigned long long) stats->nEvictions);
+
+	fprintf(fp, "Probe steps by operation:\n");
+	printOperationStats(fp, "Insertion", &stats->inserts);
+	printOperationStats(fp, "Search hit", &stats->hits);
+	printOperationStats(fp, "Search miss", &stats->misses);
+	printOperationStats(fp, "Deletion", &stats->deletes);
+
+	fprintf(fp, "Probe length histogram:\n");
+	fprintf(fp, "  %-12s %12s %12s %12s %12s\n",
+			"steps", "insert", "hit", "miss", "delete");
+	for (b = 0; b < AA_PROBE_BUCKETS; b++) {
+		if (b == 0)
+			snprintf(range, sizeof(range), "0");
+		else if (b == AA_PROBE_BUCKETS - 1)
+			snprintf(range, sizeof(range), "%lu+", 1UL << (b - 1));
+		else if (b == 1)
+			snprintf(range, sizeof(range), "1");
+		else
+			snprintf(range, sizeof(range), "%lu-%lu", 1UL << (b - 1), (1UL << b) - 1);
+
+		fprintf(fp, "  %-12s %12llu %12llu %12llu %12llu\n", range,
+				(unsigned long long) stats->inserts.histogram[b],
+				(unsigned long long) stats->hits.histogram[b],
+				(unsigned long long) stats->misses.histogram[b],
+				(unsigned long long) stats->deletes.histogram[b]);
+	}
 }
 
@@ -2,38 +2,193 @@
 #define	__HASHING_TOOLS_HEADER__
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <aarray.h>
 
 typedef size_t HashIndex;
 
+/** full-width hash value, before it is reduced to a table index */
+typedef uint64_t HashValue;
+
 // forward declaration of typedef to allow it to be used in the
 // definition of HashProbe and allow HashProbe to be used in AssociativeArray
 typedef struct AssociativeArray AssociativeArray;
 
-typedef HashIndex (*HashAlgorithm)(AAKeyType key, size_t keyLength, HashIndex tableSize);
-typedef HashIndex (*HashProbe)(struct AssociativeArray *table, AAKeyType key, size_t keyLength, int startIndex, int, int *cost);
+/** a table mapped from a snapshot file, private to snapshot.c */
+typedef struct Snapshot Snapshot;
+
+/** the log of changes made to a table, private to operation-log.c */
+typedef struct OperationLog OperationLog;
+
+/** the capacity and clock hand of a table in cache mode, private to cache.c */
+typedef struct TableCache TableCache;
+
+/**
+ * The secret key of a table.  Keyed hash functions mix it into
+ * every value; the simple ones (sum, xor, length) ignore it.
+ */
+typedef struct HashSeed {
+	uint64_t k0;
+	uint64_t k1;
+} HashSeed;
+
+typedef HashValue (*HashAlgorithm)(AAKeyType key, size_t keyLength, const HashSeed *seed);
+
+/**
+ * A position along a probe sequence.  Every sequence starts at the
+ * key's home slot and is moved on one slot at a time by the table's
+ * HashProbe, so that insert, lookup and delete all visit the same
+ * slots in the same order.
+ */
+typedef struct ProbeSequence {
+	HashIndex index;	/** the slot to look at now */
+	HashIndex step;		/** double hashing stride, 0 until first needed */
+	size_t nProbes;		/** how many times the sequence has moved on */
+	AAKeyType key;		/** the key being probed for, for double hashing */
+	size_t keylen;
+} ProbeSequence;
+
+typedef void (*HashProbe)(struct AssociativeArray *table, ProbeSequence *probe);
+
+/**
+ * Everything needed to map a hash value onto [0...size-1].
+ * Tables are either a power of two in size, in which case we
+ * keep either the low bits (mask) or the high bits of a
+ * multiplication by 2^64/phi (shift), or are a prime size, in
+ * which case we use a precomputed fast modulo "magic" multiplier
+ * in place of a hardware division.
+ */
+typedef struct TableSizer {
+	AASizingMode mode;
+	size_t size;
+	size_t mask;
+	int shift;
+	uint64_t magic;
+} TableSizer;
+
+/** keys of up to this many bytes are stored in the slot itself */
+#define	INLINE_KEY_MAX	16
 
+/**
+ * Short keys are copied into the slot itself, saving both an
+ * allocation and a pointer chase on every comparison; longer
+ * keys are copied into memory owned by the table.  Which one is
+ * in use follows from keylen -- use slotKey() to get at either.
+ *
+ * The full primary hash of the key is kept as well, so that a
+ * search can pass over almost every non-matching slot with one
+ * integer comparison, and a rehash never has to look at the keys.
+ *
+ * The reference bit is only used in cache mode, where a lookup
+ * sets it and the clock hand clears it; it sits in the same cache
+ * line as the rest of the slot, so setting it costs no extra miss.
+ */
 typedef struct KeyDataPair {
-	AAKeyType key;
+	union {
+		AAKeyType key;
+		unsigned char bytes[INLINE_KEY_MAX];
+	} keyData;
 	size_t keylen;
 	void *value;
-	int validity;
+	HashValue hash;
+	unsigned char validity;
+	unsigned char referenced;
+	union {
+		unsigned int probeDistance;	/** slots from home, for Robin Hood probing */
+		uint32_t alternateHash;		/** secondary hash bits, for cuckoo hashing */
+	} aux;
 } KeyDataPair;
 
+/**
+ * The operations that differ between the ways of laying out the
+ * slots of a table.  Every layout keeps its entries in the table
+ * of KeyDataPairs, with the validity field kept current, so that
+ * iteration, printing and rehashing work the same way for all of
+ * them; a layout may keep extra arrays alongside it, which are
+ * set up by allocate() and freed by release().
+ *
+ * insert() places an entry whose key the table already owns and
+ * returns its index, or -1 if no room could be found.  find()
+ * returns the slot holding the key, or NULL.  prefetch() starts
+ * loading the memory that find() will look at first, without
+ * waiting for it.  remove() empties a slot returned by find(),
+ * once its key has been released.
+ *
+ * If insert() fails it must leave the table as it found it, so
+ * that the caller can grow the table and try again.
+ *
+ * insert() and find() add to *cost the number of steps they took
+ * past the first slot, bucket or group they looked at, so that an
+ * operation that is settled at once costs nothing.
+ */
+typedef struct TableLayout {
+	const char *name;
+	size_t minimumSize;		/** non-zero if sizes must be powers of two */
+	size_t bucketSlots;		/** slots per bucket; the sizer counts buckets */
+	int (*allocate)(struct AssociativeArray *table);
+	void (*release)(struct AssociativeArray *table);
+	long (*insert)(struct AssociativeArray *table,
+			KeyDataPair *entry, HashValue hash, int *cost);
+	KeyDataPair *(*find)(struct AssociativeArray *table,
+			AAKeyType key, size_t keyLength, HashValue hash, int *cost);
+	void (*prefetch)(struct AssociativeArray *table,
+			AAKeyType key, size_t keyLength, HashValue hash);
+	void (*remove)(struct AssociativeArray *table, KeyDataPair *slot);
+} TableLayout;
+
+/**
+ * A bump allocator for long keys: keys are packed one after the
+ * other into chunks, and are never freed individually.  The space
+ * of deleted keys is only counted, and recovered by compaction
+ * once it outweighs the space still in use.
+ */
+typedef struct ArenaChunk {
+	struct ArenaChunk *next;
+	size_t size;
+	size_t used;
+	unsigned char data[];
+} ArenaChunk;
+
+typedef struct KeyArena {
+	ArenaChunk *chunks;
+	size_t nChunks;
+	size_t liveBytes;
+	size_t deadBytes;
+} KeyArena;
+
 struct AssociativeArray {
 	KeyDataPair *table;
-	int size;
-	int nEntries;
+	unsigned char *control;
+	const TableLayout *layout;
+	size_t size;
+	TableSizer sizer;
+	size_t nEntries;
+	size_t nDeleted;
+	uint64_t randomState;
+	int keysInArena;
+	KeyArena arena;
+	int lockFreeReads;		/** searches may run while the table changes */
+	size_t minimumSize;
+	double maxLoadFactor;
+	double minLoadFactor;
+	int nResizes;
 	HashProbe hashProbe;
 	char *probeName;
 	HashAlgorithm hashAlgorithmPrimary;
 	char *hashNamePrimary;
+	HashSeed seedPrimary;
 	HashAlgorithm hashAlgorithmSecondary;
 	char *hashNameSecondary;
-	int searchCost;
-	int insertCost;
-	int deleteCost;
+	HashSeed seedSecondary;
+	AAOperationStats insertStats;
+	AAOperationStats hitStats;
+	AAOperationStats missStats;
+	AAOperationStats deleteStats;
+	Snapshot *snapshot;		/** non-NULL if opened from a snapshot, and read-only */
+	OperationLog *log;		/** non-NULL if changes are being logged */
+	TableCache *cache;		/** non-NULL if entries are evicted at a capacity */
 };
 
 
@@ -41,15 +196,214 @@ struct AssociativeArray {
 #define	HASH_USED		1
 #define	HASH_DELETED	2
 
+/**
+ * Reduce a full hash value to an index in [0...size-1] using
+ * the method chosen when the table was sized.
+ */
+static inline HashIndex reduceHash(const TableSizer *sizer, HashValue hash)
+{
+	if (sizer->mode == AA_SIZE_POW2_MASK)
+		return hash & sizer->mask;
+
+	if (sizer->mode == AA_SIZE_POW2_SHIFT)
+		return (HashIndex) ((hash * UINT64_C(0x9E3779B97F4A7C15)) >> sizer->shift);
+
+#ifdef __SIZEOF_INT128__
+	if (sizer->magic != 0) {
+		/** fold to 32 bits, then take the remainder by multiplication */
+		uint32_t folded = (uint32_t) (hash ^ (hash >> 32));
+		uint64_t lowbits = sizer->magic * folded;
+		return (HashIndex) (((unsigned __int128) lowbits * sizer->size) >> 64);
+	}
+#endif
+	return hash % sizer->size;
+}
+
+/** the size of a cache line, which data written by different threads is padded to */
+#define	CACHE_LINE		64
+
+/** how many keys of a batch are in flight between prefetch and search */
+#define	LOOKUP_WINDOW	16
+
+/** start loading a cache line we will read soon, if the compiler can */
+#if defined(__GNUC__)
+#define	PREFETCH_READ(address)	__builtin_prefetch((address), 0, 3)
+#else
+#define	PREFETCH_READ(address)	((void) (address))
+#endif
+
+/** prefetch for layouts whose search starts at the slot the hash reduces to */
+static inline void prefetchHomeSlot(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash)
+{
+	PREFETCH_READ(&aarray->table[reduceHash(&aarray->sizer, hash)]);
+}
+
+/**
+ * Copy an entry into a free slot.  The validity is written last,
+ * with release ordering, so that a reader taking no lock that sees
+ * HASH_USED through slotValidity() also sees the key, hash and value.
+ */
+static inline void publishSlot(KeyDataPair *slot, const KeyDataPair *entry)
+{
+	slot->keyData = entry->keyData;
+	slot->keylen = entry->keylen;
+	slot->value = entry->value;
+	slot->hash = entry->hash;
+	slot->referenced = entry->referenced;
+	slot->aux = entry->aux;
+	__atomic_store_n(&slot->validity, HASH_USED, __ATOMIC_RELEASE);
+}
+
+/** the validity of a slot, as published by publishSlot() */
+static inline int slotValidity(KeyDataPair *slot)
+{
+	return __atomic_load_n(&slot->validity, __ATOMIC_ACQUIRE);
+}
+
+/** the key stored in a slot, wherever it is kept */
+static inline AAKeyType slotKey(KeyDataPair *slot)
+{
+	return (slot->keylen <= INLINE_KEY_MAX) ? slot->keyData.bytes : slot->keyData.key;
+}
+
+/** does the slot hold the given key?  The hash is checked first, as it is cheapest */
+static inline int slotHoldsKey(KeyDataPair *slot, AAKeyType key, size_t keylen, HashValue hash)
+{
+	return slot->hash == hash
+			&& slot->keylen == keylen
+			&& memcmp(slotKey(slot), key, keylen) == 0;
+}
+
+/**
+ * Final avalanche step of MurmurHash3, used by layouts that need
+ * good bits from hash functions that may not provide them.
+ */
+static inline HashValue mixHash(HashValue hash)
+{
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xff51afd7ed558ccd);
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+	hash ^= hash >> 33;
+	return hash;
+}
+
+/**
+ * Which of a power of two number of parts a key belongs to, taken
+ * from the top bits of a remix of its hash, so that the choice is
+ * independent of the bits each part uses to place the key.
+ */
+static inline size_t partOfHash(HashValue hash, int shift)
+{
+	if (shift >= 64)
+		return 0;
+	return (size_t) (mixHash(hash ^ UINT64_C(0x5851F42D4C957F2D)) >> shift);
+}
+
+/**
+ * Record one operation of the given number of probe steps.  Each
+ * table is only ever changed by one thread at a time, so plain
+ * increments will do; building with AA_NO_STATS leaves them out.
+ */
+static inline void countProbes(AAOperationStats *stats, int probes)
+{
+#ifndef	AA_NO_STATS
+	int bucket = 0;
+
+	if (probes > 0) {
+		bucket = 64 - __builtin_clzll((unsigned long long) probes);
+		if (bucket >= AA_PROBE_BUCKETS)
+			bucket = AA_PROBE_BUCKETS - 1;
+	}
+
+	stats->count++;
+	stats->probes += (uint64_t) probes;
+	if ((uint64_t) probes > stats->maxProbes)
+		stats->maxProbes = (uint64_t) probes;
+	stats->histogram[bucket]++;
+#endif
+}
+
+/** the available table layouts */
+extern const TableLayout probingLayout;
+extern const TableLayout swissLayout;
+extern const TableLayout robinHoodLayout;
+extern const TableLayout cuckooLayout;
+extern const TableLayout snapshotLayout;
+
 /** prototypes */
-HashIndex hashByLength(AAKeyType key, size_t keyLength, HashIndex size);
-HashIndex hashBySum(AAKeyType key, size_t keyLength, HashIndex tableSize);
-HashIndex hashByXOR(AAKeyType key, size_t keyLength, HashIndex tableSize);
-HashIndex linearProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, int index, int stopOnInvalid, int *cost);
-HashIndex  quadraticProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, int index, int stopOnInvalid, int *cost);
-HashIndex  doubleHashProbe(AssociativeArray *table, AAKeyType key, size_t keyLength, int index, int stopOnInvalid, int *cost);
-
-int getLargerPrime(int value);
+HashValue hashByLength(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashValue hashBySum(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashValue hashByXOR(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashValue hashByWy(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashValue hashByXXH64(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashValue hashByInteger(AAKeyType key, size_t keyLength, const HashSeed *seed);
+HashValue hashBySip(AAKeyType key, size_t keyLength, const HashSeed *seed);
+uint64_t expandHashSeeds(uint64_t seed, HashSeed *primary, HashSeed *secondary);
+uint64_t sharedTableSeed(uint64_t seed);
+void linearProbe(AssociativeArray *table, ProbeSequence *probe);
+void quadraticProbe(AssociativeArray *table, ProbeSequence *probe);
+void doubleHashProbe(AssociativeArray *table, ProbeSequence *probe);
+HashAlgorithm lookupNamedHashStrategy(const char *name);
+
+long insertHashed(AssociativeArray *table, AAKeyType key, size_t keylen,
+		void *value, HashValue hash, int *cost);
+KeyDataPair *findHashed(AssociativeArray *table, AAKeyType key, size_t keylen,
+		HashValue hash);
+
+/**
+ * Picks the table a key of a batch is searched in, and gives the
+ * key's primary hash, for lookupBatch()
+ */
+typedef AssociativeArray *(*BatchTableChooser)(void *context,
+		AAKeyType key, size_t keylen, HashValue *hash);
+size_t lookupBatch(BatchTableChooser chooseTable, void *context,
+		AAKeyType keys[], size_t keylengths[], size_t nKeys,
+		void *values[]);
+void *deleteHashed(AssociativeArray *table, AAKeyType key, size_t keylen,
+		HashValue hash, int *cost);
+size_t sweepStart(AssociativeArray *table);
+size_t grownTableSize(AssociativeArray *table);
+void reserveTable(AssociativeArray *table, size_t nMore);
+AssociativeArray *cloneTable(AssociativeArray *table, size_t newSize);
+void releaseTableShell(AssociativeArray *table);
+
+int storeSlotKey(AssociativeArray *table, KeyDataPair *slot, AAKeyType key, size_t keylen);
+void releaseSlotKey(AssociativeArray *table, KeyDataPair *slot);
+void retireSlotKey(AssociativeArray *table, KeyDataPair *slot,
+		void (*retire)(void *key, void *context), void *context);
+void compactKeyArena(AssociativeArray *table, int force);
+void releaseKeyArena(KeyArena *arena);
+
+int writeSnapshot(const char *filename, AssociativeArray **tables, size_t nTables,
+		AAValueLength valueLength, int keepHidden);
+void *snapshotLookup(AssociativeArray *table, AAKeyType key, size_t keylen, HashValue hash);
+void snapshotPrefetch(AssociativeArray *table, HashValue hash);
+int snapshotIterate(AssociativeArray *table,
+		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
+		void *userdata);
+int snapshotForEach(AssociativeArray *table,
+		int (*visit)(AAKeyType key, size_t keylen, void *value, size_t valueLength, void *userdata),
+		void *userdata);
+void snapshotPrintContents(FILE *fp, AssociativeArray *table, char *tag);
+uint64_t snapshotMaxProbes(AssociativeArray *table);
+void releaseSnapshot(Snapshot *snapshot);
+
+void logOperation(OperationLog *log, int isInsert,
+		AAKeyType key, size_t keylen, void *value);
+
+int cacheMakeRoom(AssociativeArray *table, AAKeyType key, size_t keylen,
+		void *value, HashValue hash);
+void cacheAdded(AssociativeArray *table, size_t keylen, void *value);
+void cacheRemoved(AssociativeArray *table, size_t keylen, void *value);
+uint64_t cacheEvictions(AssociativeArray *table);
+void cachePrintSummary(FILE *fp, AssociativeArray *table);
+void releaseCache(TableCache *cache);
+
+size_t getLargerPrime(size_t value);
+size_t initTableSizer(TableSizer *sizer, size_t requestedSize, AASizingMode mode);
+const char *tableSizerName(const TableSizer *sizer);
 
 int doKeysMatch(AAKeyType key1, size_t key1len, AAKeyType key2, size_t key2len);
 int printableKey(char *buffer, int bufferlen, AAKeyType key, size_t keylen);
@@ -0,0 +1,182 @@
+/**
+ * Storage for the copies of the keys held by the table.
+ *
+ * Keys short enough to fit are kept in the slot itself, so most
+ * inserts need no allocation at all.  Longer keys are copied either
+ * onto the heap, or into a chunked arena owned by the table, which
+ * is released in one go when the table is deleted.  Either way the
+ * copy belongs to the table.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtools.h"
+
+/** arena chunks are this big, unless a key needs more */
+#define	ARENA_CHUNK_SIZE	(64 * 1024)
+
+/** the arena is only worth compacting once this much space is dead */
+#define	ARENA_COMPACT_MINIMUM	ARENA_CHUNK_SIZE
+
+/** carve space for a key out of the arena, adding a chunk if needed */
+static unsigned char *arenaAllocate(KeyArena *arena, size_t length)
+{
+	ArenaChunk *chunk = arena->chunks;
+	size_t chunkSize;
+
+	if (chunk == NULL || chunk->size - chunk->used < length) {
+		chunkSize = (length > ARENA_CHUNK_SIZE) ? length : ARENA_CHUNK_SIZE;
+		chunk = (ArenaChunk *) malloc(sizeof(ArenaChunk) + chunkSize);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->size = chunkSize;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->nChunks++;
+	}
+
+	chunk->used += length;
+	arena->liveBytes += length;
+	return &chunk->data[chunk->used - length];
+}
+
+/** release every chunk of the arena at once */
+void
+releaseKeyArena(KeyArena *arena)
+{
+	ArenaChunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	memset(arena, 0, sizeof(KeyArena));
+}
+
+/**
+ * Copy the key into the given slot (which need not be in the table yet)
+ *
+ *  @return  1 on success, or -1 if memory for the copy could not be found
+ */
+int
+storeSlotKey(AssociativeArray *aarray, KeyDataPair *slot, AAKeyType key, size_t keylen)
+{
+	slot->keylen = keylen;
+
+	if (keylen <= INLINE_KEY_MAX) {
+		memcpy(slot->keyData.bytes, key, keylen);
+		return 1;
+	}
+
+	if (aarray->keysInArena) {
+		slot->keyData.key = arenaAllocate(&aarray->arena, keylen);
+	} else {
+		slot->keyData.key = (AAKeyType) malloc(keylen);
+	}
+
+	if (slot->keyData.key == NULL) {
+		slot->keylen = 0;
+		return -1;
+	}
+	memcpy(slot->keyData.key, key, keylen);
+	return 1;
+}
+
+/**
+ * Release the copy of the key held by the slot, leaving it keyless.
+ * Arena space is not reused straight away; it is only recovered
+ * when the arena is compacted.
+ */
+void
+releaseSlotKey(AssociativeArray *aarray, KeyDataPair *slot)
+{
+	if (slot->keylen > INLINE_KEY_MAX) {
+		if (aarray->keysInArena) {
+			aarray->arena.liveBytes -= slot->keylen;
+			aarray->arena.deadBytes += slot->keylen;
+		} else {
+			free(slot->keyData.key);
+		}
+	}
+	slot->keyData.key = NULL;
+	slot->keylen = 0;
+}
+
+/**
+ * Give up a slot's claim on its key, as releaseSlotKey(), but for
+ * a slot that readers taking no lock may still be comparing keys
+ * against: the slot itself is left untouched, and a key in its own
+ * allocation is passed to the retire function (along with the given
+ * context) to be freed once no reader can be looking at it.  Space
+ * in the arena is only counted, as the arena is never compacted
+ * while such readers are about.
+ */
+void
+retireSlotKey(AssociativeArray *aarray, KeyDataPair *slot,
+		void (*retire)(void *key, void *context), void *context)
+{
+	if (slot->keylen > INLINE_KEY_MAX) {
+		if (aarray->keysInArena) {
+			aarray->arena.liveBytes -= slot->keylen;
+			aarray->arena.deadBytes += slot->keylen;
+		} else {
+			retire(slot->keyData.key, context);
+		}
+	}
+}
+
+/**
+ * Copy every live key into a fresh arena and drop the old one,
+ * recovering the space of deleted keys.  Unless forced, this only
+ * happens once more space is dead than in use, so the cost of
+ * visiting every slot is paid for by the deletions since the last
+ * compaction.  If the new arena cannot be built the old one is
+ * kept as it was.
+ */
+void
+compactKeyArena(AssociativeArray *aarray, int force)
+{
+	KeyArena fresh;
+	unsigned char **moved;
+	size_t i, nMoved = 0;
+
+	if ( ! force && (aarray->arena.deadBytes < ARENA_COMPACT_MINIMUM
+				|| aarray->arena.deadBytes < aarray->arena.liveBytes))
+		return;
+
+	/** remember the new copies, so a failure part way can be undone */
+	moved = (unsigned char **) malloc((aarray->nEntries + 1) * sizeof(unsigned char *));
+	if (moved == NULL)
+		return;
+
+	memset(&fresh, 0, sizeof(KeyArena));
+	for (i = 0; i < aarray->size; i++) {
+		KeyDataPair *slot = &aarray->table[i];
+
+		if (slot->validity != HASH_USED || slot->keylen <= INLINE_KEY_MAX)
+			continue;
+
+		moved[nMoved] = arenaAllocate(&fresh, slot->keylen);
+		if (moved[nMoved] == NULL) {
+			releaseKeyArena(&fresh);
+			free(moved);
+			return;
+		}
+		memcpy(moved[nMoved++], slot->keyData.key, slot->keylen);
+	}
+
+	/** every copy was made, so now switch the slots over */
+	nMoved = 0;
+	for (i = 0; i < aarray->size; i++) {
+		KeyDataPair *slot = &aarray->table[i];
+
+		if (slot->validity == HASH_USED && slot->keylen > INLINE_KEY_MAX)
+			slot->keyData.key = moved[nMoved++];
+	}
+
+	free(moved);
+	releaseKeyArena(&aarray->arena);
+	aarray->arena = fresh;
+}
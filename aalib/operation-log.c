@@ -0,0 +1,939 @@
+/**
+ * An operation log: every insert and delete made on a table is
+ * recorded in a file, so that after a crash the table can be put
+ * back as it was by replaying the log over the latest snapshot.
+ *
+ * Records are only copied into a buffer by the thread changing the
+ * table.  A writer thread hands the buffer to write(2) and then
+ * fdatasync(2)s it, a batch at a time (group commit), so the table
+ * never waits for the disk.  A batch is written once the buffer is
+ * half full, once the oldest record in it has waited syncInterval
+ * milliseconds, or as soon as aaLogSync() asks, which then waits
+ * for its records (and everything batched with them) to be synced.
+ *
+ * The log is a series of numbered segment files, NAME.000001 and
+ * on; the writer moves on to a new segment once the current one
+ * passes segmentBytes.  A compactor thread folds closed segments
+ * into a snapshot, NAME.snap.N, which holds the table as it stood
+ * at the end of segment N, and then removes them and any older
+ * snapshot.  Compaction works from the files alone, never the live
+ * table, so it runs alongside the table being changed.
+ *
+ * Each record carries a checksum, so a record torn by a crash
+ * part way through a write is recognised, and replay stops there.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h> /* for open() */
+#include <unistd.h> /* for write(), fdatasync(), unlink() */
+#include <dirent.h> /* for opendir() */
+#include <pthread.h>
+
+#include "hashtools.h"
+
+#define	LOG_MAGIC			"AAOPLOG1"
+#define	LOG_VERSION			1
+#define	LOG_BYTE_ORDER		UINT32_C(0x01020304)
+
+#define	LOG_INSERT			1
+#define	LOG_DELETE			2
+
+#define	DEFAULT_BUFFER_SIZE		(1024 * 1024)
+#define	DEFAULT_SYNC_INTERVAL	10
+#define	DEFAULT_SEGMENT_BYTES	(16 * 1024 * 1024)
+#define	DEFAULT_COMPACT_SEGMENTS	4
+
+/** room for the log name, a suffix and a segment number */
+#define	SUFFIX_MAX			32
+
+typedef struct LogFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+} LogFileHeader;
+
+/**
+ * Each record is this header, then the key, then the value.  The
+ * checksum covers everything after itself, key and value included.
+ */
+typedef struct LogRecord {
+	uint64_t checksum;
+	uint32_t op;
+	uint32_t keylen;
+	uint32_t valueLength;
+	uint32_t reserved;
+} LogRecord;
+
+typedef struct LogBuffer {
+	unsigned char *data;
+	size_t used;
+	size_t size;
+} LogBuffer;
+
+struct OperationLog {
+	char *name;
+	AAValueLength valueLength;
+	AALogConfig config;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wakeWriter;		/** records to write, a sync wanted, or stopping */
+	pthread_cond_t written;			/** a batch is on disk, or the buffer is free */
+	pthread_cond_t wakeCompactor;
+
+	LogBuffer active;				/** being filled by the table */
+	LogBuffer flushing;				/** being written by the writer */
+	uint64_t appended;				/** bytes of records handed to the log */
+	uint64_t durable;				/** of those, bytes written and synced */
+	uint64_t syncWanted;			/** a caller is waiting for this many */
+	int full;						/** a record is waiting for room */
+
+	int fd;							/** only used by the writer thread */
+	unsigned int segment;			/** the segment being written */
+	uint64_t segmentBytes;
+	unsigned int compactedThrough;	/** segments up to here are in a snapshot */
+
+	int stopping;
+	int status;						/** -1 once a write or sync has failed */
+	pthread_t writer;
+	pthread_t compactor;
+};
+
+/** the checksum of a record, built in place */
+static uint64_t recordChecksum(const unsigned char *record, size_t length)
+{
+	static const HashSeed zeroSeed = { 0, 0 };
+
+	return hashByXXH64((AAKeyType) (record + sizeof(uint64_t)),
+			length - sizeof(uint64_t), &zeroSeed);
+}
+
+/** the name of a segment, or of a snapshot if isSnapshot is set */
+static char *logFileName(const char *name, unsigned int number, int isSnapshot)
+{
+	char *filename = (char *) malloc(strlen(name) + SUFFIX_MAX);
+
+	if (filename != NULL)
+		sprintf(filename, isSnapshot ? "%s.snap.%06u" : "%s.%06u", name, number);
+	return filename;
+}
+
+/**
+ * Sync the directory holding the log, so that files created,
+ * renamed or removed in it stay that way after a crash
+ */
+static void syncLogDirectory(const char *name)
+{
+	const char *slash = strrchr(name, '/');
+	char *directory;
+	int fd;
+
+	if (slash == NULL) {
+		directory = strdup(".");
+	} else {
+		directory = strndup(name, (slash == name) ? 1 : (size_t) (slash - name));
+	}
+	if (directory == NULL)
+		return;
+
+	if ((fd = open(directory, O_RDONLY)) >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(directory);
+}
+
+/**
+ * Find the segments and snapshots of the named log.  The numbers of
+ * the segments in (after, through] are returned, in order, in a
+ * malloc()ed array (which may be NULL if there are none); the
+ * highest numbered snapshot up to through, or zero if there is none,
+ * is returned through latestSnapshot, and the highest number of any
+ * file through highest.
+ *
+ *  @return      the number of segments found, or -1 on error
+ */
+static long findLogFiles(const char *name, unsigned int after, unsigned int through,
+		unsigned int **segments, unsigned int *latestSnapshot, unsigned int *highest)
+{
+	const char *slash = strrchr(name, '/');
+	const char *base = (slash == NULL) ? name : slash + 1;
+	size_t baselen = strlen(base);
+	unsigned int *found = NULL, *grown, number, swap;
+	long nFound = 0, nAllocated = 0, i, j;
+	char *directory, *end;
+	struct dirent *entry;
+	DIR *dir;
+	int isSnapshot;
+
+	directory = (slash == NULL) ? strdup(".")
+			: strndup(name, (slash == name) ? 1 : (size_t) (slash - name));
+	if (directory == NULL || (dir = opendir(directory)) == NULL) {
+		fprintf(stderr, "Cannot read directory of log '%s' : %s\n", name, strerror(errno));
+		free(directory);
+		return -1;
+	}
+
+	*latestSnapshot = 0;
+	*highest = 0;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, base, baselen) != 0 || entry->d_name[baselen] != '.')
+			continue;
+
+		/** NAME.NNNNNN or NAME.snap.NNNNNN, but not a snapshot being written */
+		isSnapshot = (strncmp(&entry->d_name[baselen], ".snap.", 6) == 0);
+		number = (unsigned int) strtoul(&entry->d_name[baselen + (isSnapshot ? 6 : 1)], &end, 10);
+		if (*end != '\0' || number == 0)
+			continue;
+
+		if (number > *highest)
+			*highest = number;
+		if (isSnapshot) {
+			if (number <= through && number > *latestSnapshot)
+				*latestSnapshot = number;
+			continue;
+		}
+		if (number <= after || number > through)
+			continue;
+
+		if (nFound == nAllocated) {
+			nAllocated = (nAllocated == 0) ? 16 : nAllocated * 2;
+			grown = (unsigned int *) realloc(found, nAllocated * sizeof(unsigned int));
+			if (grown == NULL) {
+				fprintf(stderr, "Cannot allocate list of log segments\n");
+				free(found);
+				closedir(dir);
+				free(directory);
+				return -1;
+			}
+			found = grown;
+		}
+		found[nFound++] = number;
+	}
+	closedir(dir);
+	free(directory);
+
+	/** there are few segments, so a simple sort will do */
+	for (i = 1; i < nFound; i++) {
+		for (j = i; j > 0 && found[j - 1] > found[j]; j--) {
+			swap = found[j];
+			found[j] = found[j - 1];
+			found[j - 1] = swap;
+		}
+	}
+
+	*segments = found;
+	return nFound;
+}
+
+/**
+ * How values are held in a table being rebuilt: either as plain
+ * malloc()ed copies, for a table handed back to the caller, or,
+ * for a table that is only going to be written to a snapshot, with
+ * their length stored just in front of them.
+ */
+typedef struct Rebuild {
+	AssociativeArray *table;
+	int keepLengths;
+} Rebuild;
+
+static void *copyValue(Rebuild *rebuild, const void *value, size_t length)
+{
+	unsigned char *copy;
+
+	if (rebuild->keepLengths) {
+		copy = (unsigned char *) malloc(sizeof(size_t) + length);
+		if (copy == NULL)
+			return NULL;
+		memcpy(copy, &length, sizeof(size_t));
+		copy += sizeof(size_t);
+	} else {
+		copy = (unsigned char *) malloc((length > 0) ? length : 1);
+		if (copy == NULL)
+			return NULL;
+	}
+	memcpy(copy, value, length);
+	return copy;
+}
+
+static void freeValue(Rebuild *rebuild, void *value)
+{
+	if (value != NULL && rebuild->keepLengths)
+		value = (unsigned char *) value - sizeof(size_t);
+	free(value);
+}
+
+/** the AAValueLength of values copied with keepLengths */
+static size_t keptValueLength(void *value)
+{
+	size_t length;
+
+	memcpy(&length, (unsigned char *) value - sizeof(size_t), sizeof(size_t));
+	return length;
+}
+
+static int freeKeptValue(AAKeyType key, size_t keylen, void *value, void *userdata)
+{
+	freeValue((Rebuild *) userdata, value);
+	return 0;
+}
+
+/** add an entry of a snapshot to the table being rebuilt */
+static int addSnapshotEntry(AAKeyType key, size_t keylen,
+		void *value, size_t valueLength, void *userdata)
+{
+	Rebuild *rebuild = (Rebuild *) userdata;
+	void *copy = NULL;
+
+	if (value != NULL && (copy = copyValue(rebuild, value, valueLength)) == NULL) {
+		fprintf(stderr, "Cannot allocate space for recovered value\n");
+		return -1;
+	}
+	if (aaInsert(rebuild->table, key, keylen, copy) < 0) {
+		freeValue(rebuild, copy);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Replay every complete record of a segment into the table.  A
+ * record that is cut short or fails its checksum ends the replay of
+ * that segment: it can only be the last, left half written by a
+ * crash, as nothing is written after a record until it is synced.
+ *
+ *  @return      1 on success, or -1 if the table could not be changed
+ */
+static int replaySegment(Rebuild *rebuild, const char *filename)
+{
+	LogFileHeader fileHeader;
+	LogRecord header;
+	unsigned char *record = NULL, *grown;
+	size_t length, allocated = 0;
+	void *value;
+	FILE *fp;
+	int status = 1;
+
+	if ((fp = fopen(filename, "rb")) == NULL) {
+		fprintf(stderr, "Cannot open log segment '%s' : %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	if (fread(&fileHeader, sizeof(fileHeader), 1, fp) != 1
+			|| memcmp(fileHeader.magic, LOG_MAGIC, sizeof(fileHeader.magic)) != 0
+			|| fileHeader.version != LOG_VERSION
+			|| fileHeader.byteOrder != LOG_BYTE_ORDER) {
+		/** a segment created just before a crash may not even have its header */
+		fclose(fp);
+		return 1;
+	}
+
+	while (fread(&header, sizeof(header), 1, fp) == 1) {
+		length = sizeof(header) + (size_t) header.keylen + header.valueLength;
+		if (length > allocated) {
+			grown = (unsigned char *) realloc(record, length);
+			if (grown == NULL) {
+				fprintf(stderr, "Cannot allocate space to replay log\n");
+				status = -1;
+				break;
+			}
+			record = grown;
+			allocated = length;
+		}
+
+		memcpy(record, &header, sizeof(header));
+		if (fread(record + sizeof(header), 1, length - sizeof(header), fp)
+					!= length - sizeof(header)
+				|| recordChecksum(record, length) != header.checksum) {
+			fprintf(stderr, "Log segment '%s' ends in a damaged record - ignoring it\n",
+					filename);
+			break;
+		}
+
+		if (header.op == LOG_INSERT) {
+			value = NULL;
+			if (header.valueLength > 0 && (value = copyValue(rebuild,
+					record + sizeof(header) + header.keylen, header.valueLength)) == NULL) {
+				fprintf(stderr, "Cannot allocate space for recovered value\n");
+				status = -1;
+				break;
+			}
+			if (aaInsert(rebuild->table, record + sizeof(header), header.keylen, value) < 0) {
+				freeValue(rebuild, value);
+				status = -1;
+				break;
+			}
+		} else if (header.op == LOG_DELETE) {
+			freeValue(rebuild, aaDelete(rebuild->table, record + sizeof(header), header.keylen));
+		}
+	}
+
+	free(record);
+	fclose(fp);
+	return status;
+}
+
+/**
+ * Put the table back as it stood at the end of the given segment:
+ * load the latest snapshot up to there, then replay the segments
+ * that follow it.
+ *
+ *  @return      1 on success, or -1 on failure
+ */
+static int rebuildTable(Rebuild *rebuild, const char *name, unsigned int through)
+{
+	AssociativeArray *snapshot;
+	unsigned int *segments, latest, highest;
+	char *filename;
+	long nSegments, i;
+	int status = 1;
+
+	/** find the snapshot first, then the segments after it */
+	if (findLogFiles(name, 0, through, &segments, &latest, &highest) < 0)
+		return -1;
+	free(segments);
+
+	if (latest > 0) {
+		filename = logFileName(name, latest, 1);
+		snapshot = (filename == NULL) ? NULL : aaOpenSnapshot(filename);
+		free(filename);
+		if (snapshot == NULL)
+			return -1;
+		status = snapshotForEach(snapshot, addSnapshotEntry, rebuild);
+		aaDeleteAssociativeArray(snapshot);
+		if (status < 0)
+			return -1;
+	}
+
+	if ((nSegments = findLogFiles(name, latest, through, &segments, &latest, &highest)) < 0)
+		return -1;
+	for (i = 0; i < nSegments && status > 0; i++) {
+		if ((filename = logFileName(name, segments[i], 0)) == NULL) {
+			status = -1;
+			break;
+		}
+		status = replaySegment(rebuild, filename);
+		free(filename);
+	}
+	free(segments);
+
+	return status;
+}
+
+/**
+ * Create a table as aaCreateAssociativeArrayWithConfig() does, and
+ * fill it from the latest snapshot of the named log and the log
+ * segments written since.  If there is no log yet, the table is
+ * simply left empty.  The values are malloc()ed copies of those
+ * logged, which the caller frees as usual.  A NULL config uses the
+ * default settings.
+ *
+ * The table has no log attached; call aaAttachLog() to carry on
+ * logging where the old log left off.
+ *
+ *  @return      the table, or NULL if it could not be rebuilt
+ */
+AssociativeArray *aaRecoverFromLog(const char *name,
+		size_t size,
+		char *probingStrategy,
+		char *hashPrimary,
+		char *hashSecondary,
+		const AAConfig *config)
+{
+	AAConfig defaults;
+	Rebuild rebuild;
+
+	if (config == NULL) {
+		aaInitConfig(&defaults);
+		config = &defaults;
+	}
+
+	rebuild.keepLengths = 0;
+	rebuild.table = aaCreateAssociativeArrayWithConfig(size,
+			probingStrategy, hashPrimary, hashSecondary, config);
+	if (rebuild.table == NULL)
+		return NULL;
+
+	if (rebuildTable(&rebuild, name, UINT32_MAX) < 0) {
+		fprintf(stderr, "Cannot recover table from log '%s'\n", name);
+		aaIterateAction(rebuild.table, freeKeptValue, &rebuild);
+		aaDeleteAssociativeArray(rebuild.table);
+		return NULL;
+	}
+	return rebuild.table;
+}
+
+/**
+ * Fold the segments up to the given one into a new snapshot, and
+ * remove the files it replaces.  The table is rebuilt off to the
+ * side, from the files, so this needs as much memory again as the
+ * table itself.
+ *
+ * A key inserted more than once has as many copies in the table,
+ * and a delete replayed later removes the one a search reaches
+ * first, so the snapshot keeps every copy, in that order.  It is a
+ * linear probing table that is rebuilt, so that the order a search
+ * reaches the copies in is the order they lie in.
+ *
+ *  @return      1 on success, or -1 on failure
+ */
+static int compactLog(const char *name, unsigned int through)
+{
+	Rebuild rebuild;
+	unsigned int *segments, latest, highest;
+	char *filename;
+	long nSegments, i;
+	int status;
+
+	rebuild.keepLengths = 1;
+	rebuild.table = aaCreateAssociativeArray(1024, "lin", "wyhash", "len");
+	if (rebuild.table == NULL)
+		return -1;
+
+	status = rebuildTable(&rebuild, name, through);
+	if (status > 0) {
+		filename = logFileName(name, through, 1);
+		status = (filename == NULL) ? -1
+				: writeSnapshot(filename, &rebuild.table, 1, keptValueLength, 1);
+		free(filename);
+	}
+	aaIterateAction(rebuild.table, freeKeptValue, &rebuild);
+	aaDeleteAssociativeArray(rebuild.table);
+	if (status < 0)
+		return -1;
+	syncLogDirectory(name);
+
+	/** the new snapshot replaces every file numbered up to it */
+	if ((nSegments = findLogFiles(name, 0, through, &segments, &latest, &highest)) < 0)
+		return 1;
+	for (i = 0; i < nSegments; i++) {
+		if ((filename = logFileName(name, segments[i], 0)) != NULL)
+			unlink(filename);
+		free(filename);
+	}
+	free(segments);
+
+	/** older snapshots go one at a time, newest first */
+	for (;;) {
+		if (findLogFiles(name, 0, through - 1, &segments, &latest, &highest) < 0)
+			break;
+		free(segments);
+		if (latest == 0 || (filename = logFileName(name, latest, 1)) == NULL)
+			break;
+		status = unlink(filename);
+		free(filename);
+		if (status < 0)
+			break;
+	}
+	syncLogDirectory(name);
+
+	return 1;
+}
+
+/** write the whole buffer, carrying on after short writes */
+static int writeBuffer(int fd, const unsigned char *data, size_t length)
+{
+	ssize_t nWritten;
+
+	while (length > 0) {
+		nWritten = write(fd, data, length);
+		if (nWritten < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += nWritten;
+		length -= (size_t) nWritten;
+	}
+	return 1;
+}
+
+/**
+ * Create a segment file and write its header.
+ *
+ *  @return      the open file, or -1 on failure
+ */
+static int createSegment(const char *name, unsigned int number)
+{
+	LogFileHeader header;
+	char *filename;
+	int fd;
+
+	if ((filename = logFileName(name, number, 0)) == NULL)
+		return -1;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot create log segment '%s' : %s\n", filename, strerror(errno));
+		free(filename);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+	header.version = LOG_VERSION;
+	header.byteOrder = LOG_BYTE_ORDER;
+	if (writeBuffer(fd, (const unsigned char *) &header, sizeof(header)) < 0
+			|| fdatasync(fd) < 0) {
+		fprintf(stderr, "Cannot write log segment '%s' : %s\n", filename, strerror(errno));
+		close(fd);
+		unlink(filename);
+		free(filename);
+		return -1;
+	}
+
+	free(filename);
+	syncLogDirectory(name);
+	return fd;
+}
+
+/** the time syncInterval milliseconds from now, for pthread_cond_timedwait() */
+static void syncDeadline(OperationLog *log, struct timespec *deadline)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_nsec += (long) log->config.syncInterval * 1000000L;
+	deadline->tv_sec += deadline->tv_nsec / 1000000000L;
+	deadline->tv_nsec %= 1000000000L;
+}
+
+/**
+ * The writer thread: waits for a batch of records to be worth
+ * writing, then writes and syncs it with the log unlocked, so the
+ * table can carry on filling the other buffer meanwhile.
+ */
+static void *logWriter(void *argument)
+{
+	OperationLog *log = (OperationLog *) argument;
+	struct timespec deadline;
+	LogBuffer swap;
+	uint64_t batchEnd;
+	int status, fd;
+
+	pthread_mutex_lock(&log->lock);
+	for (;;) {
+		if (log->active.used == 0) {
+			if (log->stopping)
+				break;
+			pthread_cond_wait(&log->wakeWriter, &log->lock);
+			continue;
+		}
+
+		/** give the batch time to grow, unless someone is waiting on it */
+		if ( ! log->stopping && ! log->full && log->syncWanted <= log->durable
+				&& log->active.used < log->active.size / 2) {
+			syncDeadline(log, &deadline);
+			while ( ! log->stopping && ! log->full && log->syncWanted <= log->durable
+					&& log->active.used < log->active.size / 2
+					&& pthread_cond_timedwait(&log->wakeWriter, &log->lock, &deadline) == 0)
+				;
+		}
+
+		swap = log->flushing;
+		log->flushing = log->active;
+		log->active = swap;
+		log->full = 0;
+		batchEnd = log->appended;
+		pthread_cond_broadcast(&log->written);
+		pthread_mutex_unlock(&log->lock);
+
+		status = 1;
+		if (writeBuffer(log->fd, log->flushing.data, log->flushing.used) < 0
+				|| fdatasync(log->fd) < 0) {
+			fprintf(stderr, "Cannot write log '%s' : %s\n", log->name, strerror(errno));
+			status = -1;
+		}
+		log->segmentBytes += log->flushing.used;
+		log->flushing.used = 0;
+
+		/** move on to a new segment once this one is big enough */
+		fd = -1;
+		if (status > 0 && log->segmentBytes >= log->config.segmentBytes
+				&& (fd = createSegment(log->name, log->segment + 1)) >= 0) {
+			close(log->fd);
+			log->fd = fd;
+			log->segmentBytes = 0;
+		}
+
+		pthread_mutex_lock(&log->lock);
+		if (status < 0)
+			log->status = -1;
+		if (fd >= 0) {
+			log->segment++;
+			pthread_cond_signal(&log->wakeCompactor);
+		}
+		log->durable = batchEnd;
+		pthread_cond_broadcast(&log->written);
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	return NULL;
+}
+
+/**
+ * The compactor thread: folds the closed segments into a snapshot
+ * once there are compactSegments of them
+ */
+static void *logCompactor(void *argument)
+{
+	OperationLog *log = (OperationLog *) argument;
+	unsigned int through;
+
+	pthread_mutex_lock(&log->lock);
+	for (;;) {
+		while ( ! log->stopping && (log->config.compactSegments == 0
+				|| log->segment - 1 - log->compactedThrough < log->config.compactSegments))
+			pthread_cond_wait(&log->wakeCompactor, &log->lock);
+		if (log->stopping)
+			break;
+
+		through = log->segment - 1;
+		pthread_mutex_unlock(&log->lock);
+
+		if (compactLog(log->name, through) < 0) {
+			fprintf(stderr, "Cannot compact log '%s' - no longer compacting it\n", log->name);
+			pthread_mutex_lock(&log->lock);
+			log->config.compactSegments = 0;
+			continue;
+		}
+
+		pthread_mutex_lock(&log->lock);
+		log->compactedThrough = through;
+	}
+	pthread_mutex_unlock(&log->lock);
+
+	return NULL;
+}
+
+/** fill in a log configuration with the default settings */
+void aaInitLogConfig(AALogConfig *config)
+{
+	config->bufferSize = DEFAULT_BUFFER_SIZE;
+	config->syncInterval = DEFAULT_SYNC_INTERVAL;
+	config->segmentBytes = DEFAULT_SEGMENT_BYTES;
+	config->compactSegments = DEFAULT_COMPACT_SEGMENTS;
+}
+
+/** free a log whose threads are not running */
+static void releaseLog(OperationLog *log)
+{
+	if (log->fd >= 0)
+		close(log->fd);
+	pthread_mutex_destroy(&log->lock);
+	pthread_cond_destroy(&log->wakeWriter);
+	pthread_cond_destroy(&log->written);
+	pthread_cond_destroy(&log->wakeCompactor);
+	free(log->active.data);
+	free(log->flushing.data);
+	free(log->name);
+	free(log);
+}
+
+/**
+ * Log every insert and delete made on the table from now on, in a
+ * new segment of the named log, following any segments already
+ * there.  Values are logged as the number of bytes valueLength()
+ * gives for each (or not at all, if it is NULL).  A NULL config
+ * uses the defaults.
+ *
+ *  @return      1 on success, or -1 if the log could not be started
+ */
+int aaAttachLog(AssociativeArray *aarray, const char *name,
+		AAValueLength valueLength, const AALogConfig *config)
+{
+	OperationLog *log;
+	unsigned int *segments, latest, highest;
+
+	if (aarray->snapshot != NULL || aarray->log != NULL) {
+		fprintf(stderr, "Cannot log a table that is read-only or already logged\n");
+		return -1;
+	}
+
+	log = (OperationLog *) calloc(1, sizeof(OperationLog));
+	if (log == NULL || (log->name = strdup(name)) == NULL) {
+		fprintf(stderr, "Cannot allocate log '%s'\n", name);
+		free(log);
+		return -1;
+	}
+	log->valueLength = valueLength;
+	log->fd = -1;
+	log->status = 1;
+	if (config == NULL) {
+		aaInitLogConfig(&log->config);
+	} else {
+		log->config = *config;
+	}
+	if (log->config.bufferSize < sizeof(LogRecord))
+		log->config.bufferSize = DEFAULT_BUFFER_SIZE;
+
+	pthread_mutex_init(&log->lock, NULL);
+	pthread_cond_init(&log->wakeWriter, NULL);
+	pthread_cond_init(&log->written, NULL);
+	pthread_cond_init(&log->wakeCompactor, NULL);
+
+	log->active.data = (unsigned char *) malloc(log->config.bufferSize);
+	log->flushing.data = (unsigned char *) malloc(log->config.bufferSize);
+	log->active.size = log->flushing.size = log->config.bufferSize;
+	if (log->active.data == NULL || log->flushing.data == NULL) {
+		fprintf(stderr, "Cannot allocate buffers for log '%s'\n", name);
+		releaseLog(log);
+		return -1;
+	}
+
+	/** carry on after whatever is there already */
+	if (findLogFiles(name, 0, UINT32_MAX, &segments, &latest, &highest) < 0) {
+		releaseLog(log);
+		return -1;
+	}
+	free(segments);
+	log->compactedThrough = latest;
+	log->segment = highest + 1;
+
+	if ((log->fd = createSegment(name, log->segment)) < 0) {
+		releaseLog(log);
+		return -1;
+	}
+
+	if (pthread_create(&log->writer, NULL, logWriter, log) != 0) {
+		fprintf(stderr, "Cannot start writer for log '%s'\n", name);
+		releaseLog(log);
+		return -1;
+	}
+	if (pthread_create(&log->compactor, NULL, logCompactor, log) != 0) {
+		fprintf(stderr, "Cannot start compactor for log '%s'\n", name);
+		pthread_mutex_lock(&log->lock);
+		log->stopping = 1;
+		pthread_cond_signal(&log->wakeWriter);
+		pthread_mutex_unlock(&log->lock);
+		pthread_join(log->writer, NULL);
+		releaseLog(log);
+		return -1;
+	}
+
+	aarray->log = log;
+	return 1;
+}
+
+/**
+ * Add a record to the log.  Only the copy into the buffer is done
+ * here; should the buffer be full, we wait for the writer to take
+ * it, which is the only time the table waits on the log.
+ */
+void logOperation(OperationLog *log, int isInsert,
+		AAKeyType key, size_t keylen, void *value)
+{
+	size_t valueLength = 0, length;
+	unsigned char *record, *grown;
+	LogRecord header;
+
+	if (isInsert && value != NULL && log->valueLength != NULL)
+		valueLength = log->valueLength(value);
+	length = sizeof(LogRecord) + keylen + valueLength;
+
+	if (keylen > UINT32_MAX || valueLength > UINT32_MAX) {
+		fprintf(stderr, "Cannot log a key or value of more than 4GB\n");
+		pthread_mutex_lock(&log->lock);
+		log->status = -1;
+		pthread_mutex_unlock(&log->lock);
+		return;
+	}
+
+	pthread_mutex_lock(&log->lock);
+	while (log->active.used + length > log->active.size) {
+		/** a record bigger than the buffer gets a buffer of its own */
+		if (log->active.used == 0) {
+			grown = (unsigned char *) realloc(log->active.data, length);
+			if (grown == NULL) {
+				fprintf(stderr, "Cannot allocate space to log a record\n");
+				log->status = -1;
+				pthread_mutex_unlock(&log->lock);
+				return;
+			}
+			log->active.data = grown;
+			log->active.size = length;
+			break;
+		}
+		log->full = 1;
+		pthread_cond_signal(&log->wakeWriter);
+		pthread_cond_wait(&log->written, &log->lock);
+	}
+
+	record = log->active.data + log->active.used;
+	memset(&header, 0, sizeof(header));
+	header.op = isInsert ? LOG_INSERT : LOG_DELETE;
+	header.keylen = (uint32_t) keylen;
+	header.valueLength = (uint32_t) valueLength;
+	memcpy(record, &header, sizeof(header));
+	memcpy(record + sizeof(header), key, keylen);
+	if (valueLength > 0)
+		memcpy(record + sizeof(header) + keylen, value, valueLength);
+	header.checksum = recordChecksum(record, length);
+	memcpy(record, &header.checksum, sizeof(header.checksum));
+
+	log->active.used += length;
+	log->appended += length;
+
+	/** the writer is only woken for the first record of a batch, or a full buffer */
+	if (log->active.used == length || log->active.used >= log->active.size / 2)
+		pthread_cond_signal(&log->wakeWriter);
+	pthread_mutex_unlock(&log->lock);
+}
+
+/**
+ * Wait until every change logged so far is on disk.  Changes from
+ * other calls that arrive meanwhile are written and synced along
+ * with them.
+ *
+ *  @return      1 on success, or -1 if a write to the log has failed
+ */
+int aaLogSync(AssociativeArray *aarray)
+{
+	OperationLog *log = aarray->log;
+	uint64_t target;
+	int status;
+
+	if (log == NULL)
+		return 1;
+
+	pthread_mutex_lock(&log->lock);
+	target = log->appended;
+	if (log->syncWanted < target)
+		log->syncWanted = target;
+	pthread_cond_signal(&log->wakeWriter);
+	while (log->durable < target)
+		pthread_cond_wait(&log->written, &log->lock);
+	status = log->status;
+	pthread_mutex_unlock(&log->lock);
+
+	return status;
+}
+
+/**
+ * Write out and sync everything logged, wait for any compaction
+ * under way to finish, and stop logging the table.
+ *
+ *  @return      1 on success, or -1 if a write to the log failed
+ */
+int aaDetachLog(AssociativeArray *aarray)
+{
+	OperationLog *log = aarray->log;
+	int status;
+
+	if (log == NULL)
+		return 1;
+
+	pthread_mutex_lock(&log->lock);
+	log->stopping = 1;
+	pthread_cond_signal(&log->wakeWriter);
+	pthread_cond_signal(&log->wakeCompactor);
+	pthread_mutex_unlock(&log->lock);
+
+	pthread_join(log->writer, NULL);
+	pthread_join(log->compactor, NULL);
+
+	status = log->status;
+	releaseLog(log);
+	aarray->log = NULL;
+	return status;
+}
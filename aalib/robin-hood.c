@@ -0,0 +1,137 @@
+/**
+ * Robin Hood probing: a linear probing layout in which every slot
+ * records how far its entry sits from the slot it hashed to (its
+ * "probe distance").
+ *
+ * When inserting, an entry that has travelled further than the
+ * entry in the slot it is looking at takes that slot, and the
+ * displaced entry carries on looking.  This keeps probe distances
+ * close to each other, so even at high load factors no key ends up
+ * very far from home.  It also lets a search stop as soon as it
+ * sees an entry that is closer to home than the key being searched
+ * for would be at that slot.
+ *
+ * Deletion shifts the following entries back one slot, rather than
+ * leaving a tombstone, so searches never have to step over
+ * deleted slots.
+ */
+#include <string.h>
+
+#include "hashtools.h"
+
+/** the next slot along, wrapping at the end of the table */
+static inline HashIndex nextSlot(AssociativeArray *aarray, HashIndex index)
+{
+	return (index + 1 == aarray->size) ? 0 : index + 1;
+}
+
+static long robinHoodInsert(AssociativeArray *aarray,
+		KeyDataPair *entry, HashValue hash, int *cost)
+{
+	HashIndex index = reduceHash(&aarray->sizer, hash);
+	KeyDataPair carried = *entry, swap;
+	long placedAt = -1;
+	size_t steps;
+
+	/**
+	 * Entries are displaced along the probe path before the empty
+	 * slot is reached, so make sure there is one first: a table that
+	 * cannot grow must be left as it was when the insert fails
+	 */
+	if (aarray->nEntries >= aarray->size)
+		return -1;
+
+	carried.validity = HASH_USED;
+	carried.aux.probeDistance = 0;
+
+	for (steps = 0; steps < aarray->size; steps++) {
+		KeyDataPair *slot = &aarray->table[index];
+
+		if (slot->validity != HASH_USED) {
+			*slot = carried;
+			aarray->nEntries++;
+			return (placedAt < 0) ? (long) index : placedAt;
+		}
+
+		/** take from the rich (close to home) and give to the poor */
+		if (slot->aux.probeDistance < carried.aux.probeDistance) {
+			swap = *slot;
+			*slot = carried;
+			carried = swap;
+			if (placedAt < 0)
+				placedAt = (long) index;
+		}
+
+		index = nextSlot(aarray, index);
+		carried.aux.probeDistance++;
+		(*cost)++;
+	}
+
+	/**
+	 * Not reached: with no tombstones, a table that is not full has
+	 * an empty slot that the loop above comes to within size steps
+	 */
+	return -1;
+}
+
+static KeyDataPair *robinHoodFind(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash, int *cost)
+{
+	HashIndex index = reduceHash(&aarray->sizer, hash);
+	unsigned int distance;
+
+	for (distance = 0; distance < aarray->size; distance++) {
+		KeyDataPair *slot = &aarray->table[index];
+
+		/**
+		 * An empty slot, or an entry closer to home than we
+		 * would be here, means our key would have been placed
+		 * here or earlier if it were in the table.
+		 */
+		if (slot->validity != HASH_USED || slot->aux.probeDistance < distance)
+			return NULL;
+
+		if (slotHoldsKey(slot, key, keylen, hash))
+			return slot;
+
+		index = nextSlot(aarray, index);
+		(*cost)++;
+	}
+
+	return NULL;
+}
+
+/**
+ * Backward shift deletion: move each following entry back one
+ * slot until we reach an empty slot or an entry that is already
+ * in its home slot, then empty the last slot moved from.
+ */
+static void robinHoodRemove(AssociativeArray *aarray, KeyDataPair *slot)
+{
+	HashIndex index = (HashIndex) (slot - aarray->table);
+	HashIndex next = nextSlot(aarray, index);
+
+	while (aarray->table[next].validity == HASH_USED
+			&& aarray->table[next].aux.probeDistance > 0) {
+		aarray->table[index] = aarray->table[next];
+		aarray->table[index].aux.probeDistance--;
+		index = next;
+		next = nextSlot(aarray, index);
+	}
+
+	memset(&aarray->table[index], 0, sizeof(KeyDataPair));
+	aarray->table[index].validity = HASH_EMPTY;
+}
+
+/** the Robin Hood layout, which never leaves tombstones */
+const TableLayout robinHoodLayout = {
+		"robin hood linear probing",
+		0,
+		1,
+		NULL,
+		NULL,
+		robinHoodInsert,
+		robinHoodFind,
+		prefetchHomeSlot,
+		robinHoodRemove
+	};
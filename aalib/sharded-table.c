@@ -0,0 +1,788 @@
+/**
+ * A table split into independent shards.
+ *
+ * Each key belongs to one of a power of two number of shards,
+ * chosen from the high bits of a remix of its hash.  Every shard is
+ * an ordinary AssociativeArray, sized, grown and shrunk on its own,
+ * so the whole table can hold as many entries as all of its shards
+ * together, and no single rehash ever has to move more than one
+ * shard's worth of entries.
+ *
+ * Used directly, a sharded table is no more thread-safe than a
+ * plain one.  Instead, each shard may be given to a worker thread
+ * that owns it outright: requests are passed to the worker through
+ * a queue, so the shard's slots are only ever touched by the one
+ * core, and are never shared between caches.  Results come back
+ * through a callback, run on the worker thread.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hashtools.h"
+
+#define	MAX_SHARDS		65536
+
+/** the most threads a bulk insert will use */
+#define	MAX_BULK_THREADS	256
+
+/** requests waiting for one worker, and how many it takes at once */
+#define	QUEUE_DEPTH		1024
+#define	WORKER_BATCH	64
+
+typedef struct ShardRequest {
+	AAShardOp op;
+	AAKeyType key;
+	size_t keylen;
+	void *value;
+	HashValue hash;
+	AAShardCallback callback;
+	void *userdata;
+} ShardRequest;
+
+/** a bounded queue of requests for one worker */
+typedef struct ShardQueue {
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	pthread_cond_t idle;
+	ShardRequest *requests;
+	size_t head;
+	size_t count;
+	int busy;				/** the worker is running requests it has taken */
+	int stopping;
+} ShardQueue;
+
+typedef struct Shard {
+	AssociativeArray *table;
+	ShardQueue queue;
+	pthread_t worker;
+} Shard;
+
+/** one shard per cache line, so the workers do not share lines */
+typedef union PaddedShard {
+	Shard shard;
+	unsigned char pad[(sizeof(Shard) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE];
+} PaddedShard;
+
+struct AAShardedArray {
+	PaddedShard *shards;
+	size_t nShards;
+	int shardShift;
+	HashAlgorithm hashAlgorithm;
+	HashSeed seed;
+	int workersRunning;
+};
+
+static inline Shard *shardFor(AAShardedArray *sarray, HashValue hash)
+{
+	return &sarray->shards[partOfHash(hash, sarray->shardShift)].shard;
+}
+
+/**
+ * Create a sharded table.
+ *
+ *  @param  nShards  how many shards to split the table into, rounded
+ *				up to a power of two
+ *  @param  size  the initial size of the whole table, shared out
+ *				between the shards
+ *  @return the new table, or NULL if it could not be created
+ *
+ *  @see    aaCreateAssociativeArrayWithConfig
+ */
+AAShardedArray *
+aaCreateShardedArray(
+		size_t nShards,
+		size_t size,
+		char *probingStrategy,
+		char *hashPrimary,
+		char *hashSecondary,
+		const AAConfig *config
+	)
+{
+	AAShardedArray *sarray;
+	AAConfig shardConfig = *config;
+	size_t i, shardSize;
+	void *memory;
+	int log2 = 0;
+
+	if (nShards < 1)
+		nShards = 1;
+	if (nShards > MAX_SHARDS)
+		nShards = MAX_SHARDS;
+	while (((size_t) 1 << log2) < nShards)
+		log2++;
+	nShards = (size_t) 1 << log2;
+
+	sarray = (AAShardedArray *) malloc(sizeof(AAShardedArray));
+	if (sarray == NULL)
+		return NULL;
+
+	if (posix_memalign(&memory, CACHE_LINE, nShards * sizeof(PaddedShard)) != 0) {
+		fprintf(stderr, "Cannot allocate sharded table of %zu shards\n", nShards);
+		free(sarray);
+		return NULL;
+	}
+	memset(memory, 0, nShards * sizeof(PaddedShard));
+	sarray->shards = (PaddedShard *) memory;
+	sarray->nShards = nShards;
+	sarray->shardShift = 64 - log2;
+	sarray->workersRunning = 0;
+
+	/** every shard must hash a key the same way, so they share one seed */
+	shardConfig.seed = sharedTableSeed(config->seed);
+
+	shardSize = size / nShards;
+	if (shardSize < 1)
+		shardSize = 1;
+
+	for (i = 0; i < nShards; i++) {
+		sarray->shards[i].shard.table = aaCreateAssociativeArrayWithConfig(shardSize,
+				probingStrategy, hashPrimary, hashSecondary, &shardConfig);
+		if (sarray->shards[i].shard.table == NULL) {
+			fprintf(stderr, "Cannot create shard %zu of sharded table\n", i);
+			sarray->nShards = i;
+			aaDeleteShardedArray(sarray);
+			return NULL;
+		}
+	}
+
+	sarray->hashAlgorithm = sarray->shards[0].shard.table->hashAlgorithmPrimary;
+	sarray->seed = sarray->shards[0].shard.table->seedPrimary;
+
+	return sarray;
+}
+
+/**
+ * Deallocate the table and all of its shards, stopping the
+ * workers first if they are running.
+ */
+void
+aaDeleteShardedArray(AAShardedArray *sarray)
+{
+	size_t i;
+
+	if (sarray == NULL)
+		return;
+
+	if (sarray->workersRunning)
+		aaStopShardWorkers(sarray);
+
+	for (i = 0; i < sarray->nShards; i++)
+		aaDeleteAssociativeArray(sarray->shards[i].shard.table);
+	free(sarray->shards);
+	free(sarray);
+}
+
+/** the number of shards, after rounding up to a power of two */
+size_t aaShardCount(AAShardedArray *sarray)
+{
+	return sarray->nShards;
+}
+
+/** the shard a key belongs to, for callers that partition work themselves */
+size_t aaShardOf(AAShardedArray *sarray, AAKeyType key, size_t keylen)
+{
+	return partOfHash(sarray->hashAlgorithm(key, keylen, &sarray->seed), sarray->shardShift);
+}
+
+/**
+ * One shard as a table in its own right.  It may be used from a
+ * different thread than the other shards, as long as each shard is
+ * only used by one thread at a time, and must not be deleted.
+ */
+AssociativeArray *aaGetShard(AAShardedArray *sarray, size_t shard)
+{
+	if (shard >= sarray->nShards)
+		return NULL;
+	return sarray->shards[shard].shard.table;
+}
+
+/** add a key and value to the table, as aaInsert() */
+long aaShardedInsert(AAShardedArray *sarray, AAKeyType key, size_t keylen, void *value)
+{
+	HashValue hash = sarray->hashAlgorithm(key, keylen, &sarray->seed);
+	AssociativeArray *table = shardFor(sarray, hash)->table;
+
+	return insertHashed(table, key, keylen, value, hash, NULL);
+}
+
+/** locate the value stored with a key, as aaLookup() */
+void *aaShardedLookup(AAShardedArray *sarray, AAKeyType key, size_t keylen)
+{
+	HashValue hash = sarray->hashAlgorithm(key, keylen, &sarray->seed);
+	AssociativeArray *table = shardFor(sarray, hash)->table;
+	KeyDataPair *slot;
+
+	slot = findHashed(table, key, keylen, hash);
+	return (slot == NULL) ? NULL : slot->value;
+}
+
+/** remove a key from the table, as aaDelete() */
+void *aaShardedDelete(AAShardedArray *sarray, AAKeyType key, size_t keylen)
+{
+	HashValue hash = sarray->hashAlgorithm(key, keylen, &sarray->seed);
+	AssociativeArray *table = shardFor(sarray, hash)->table;
+
+	return deleteHashed(table, key, keylen, hash, NULL);
+}
+
+/** the BatchTableChooser of a sharded table: each key is searched in its shard */
+static AssociativeArray *shardOfKey(void *context,
+		AAKeyType key, size_t keylen, HashValue *hash)
+{
+	AAShardedArray *sarray = (AAShardedArray *) context;
+
+	*hash = sarray->hashAlgorithm(key, keylen, &sarray->seed);
+	return shardFor(sarray, *hash)->table;
+}
+
+/** look up a batch of keys at once, as aaLookupBatch() */
+size_t aaShardedLookupBatch(AAShardedArray *sarray,
+		AAKeyType keys[], size_t keylengths[], size_t nKeys,
+		void *values[])
+{
+	return lookupBatch(shardOfKey, sarray, keys, keylengths, nKeys, values);
+}
+
+/** one thread's share of a bulk insert */
+typedef struct BulkPart {
+	AAShardedArray *sarray;
+	AAKeyType *keys;
+	size_t *keylengths;
+	void **values;
+	HashValue *hashes;
+	size_t *order;			/** the keys, grouped by shard */
+	size_t *shardStart;		/** where each shard's keys start in order[] */
+	size_t *counts;			/** this thread's keys in each shard */
+	size_t first, last;		/** the keys this thread hashes */
+	int thread, nThreads;
+	long status;
+	pthread_t id;
+} BulkPart;
+
+/** hash this thread's keys, counting how many go to each shard */
+static void *bulkHash(void *argument)
+{
+	BulkPart *part = (BulkPart *) argument;
+	AAShardedArray *sarray = part->sarray;
+	size_t i;
+
+	for (i = part->first; i < part->last; i++) {
+		part->hashes[i] = sarray->hashAlgorithm(part->keys[i],
+				part->keylengths[i], &sarray->seed);
+		part->counts[partOfHash(part->hashes[i], sarray->shardShift)]++;
+	}
+	return NULL;
+}
+
+/**
+ * Place this thread's keys in order[], after those of the earlier
+ * threads in each shard, so that each shard sees its keys in the
+ * order they were given; counts[] has been turned into where this
+ * thread's keys for each shard start.
+ */
+static void *bulkScatter(void *argument)
+{
+	BulkPart *part = (BulkPart *) argument;
+	size_t i;
+
+	for (i = part->first; i < part->last; i++)
+		part->order[part->counts[partOfHash(part->hashes[i], part->sarray->shardShift)]++] = i;
+	return NULL;
+}
+
+/** insert the keys of every shard this thread owns */
+static void *bulkInsert(void *argument)
+{
+	BulkPart *part = (BulkPart *) argument;
+	AAShardedArray *sarray = part->sarray;
+	AssociativeArray *table;
+	size_t shard, i, key;
+
+	for (shard = part->thread; shard < sarray->nShards; shard += part->nThreads) {
+		table = sarray->shards[shard].shard.table;
+		reserveTable(table, part->shardStart[shard + 1] - part->shardStart[shard]);
+
+		for (i = part->shardStart[shard]; i < part->shardStart[shard + 1]; i++) {
+			key = part->order[i];
+			if (insertHashed(table, part->keys[key], part->keylengths[key],
+					part->values[key], part->hashes[key], NULL) < 0) {
+				part->status = -1;
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+/** run one step of the bulk insert on every thread, and wait for them */
+static void runBulkStep(BulkPart *parts, int nThreads, void *(*step)(void *))
+{
+	int i, nStarted;
+
+	for (nStarted = 1; nStarted < nThreads; nStarted++) {
+		if (pthread_create(&parts[nStarted].id, NULL, step, &parts[nStarted]) != 0)
+			break;
+	}
+
+	/** this thread does the first share, and any that could not be started */
+	step(&parts[0]);
+	for (i = nStarted; i < nThreads; i++)
+		step(&parts[i]);
+
+	for (i = 1; i < nStarted; i++)
+		pthread_join(parts[i].id, NULL);
+}
+
+/**
+ * Insert many keys at once, using several threads.  The keys are
+ * hashed in parallel and grouped by shard, then each thread inserts
+ * the keys for the shards it owns, so no two threads ever touch the
+ * same shard and no locking is needed.  Each shard is sized for its
+ * new keys before they are inserted.  Keys are inserted into each
+ * shard in the order given, so when a key is repeated, lookups find
+ * the same entry as if the keys had been inserted one at a time.
+ *
+ * The workers started by aaStartShardWorkers() must not be running.
+ *
+ *  @param  nThreads  the number of threads to use, including the
+ *				 calling thread
+ *  @return      the number of keys inserted, or -1 if any key could
+ *				 not be inserted (some of the others may have been)
+ */
+long aaShardedInsertBulk(AAShardedArray *sarray,
+		AAKeyType keys[], size_t keylengths[], void *values[], size_t nKeys,
+		int nThreads)
+{
+	BulkPart *parts = NULL;
+	HashValue *hashes = NULL;
+	size_t *order = NULL, *shardStart = NULL, *counts = NULL;
+	size_t shard, position;
+	long status;
+	int i;
+
+	if (sarray->workersRunning) {
+		fprintf(stderr, "Cannot bulk insert while the shard workers are running\n");
+		return -1;
+	}
+
+	if (nThreads < 1)
+		nThreads = 1;
+	if (nThreads > MAX_BULK_THREADS)
+		nThreads = MAX_BULK_THREADS;
+	if ((size_t) nThreads > sarray->nShards)
+		nThreads = (int) sarray->nShards;
+
+	parts = (BulkPart *) calloc(nThreads, sizeof(BulkPart));
+	hashes = (HashValue *) malloc(nKeys * sizeof(HashValue));
+	order = (size_t *) malloc(nKeys * sizeof(size_t));
+	shardStart = (size_t *) malloc((sarray->nShards + 1) * sizeof(size_t));
+	counts = (size_t *) calloc(nThreads * sarray->nShards, sizeof(size_t));
+	if (parts == NULL || (nKeys > 0 && (hashes == NULL || order == NULL))
+			|| shardStart == NULL || counts == NULL) {
+		fprintf(stderr, "Cannot allocate space to bulk insert %zu keys\n", nKeys);
+		free(parts);
+		free(hashes);
+		free(order);
+		free(shardStart);
+		free(counts);
+		return -1;
+	}
+
+	for (i = 0; i < nThreads; i++) {
+		parts[i].sarray = sarray;
+		parts[i].keys = keys;
+		parts[i].keylengths = keylengths;
+		parts[i].values = values;
+		parts[i].hashes = hashes;
+		parts[i].order = order;
+		parts[i].shardStart = shardStart;
+		parts[i].counts = &counts[i * sarray->nShards];
+		parts[i].first = nKeys * i / nThreads;
+		parts[i].last = nKeys * (i + 1) / nThreads;
+		parts[i].thread = i;
+		parts[i].nThreads = nThreads;
+		parts[i].status = 1;
+	}
+
+	runBulkStep(parts, nThreads, bulkHash);
+
+	/** turn the counts into where each thread's keys for each shard go */
+	position = 0;
+	for (shard = 0; shard < sarray->nShards; shard++) {
+		shardStart[shard] = position;
+		for (i = 0; i < nThreads; i++) {
+			size_t count = parts[i].counts[shard];
+
+			parts[i].counts[shard] = position;
+			position += count;
+		}
+	}
+	shardStart[sarray->nShards] = position;
+
+	runBulkStep(parts, nThreads, bulkScatter);
+	runBulkStep(parts, nThreads, bulkInsert);
+
+	status = (long) nKeys;
+	for (i = 0; i < nThreads; i++) {
+		if (parts[i].status < 0)
+			status = -1;
+	}
+
+	free(parts);
+	free(hashes);
+	free(order);
+	free(shardStart);
+	free(counts);
+	return status;
+}
+
+/** call the user function on every entry, one shard after another */
+int aaShardedIterateAction(
+		AAShardedArray *sarray,
+		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
+		void *userdata
+	)
+{
+	size_t i;
+
+	for (i = 0; i < sarray->nShards; i++) {
+		if (aaIterateAction(sarray->shards[i].shard.table, userfunction, userdata) < 0)
+			return -1;
+	}
+	return 1;
+}
+
+/** carry out one request on the shard that owns its key */
+static void runRequest(Shard *shard, ShardRequest *request)
+{
+	AssociativeArray *table = shard->table;
+	KeyDataPair *slot;
+	void *value = NULL;
+	long status;
+
+	switch (request->op) {
+	case AA_SHARD_INSERT:
+		status = insertHashed(table, request->key, request->keylen,
+				request->value, request->hash, NULL);
+		value = request->value;
+		break;
+
+	case AA_SHARD_LOOKUP:
+		slot = findHashed(table, request->key, request->keylen, request->hash);
+		if (slot != NULL)
+			value = slot->value;
+		status = (slot != NULL);
+		break;
+
+	default:
+		value = deleteHashed(table, request->key, request->keylen,
+				request->hash, NULL);
+		status = (value != NULL);
+		break;
+	}
+
+	if (request->callback != NULL)
+		request->callback(request->userdata, request->op,
+				request->key, request->keylen, value, status);
+}
+
+/**
+ * The owner of one shard: take requests off the queue a batch at
+ * a time, so the queue lock is taken once per batch rather than
+ * once per request, and run them.
+ */
+static void *shardWorker(void *argument)
+{
+	Shard *shard = (Shard *) argument;
+	ShardQueue *queue = &shard->queue;
+	ShardRequest batch[WORKER_BATCH];
+	size_t nTaken, i;
+
+	pthread_mutex_lock(&queue->lock);
+	for (;;) {
+		while (queue->count == 0 && ! queue->stopping)
+			pthread_cond_wait(&queue->notEmpty, &queue->lock);
+		if (queue->count == 0)
+			break;
+
+		for (nTaken = 0; nTaken < WORKER_BATCH && queue->count > 0; nTaken++) {
+			batch[nTaken] = queue->requests[queue->head];
+			queue->head = (queue->head + 1) % QUEUE_DEPTH;
+			queue->count--;
+		}
+		queue->busy = 1;
+		pthread_cond_broadcast(&queue->notFull);
+		pthread_mutex_unlock(&queue->lock);
+
+		for (i = 0; i < nTaken; i++)
+			runRequest(shard, &batch[i]);
+
+		pthread_mutex_lock(&queue->lock);
+		queue->busy = 0;
+		if (queue->count == 0)
+			pthread_cond_broadcast(&queue->idle);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return NULL;
+}
+
+static void releaseQueue(ShardQueue *queue)
+{
+	pthread_mutex_destroy(&queue->lock);
+	pthread_cond_destroy(&queue->notEmpty);
+	pthread_cond_destroy(&queue->notFull);
+	pthread_cond_destroy(&queue->idle);
+	free(queue->requests);
+}
+
+static void stopWorkers(AAShardedArray *sarray, size_t nStarted)
+{
+	size_t i;
+
+	for (i = 0; i < nStarted; i++) {
+		ShardQueue *queue = &sarray->shards[i].shard.queue;
+
+		pthread_mutex_lock(&queue->lock);
+		queue->stopping = 1;
+		pthread_cond_broadcast(&queue->notEmpty);
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	for (i = 0; i < nStarted; i++) {
+		pthread_join(sarray->shards[i].shard.worker, NULL);
+		releaseQueue(&sarray->shards[i].shard.queue);
+	}
+	sarray->workersRunning = 0;
+}
+
+/**
+ * Give each shard a worker thread of its own.  From then until
+ * aaStopShardWorkers(), the table must only be used through
+ * aaShardedSubmit() and aaShardedDrain().
+ *
+ *  @return      1 on success, or -1 if the workers could not all be
+ *				 started, in which case none are left running
+ */
+int aaStartShardWorkers(AAShardedArray *sarray)
+{
+	size_t i;
+
+	if (sarray->workersRunning)
+		return 1;
+
+	for (i = 0; i < sarray->nShards; i++) {
+		Shard *shard = &sarray->shards[i].shard;
+		ShardQueue *queue = &shard->queue;
+
+		memset(queue, 0, sizeof(ShardQueue));
+		queue->requests = (ShardRequest *) malloc(QUEUE_DEPTH * sizeof(ShardRequest));
+		if (queue->requests == NULL
+				|| pthread_mutex_init(&queue->lock, NULL) != 0
+				|| pthread_cond_init(&queue->notEmpty, NULL) != 0
+				|| pthread_cond_init(&queue->notFull, NULL) != 0
+				|| pthread_cond_init(&queue->idle, NULL) != 0
+				|| pthread_create(&shard->worker, NULL, shardWorker, shard) != 0) {
+			fprintf(stderr, "Cannot start worker for shard %zu\n", i);
+			free(queue->requests);
+			stopWorkers(sarray, i);
+			return -1;
+		}
+	}
+
+	sarray->workersRunning = 1;
+	return 1;
+}
+
+/** finish all queued requests, then stop the workers */
+void aaStopShardWorkers(AAShardedArray *sarray)
+{
+	if (sarray->workersRunning)
+		stopWorkers(sarray, sarray->nShards);
+}
+
+/**
+ * Queue a request for the worker that owns the key's shard,
+ * waiting if its queue is full.  The key (and for an insert, the
+ * value) must stay valid until the callback has been run; the
+ * callback is run on the worker thread, with the value inserted,
+ * found or deleted, and a status that is the result of aaInsert()
+ * for an insert, or 1 if the key was found and 0 if not otherwise.
+ *
+ *  @return      1 once the request is queued, or -1 if the workers
+ *				 are not running
+ */
+int aaShardedSubmit(AAShardedArray *sarray, AAShardOp op,
+		AAKeyType key, size_t keylen, void *value,
+		AAShardCallback callback, void *userdata)
+{
+	ShardRequest request;
+	ShardQueue *queue;
+
+	if ( ! sarray->workersRunning)
+		return -1;
+
+	request.op = op;
+	request.key = key;
+	request.keylen = keylen;
+	request.value = value;
+	request.hash = sarray->hashAlgorithm(key, keylen, &sarray->seed);
+	request.callback = callback;
+	request.userdata = userdata;
+
+	queue = &shardFor(sarray, request.hash)->queue;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == QUEUE_DEPTH)
+		pthread_cond_wait(&queue->notFull, &queue->lock);
+	queue->requests[(queue->head + queue->count) % QUEUE_DEPTH] = request;
+	queue->count++;
+	pthread_cond_signal(&queue->notEmpty);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 1;
+}
+
+/** wait until every request queued so far has been run */
+void aaShardedDrain(AAShardedArray *sarray)
+{
+	size_t i;
+
+	if ( ! sarray->workersRunning)
+		return;
+
+	for (i = 0; i < sarray->nShards; i++) {
+		ShardQueue *queue = &sarray->shards[i].shard.queue;
+
+		pthread_mutex_lock(&queue->lock);
+		while (queue->count > 0 || queue->busy)
+			pthread_cond_wait(&queue->idle, &queue->lock);
+		pthread_mutex_unlock(&queue->lock);
+	}
+}
+
+/** print out every shard in turn, as aaPrintContents() */
+void aaShardedPrintContents(FILE *fp, AAShardedArray *sarray, char *tag)
+{
+	size_t i;
+
+	for (i = 0; i < sarray->nShards; i++) {
+		fprintf(fp, "%sShard %zu:\n", tag, i);
+		aaPrintContents(fp, sarray->shards[i].shard.table, tag);
+	}
+}
+
+/**
+ * Print the totals over all shards, in the form of aaPrintSummary(),
+ * along with how evenly the entries are spread.  The workers, if
+ * running, must have been drained.
+ */
+void aaShardedPrintSummary(FILE *fp, AAShardedArray *sarray)
+{
+	AssociativeArray *table;
+	size_t i, nEntries = 0, size = 0, nDeleted = 0;
+	size_t smallest = (size_t) -1, largest = 0;
+	unsigned long long insertCost = 0, searchCost = 0, deleteCost = 0;
+	int nResizes = 0;
+
+	for (i = 0; i < sarray->nShards; i++) {
+		table = sarray->shards[i].shard.table;
+		nEntries += table->nEntries;
+		size += table->size;
+		nDeleted += table->nDeleted;
+		nResizes += table->nResizes;
+		insertCost += table->insertStats.probes;
+		searchCost += table->hitStats.probes + table->missStats.probes;
+		deleteCost += table->deleteStats.probes;
+		if (table->nEntries < smallest)
+			smallest = table->nEntries;
+		if (table->nEntries > largest)
+			largest = table->nEntries;
+	}
+
+	table = sarray->shards[0].shard.table;
+	fprintf(fp, "Sharded table: %zu entries in %zu shards, total size %zu\n",
+			nEntries, sarray->nShards, size);
+	fprintf(fp, "Entries per shard: %zu to %zu\n", smallest, largest);
+	fprintf(fp, "Load factor limits %.2f to %.2f, %zu tombstones, resized %d times\n",
+			table->minLoadFactor, table->maxLoadFactor, nDeleted, nResizes);
+	fprintf(fp, "Strategies used: '%s' hash, '%s' secondary hash and '%s' probing\n",
+			table->hashNamePrimary, table->hashNameSecondary, table->probeName);
+	fprintf(fp, "Table layout: %s\n", table->layout->name);
+	fprintf(fp, "Costs accrued due to probing:\n");
+	fprintf(fp, "  Insertion : %llu\n", insertCost);
+	fprintf(fp, "  Search    : %llu\n", searchCost);
+	fprintf(fp, "  Deletion  : %llu\n", deleteCost);
+}
+
+/** add the counters of one shard into the totals */
+static void addOperationStats(AAOperationStats *total, const AAOperationStats *shard)
+{
+	int b;
+
+	total->count += shard->count;
+	total->probes += shard->probes;
+	if (shard->maxProbes > total->maxProbes)
+		total->maxProbes = shard->maxProbes;
+	for (b = 0; b < AA_PROBE_BUCKETS; b++)
+		total->histogram[b] += shard->histogram[b];
+}
+
+/**
+ * The statistics of every shard added together, as aaGetStats().
+ * The workers, if running, must have been drained.
+ */
+int aaShardedGetStats(AAShardedArray *sarray, AAStats *stats)
+{
+	AAStats shard;
+	size_t i;
+	int status = 1;
+
+	memset(stats, 0, sizeof(AAStats));
+	for (i = 0; i < sarray->nShards; i++) {
+		status = aaGetStats(sarray->shards[i].shard.table, &shard);
+
+		addOperationStats(&stats->inserts, &shard.inserts);
+		addOperationStats(&stats->hits, &shard.hits);
+		addOperationStats(&stats->misses, &shard.misses);
+		addOperationStats(&stats->deletes, &shard.deletes);
+		stats->nEntries += shard.nEntries;
+		stats->size += shard.size;
+		stats->nTombstones += shard.nTombstones;
+		stats->nResizes += shard.nResizes;
+		stats->nEvictions += shard.nEvictions;
+		if (shard.maxProbeDistance > stats->maxProbeDistance)
+			stats->maxProbeDistance = shard.maxProbeDistance;
+	}
+	stats->loadFactor = (double) stats->nEntries / stats->size;
+
+	return status;
+}
+
+/**
+ * Save every shard into one snapshot, as aaSaveSnapshot().  The
+ * shards share one hash function and seed, so the snapshot is an
+ * ordinary one, opened with aaOpenSnapshot() as a single table.
+ * The workers, if running, must have been drained.
+ */
+int aaShardedSaveSnapshot(AAShardedArray *sarray, const char *filename,
+		AAValueLength valueLength)
+{
+	AssociativeArray **tables;
+	size_t i;
+	int status;
+
+	tables = (AssociativeArray **) malloc(sarray->nShards * sizeof(AssociativeArray *));
+	if (tables == NULL) {
+		fprintf(stderr, "Cannot allocate space to save snapshot '%s'\n", filename);
+		return -1;
+	}
+
+	for (i = 0; i < sarray->nShards; i++)
+		tables[i] = sarray->shards[i].shard.table;
+	status = writeSnapshot(filename, tables, sarray->nShards, valueLength, 0);
+
+	free(tables);
+	return status;
+}
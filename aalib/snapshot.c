@@ -0,0 +1,643 @@
+/**
+ * Snapshots: a table written out to a file that can be mapped
+ * straight back into memory and searched where it lies, with no
+ * parsing and no rebuilding, and shared between processes through
+ * the page cache.
+ *
+ * Whatever layout the table had, the snapshot is laid out afresh
+ * as a linear probing table of at most half load, a power of two in
+ * size.  Each slot is a fixed size record holding the full primary
+ * hash of its key, and the file offsets of the key and value bytes,
+ * which follow the slots.  Nothing in the file is a pointer, so the
+ * file may be mapped at any address.
+ *
+ * The file begins with a header giving the format version, the byte
+ * order it was written in, the hash algorithms and their seeds, and
+ * where everything is.  A snapshot is written to a temporary file
+ * which is synced and then renamed over the old one, so a snapshot
+ * that is found on disk is always complete.
+ *
+ * A table opened from a snapshot is read-only.  The values it
+ * returns point into the mapping, and belong to it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h> /* for open() */
+#include <unistd.h> /* for close(), fsync() */
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
+
+#include "hashtools.h"
+
+#define	SNAPSHOT_MAGIC		"AASNAPSH"
+#define	SNAPSHOT_VERSION	1
+#define	SNAPSHOT_BYTE_ORDER	UINT32_C(0x01020304)
+#define	SNAPSHOT_NAME_MAX	32
+
+/** slots and values start on these boundaries */
+#define	SLOT_ALIGNMENT		64
+#define	VALUE_ALIGNMENT		8
+
+#define	ALIGN_UP(n, alignment)	(((n) + (alignment) - 1) / (alignment) * (alignment))
+
+typedef struct SnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;		/** reads back as SNAPSHOT_BYTE_ORDER if ours */
+	uint64_t fileLength;
+	uint64_t nEntries;
+	uint64_t nSlots;
+	uint64_t slotsOffset;
+	uint64_t dataOffset;
+	HashSeed seedPrimary;
+	HashSeed seedSecondary;
+	char hashPrimary[SNAPSHOT_NAME_MAX];
+	char hashSecondary[SNAPSHOT_NAME_MAX];
+	char probeName[SNAPSHOT_NAME_MAX];
+} SnapshotHeader;
+
+/** a slot with a keyOffset of zero is empty, as no key lies in the header */
+typedef struct SnapshotSlot {
+	uint64_t hash;
+	uint64_t keyOffset;
+	uint64_t valueOffset;	/** zero for a NULL value */
+	uint32_t keylen;
+	uint32_t valueLength;
+} SnapshotSlot;
+
+struct Snapshot {
+	const unsigned char *base;
+	size_t length;
+	const SnapshotHeader *header;
+	const SnapshotSlot *slots;
+	size_t mask;
+};
+
+/** the slot a key's search starts at */
+static inline size_t homeSlot(const Snapshot *snapshot, HashValue hash)
+{
+	return (size_t) mixHash(hash) & snapshot->mask;
+}
+
+/** is the given stretch of the file inside the mapping? */
+static inline int inSnapshot(const Snapshot *snapshot, uint64_t offset, uint64_t length)
+{
+	return offset <= snapshot->length && length <= snapshot->length - offset;
+}
+
+/** the value stored in a slot, or NULL */
+static inline void *slotValue(const Snapshot *snapshot, const SnapshotSlot *slot)
+{
+	if (slot->valueOffset == 0 || ! inSnapshot(snapshot, slot->valueOffset, slot->valueLength))
+		return NULL;
+	return (void *) (snapshot->base + slot->valueOffset);
+}
+
+/**
+ * The slot to start a sweep over the snapshot at: an empty one, so
+ * that copies of a key come out in the order a search reaches them,
+ * as sweepStart() does for a table.  At most half the slots are in
+ * use, so there is always one.
+ */
+static size_t snapshotSweepStart(const Snapshot *snapshot)
+{
+	size_t i;
+
+	for (i = 0; i <= snapshot->mask; i++) {
+		if (snapshot->slots[i].keyOffset == 0)
+			return i;
+	}
+	return 0;
+}
+
+/**
+ * Search the snapshot for a key, counting the steps as a hit or a
+ * miss.  Offsets are checked against the mapping before they are
+ * followed, so a damaged file cannot take us outside it.
+ */
+static const SnapshotSlot *findInSnapshot(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash)
+{
+	const Snapshot *snapshot = aarray->snapshot;
+	const SnapshotSlot *slot;
+	size_t index = homeSlot(snapshot, hash);
+	int probes;
+
+	for (probes = 0; (size_t) probes <= snapshot->mask; probes++) {
+		slot = &snapshot->slots[index];
+		if (slot->keyOffset == 0)
+			break;
+
+		if (slot->hash == hash && slot->keylen == keylen
+				&& inSnapshot(snapshot, slot->keyOffset, keylen)
+				&& memcmp(snapshot->base + slot->keyOffset, key, keylen) == 0) {
+			countProbes(&aarray->hitStats, probes);
+			return slot;
+		}
+
+		index = (index + 1) & snapshot->mask;
+	}
+
+	countProbes(&aarray->missStats, probes);
+	return NULL;
+}
+
+/** the work of aaLookup() for a table opened from a snapshot */
+void *snapshotLookup(AssociativeArray *aarray, AAKeyType key, size_t keylen, HashValue hash)
+{
+	const SnapshotSlot *slot = findInSnapshot(aarray, key, keylen, hash);
+
+	return (slot == NULL) ? NULL : slotValue(aarray->snapshot, slot);
+}
+
+/** start loading the slot a search for the key will look at first */
+void snapshotPrefetch(AssociativeArray *aarray, HashValue hash)
+{
+	PREFETCH_READ(&aarray->snapshot->slots[homeSlot(aarray->snapshot, hash)]);
+}
+
+/** the work of aaIterateAction() for a table opened from a snapshot */
+int snapshotIterate(AssociativeArray *aarray,
+		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
+		void *userdata)
+{
+	const Snapshot *snapshot = aarray->snapshot;
+	const SnapshotSlot *slot;
+	size_t start = snapshotSweepStart(snapshot), i;
+
+	for (i = 0; i <= snapshot->mask; i++) {
+		slot = &snapshot->slots[(start + i) & snapshot->mask];
+		if (slot->keyOffset == 0 || ! inSnapshot(snapshot, slot->keyOffset, slot->keylen))
+			continue;
+
+		if ((*userfunction)((AAKeyType) (snapshot->base + slot->keyOffset),
+				slot->keylen, slotValue(snapshot, slot), userdata) < 0)
+			return -1;
+	}
+	return 1;
+}
+
+/**
+ * Visit every entry of a table opened from a snapshot, as
+ * snapshotIterate() does, but giving the length of each value too
+ */
+int snapshotForEach(AssociativeArray *aarray,
+		int (*visit)(AAKeyType key, size_t keylen, void *value, size_t valueLength, void *userdata),
+		void *userdata)
+{
+	const Snapshot *snapshot = aarray->snapshot;
+	const SnapshotSlot *slot;
+	void *value;
+	size_t start = snapshotSweepStart(snapshot), i;
+
+	for (i = 0; i <= snapshot->mask; i++) {
+		slot = &snapshot->slots[(start + i) & snapshot->mask];
+		if (slot->keyOffset == 0 || ! inSnapshot(snapshot, slot->keyOffset, slot->keylen))
+			continue;
+
+		value = slotValue(snapshot, slot);
+		if ((*visit)((AAKeyType) (snapshot->base + slot->keyOffset), slot->keylen,
+				value, (value == NULL) ? 0 : slot->valueLength, userdata) < 0)
+			return -1;
+	}
+	return 1;
+}
+
+/** the work of aaPrintContents() for a table opened from a snapshot */
+void snapshotPrintContents(FILE *fp, AssociativeArray *aarray, char *tag)
+{
+	const Snapshot *snapshot = aarray->snapshot;
+	const SnapshotSlot *slot;
+	char keybuffer[128];
+	size_t i;
+
+	fprintf(fp, "%sDumping snapshot of %zu entries:\n", tag, aarray->size);
+	for (i = 0; i <= snapshot->mask; i++) {
+		slot = &snapshot->slots[i];
+		if (slot->keyOffset == 0) {
+			fprintf(fp, "%s  %zu : empty (NULL)\n", tag, i);
+		} else if ( ! inSnapshot(snapshot, slot->keyOffset, slot->keylen)) {
+			fprintf(fp, "%s  %zu : invalid key offset %llu\n", tag, i,
+					(unsigned long long) slot->keyOffset);
+		} else {
+			printableKey(keybuffer, 128,
+					(AAKeyType) (snapshot->base + slot->keyOffset), slot->keylen);
+			fprintf(fp, "%s  %zu : in use : '%s'\n", tag, i, keybuffer);
+		}
+	}
+}
+
+/** the longest search any entry of the snapshot takes, for aaGetStats() */
+uint64_t snapshotMaxProbes(AssociativeArray *aarray)
+{
+	const Snapshot *snapshot = aarray->snapshot;
+	uint64_t longest = 0, distance;
+	size_t i;
+
+	for (i = 0; i <= snapshot->mask; i++) {
+		if (snapshot->slots[i].keyOffset == 0)
+			continue;
+		distance = (i - homeSlot(snapshot, snapshot->slots[i].hash)) & snapshot->mask;
+		if (distance > longest)
+			longest = distance;
+	}
+	return longest;
+}
+
+void releaseSnapshot(Snapshot *snapshot)
+{
+	munmap((void *) snapshot->base, snapshot->length);
+	free(snapshot);
+}
+
+/**
+ * The state carried through the two passes over the entries of the
+ * tables being saved: the first lays out the file and fills in the
+ * slots, the second writes the keys and values where the first
+ * said they would go.
+ */
+typedef struct SnapshotWriter {
+	AAValueLength valueLength;
+	SnapshotSlot *slots;
+	size_t mask;
+	uint64_t offset;		/** where the next entry's bytes go */
+	size_t nPlaced;
+	int keepHidden;			/** save entries a search cannot reach too */
+	FILE *fp;
+	int status;
+} SnapshotWriter;
+
+typedef void (*EntryVisitor)(SnapshotWriter *writer,
+		AAKeyType key, size_t keylen, void *value, HashValue hash);
+
+/** the number of bytes to save for a value */
+static size_t valueBytes(SnapshotWriter *writer, void *value)
+{
+	if (value == NULL || writer->valueLength == NULL)
+		return 0;
+	return writer->valueLength(value);
+}
+
+/**
+ * Call the visitor on every entry of the tables, in the same order
+ * every time.  An entry hidden behind another entry of the same key
+ * that a search reaches first is left out, so that a search of the
+ * snapshot finds the same value a search of the table would -- unless
+ * the writer keeps hidden entries, for a snapshot that will be loaded
+ * back into a table and changed.  Then every entry is visited, each
+ * table being swept from an empty slot, so that the copies of a key
+ * in a linear probing table are visited, and so placed in the
+ * snapshot, in the order a search reaches them.
+ */
+static void visitEntries(AssociativeArray **tables, size_t nTables,
+		EntryVisitor visitor, SnapshotWriter *writer)
+{
+	const Snapshot *snapshot;
+	const SnapshotSlot *record;
+	KeyDataPair *slot;
+	size_t t, start, i;
+	int probes;
+
+	for (t = 0; t < nTables; t++) {
+		if ((snapshot = tables[t]->snapshot) != NULL) {
+			start = snapshotSweepStart(snapshot);
+			for (i = 0; i <= snapshot->mask; i++) {
+				record = &snapshot->slots[(start + i) & snapshot->mask];
+				if (record->keyOffset != 0
+						&& inSnapshot(snapshot, record->keyOffset, record->keylen))
+					visitor(writer, (AAKeyType) (snapshot->base + record->keyOffset),
+							record->keylen, slotValue(snapshot, record), record->hash);
+			}
+			continue;
+		}
+
+		start = sweepStart(tables[t]);
+		for (i = 0; i < tables[t]->size; i++) {
+			slot = &tables[t]->table[(start + i) % tables[t]->size];
+			if (slot->validity != HASH_USED)
+				continue;
+			if ( ! writer->keepHidden && tables[t]->layout->find(tables[t], slotKey(slot),
+					slot->keylen, slot->hash, &probes) != slot)
+				continue;
+			visitor(writer, slotKey(slot), slot->keylen, slot->value, slot->hash);
+		}
+	}
+}
+
+/** first pass: give the entry a slot, and room in the file for its bytes */
+static void placeEntry(SnapshotWriter *writer,
+		AAKeyType key, size_t keylen, void *value, HashValue hash)
+{
+	size_t length = valueBytes(writer, value);
+	size_t index = (size_t) mixHash(hash) & writer->mask;
+	SnapshotSlot *slot;
+
+	if (keylen > UINT32_MAX || length > UINT32_MAX) {
+		fprintf(stderr, "Cannot save a key or value of more than 4GB in a snapshot\n");
+		writer->status = -1;
+		return;
+	}
+
+	while (writer->slots[index].keyOffset != 0)
+		index = (index + 1) & writer->mask;
+	slot = &writer->slots[index];
+
+	writer->offset = ALIGN_UP(writer->offset, VALUE_ALIGNMENT);
+	slot->hash = hash;
+	slot->keylen = (uint32_t) keylen;
+	slot->valueLength = (uint32_t) length;
+	slot->valueOffset = (length > 0) ? writer->offset : 0;
+	writer->offset += length;
+	slot->keyOffset = writer->offset;
+	writer->offset += keylen;
+	writer->nPlaced++;
+}
+
+/** write zeros up to the given offset */
+static void padTo(SnapshotWriter *writer, uint64_t offset)
+{
+	static const unsigned char zeros[SLOT_ALIGNMENT];
+
+	if (offset > writer->offset
+			&& fwrite(zeros, 1, offset - writer->offset, writer->fp) != offset - writer->offset)
+		writer->status = -1;
+	writer->offset = offset;
+}
+
+/** second pass: write the entry's bytes, as laid out by placeEntry() */
+static void writeEntry(SnapshotWriter *writer,
+		AAKeyType key, size_t keylen, void *value, HashValue hash)
+{
+	size_t length = valueBytes(writer, value);
+
+	padTo(writer, ALIGN_UP(writer->offset, VALUE_ALIGNMENT));
+	if ((length > 0 && fwrite(value, 1, length, writer->fp) != length)
+			|| (keylen > 0 && fwrite(key, 1, keylen, writer->fp) != keylen))
+		writer->status = -1;
+	writer->offset += length + keylen;
+}
+
+/** copy a name into a header field, which always ends in a NUL */
+static void copyName(char *field, const char *name)
+{
+	memset(field, 0, SNAPSHOT_NAME_MAX);
+	strncpy(field, name, SNAPSHOT_NAME_MAX - 1);
+}
+
+/**
+ * Write every entry of the given tables, which must all hash keys
+ * the same way, into one snapshot.  The first table supplies the
+ * names and seeds of the hash algorithms.  If keepHidden is set,
+ * entries that a search cannot reach are saved too, in search order.
+ *
+ *  @return      1 on success, or -1 if the snapshot could not be
+ *				 written, in which case any old snapshot of that
+ *				 name is left as it was
+ */
+int writeSnapshot(const char *filename, AssociativeArray **tables, size_t nTables,
+		AAValueLength valueLength, int keepHidden)
+{
+	SnapshotHeader header;
+	SnapshotWriter writer;
+	char *tempname;
+	size_t nEntries = 0, nSlots = 16, t;
+
+	/** room for every entry, though some may turn out to be hidden */
+	for (t = 0; t < nTables; t++)
+		nEntries += tables[t]->nEntries;
+	while (nSlots < 2 * nEntries)
+		nSlots *= 2;
+
+	memset(&writer, 0, sizeof(writer));
+	writer.valueLength = valueLength;
+	writer.keepHidden = keepHidden;
+	writer.mask = nSlots - 1;
+	writer.status = 1;
+	writer.slots = (SnapshotSlot *) calloc(nSlots, sizeof(SnapshotSlot));
+	tempname = (char *) malloc(strlen(filename) + 5);
+	if (writer.slots == NULL || tempname == NULL) {
+		fprintf(stderr, "Cannot allocate space to lay out snapshot '%s'\n", filename);
+		free(writer.slots);
+		free(tempname);
+		return -1;
+	}
+	sprintf(tempname, "%s.tmp", filename);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byteOrder = SNAPSHOT_BYTE_ORDER;
+	header.nSlots = nSlots;
+	header.slotsOffset = ALIGN_UP(sizeof(SnapshotHeader), SLOT_ALIGNMENT);
+	header.dataOffset = header.slotsOffset + nSlots * sizeof(SnapshotSlot);
+	header.seedPrimary = tables[0]->seedPrimary;
+	header.seedSecondary = tables[0]->seedSecondary;
+	copyName(header.hashPrimary, tables[0]->hashNamePrimary);
+	copyName(header.hashSecondary, tables[0]->hashNameSecondary);
+	copyName(header.probeName, tables[0]->probeName);
+
+	writer.offset = header.dataOffset;
+	visitEntries(tables, nTables, placeEntry, &writer);
+	header.nEntries = writer.nPlaced;
+	header.fileLength = writer.offset;
+
+	if (writer.status > 0 && (writer.fp = fopen(tempname, "wb")) == NULL) {
+		fprintf(stderr, "Cannot create snapshot '%s' : %s\n", tempname, strerror(errno));
+		writer.status = -1;
+	}
+
+	if (writer.status > 0) {
+		writer.offset = sizeof(header);
+		if (fwrite(&header, sizeof(header), 1, writer.fp) != 1)
+			writer.status = -1;
+		padTo(&writer, header.slotsOffset);
+		if (fwrite(writer.slots, sizeof(SnapshotSlot), nSlots, writer.fp) != nSlots)
+			writer.status = -1;
+		writer.offset = header.dataOffset;
+		visitEntries(tables, nTables, writeEntry, &writer);
+
+		/** the snapshot must be on disk before it replaces the old one */
+		if (fflush(writer.fp) != 0 || fsync(fileno(writer.fp)) != 0)
+			writer.status = -1;
+		if (fclose(writer.fp) != 0)
+			writer.status = -1;
+
+		if (writer.status < 0) {
+			fprintf(stderr, "Cannot write snapshot '%s' : %s\n", tempname, strerror(errno));
+			unlink(tempname);
+		} else if (rename(tempname, filename) != 0) {
+			fprintf(stderr, "Cannot rename snapshot '%s' to '%s' : %s\n",
+					tempname, filename, strerror(errno));
+			unlink(tempname);
+			writer.status = -1;
+		}
+	}
+
+	free(writer.slots);
+	free(tempname);
+	return writer.status;
+}
+
+/**
+ * Write the table to a snapshot file.  Values are saved as the
+ * number of bytes valueLength() gives for each (a string's length
+ * plus one, say); if valueLength is NULL, only the keys are saved,
+ * and every value is NULL when the snapshot is opened.
+ *
+ *  @return      1 on success, or -1 on failure
+ */
+int aaSaveSnapshot(AssociativeArray *aarray, const char *filename, AAValueLength valueLength)
+{
+	return writeSnapshot(filename, &aarray, 1, valueLength, 0);
+}
+
+/** is the header one we wrote, and does it fit the file? */
+static int validHeader(const SnapshotHeader *header, size_t length, const char *filename)
+{
+	if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+		fprintf(stderr, "'%s' is not a snapshot\n", filename);
+		return 0;
+	}
+	if (header->version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "Snapshot '%s' is version %u, but only version %d can be read\n",
+				filename, header->version, SNAPSHOT_VERSION);
+		return 0;
+	}
+	if (header->byteOrder != SNAPSHOT_BYTE_ORDER) {
+		fprintf(stderr, "Snapshot '%s' was written on a machine of another byte order\n",
+				filename);
+		return 0;
+	}
+	if (header->fileLength != length
+			|| header->nSlots < 1 || (header->nSlots & (header->nSlots - 1)) != 0
+			|| header->nEntries >= header->nSlots
+			|| header->slotsOffset < sizeof(SnapshotHeader)
+			|| header->slotsOffset % SLOT_ALIGNMENT != 0
+			|| header->nSlots > (length - header->slotsOffset) / sizeof(SnapshotSlot)
+			|| memchr(header->hashPrimary, '\0', SNAPSHOT_NAME_MAX) == NULL
+			|| memchr(header->hashSecondary, '\0', SNAPSHOT_NAME_MAX) == NULL
+			|| memchr(header->probeName, '\0', SNAPSHOT_NAME_MAX) == NULL) {
+		fprintf(stderr, "Snapshot '%s' is damaged or incomplete\n", filename);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Map a snapshot into memory as a read-only table.  Only the header
+ * is read; the slots, keys and values are paged in as searches
+ * reach them.
+ *
+ *  @return      the table, or NULL if the file is not a snapshot
+ *				 this code can read
+ */
+AssociativeArray *aaOpenSnapshot(const char *filename)
+{
+	AssociativeArray *aarray;
+	Snapshot *snapshot;
+	const SnapshotHeader *header;
+	struct stat status;
+	void *mapping;
+	int fd;
+
+	if ((fd = open(filename, O_RDONLY)) < 0) {
+		fprintf(stderr, "Cannot open snapshot '%s' : %s\n", filename, strerror(errno));
+		return NULL;
+	}
+	if (fstat(fd, &status) < 0 || (size_t) status.st_size < sizeof(SnapshotHeader)) {
+		fprintf(stderr, "Snapshot '%s' is too short\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	mapping = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "Cannot map snapshot '%s' : %s\n", filename, strerror(errno));
+		return NULL;
+	}
+
+	/** searches jump about, so reading ahead would only waste memory */
+	madvise(mapping, status.st_size, MADV_RANDOM);
+
+	header = (const SnapshotHeader *) mapping;
+	if ( ! validHeader(header, (size_t) status.st_size, filename)) {
+		munmap(mapping, status.st_size);
+		return NULL;
+	}
+
+	snapshot = (Snapshot *) malloc(sizeof(Snapshot));
+	aarray = (AssociativeArray *) calloc(1, sizeof(AssociativeArray));
+	if (snapshot == NULL || aarray == NULL) {
+		fprintf(stderr, "Cannot allocate table for snapshot '%s'\n", filename);
+		free(snapshot);
+		free(aarray);
+		munmap(mapping, status.st_size);
+		return NULL;
+	}
+
+	snapshot->base = (const unsigned char *) mapping;
+	snapshot->length = (size_t) status.st_size;
+	snapshot->header = header;
+	snapshot->slots = (const SnapshotSlot *) (snapshot->base + header->slotsOffset);
+	snapshot->mask = header->nSlots - 1;
+
+	aarray->snapshot = snapshot;
+	aarray->layout = &snapshotLayout;
+	aarray->size = header->nSlots;
+	initTableSizer(&aarray->sizer, header->nSlots, AA_SIZE_POW2_MASK);
+	aarray->minimumSize = aarray->size;
+	aarray->nEntries = header->nEntries;
+	aarray->maxLoadFactor = AA_DEFAULT_MAX_LOAD_FACTOR;
+	aarray->minLoadFactor = 0;
+	aarray->hashNamePrimary = strdup(header->hashPrimary);
+	aarray->hashNameSecondary = strdup(header->hashSecondary);
+	aarray->probeName = strdup(header->probeName);
+	aarray->hashAlgorithmPrimary = lookupNamedHashStrategy(header->hashPrimary);
+	aarray->hashAlgorithmSecondary = lookupNamedHashStrategy(header->hashSecondary);
+	aarray->seedPrimary = header->seedPrimary;
+	aarray->seedSecondary = header->seedSecondary;
+
+	return aarray;
+}
+
+/**
+ * Tables opened from a snapshot are searched by the functions above
+ * rather than through their layout, which is only here to give the
+ * table a name, and to refuse changes.
+ */
+static long snapshotInsert(AssociativeArray *aarray,
+		KeyDataPair *entry, HashValue hash, int *cost)
+{
+	return -1;
+}
+
+static KeyDataPair *snapshotFind(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash, int *cost)
+{
+	return NULL;
+}
+
+static void snapshotLayoutPrefetch(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash)
+{
+	snapshotPrefetch(aarray, hash);
+}
+
+static void snapshotRemove(AssociativeArray *aarray, KeyDataPair *slot)
+{
+}
+
+const TableLayout snapshotLayout = {
+		"snapshot (mapped read-only)",
+		0,
+		1,
+		NULL,
+		NULL,
+		snapshotInsert,
+		snapshotFind,
+		snapshotLayoutPrefetch,
+		snapshotRemove
+	};
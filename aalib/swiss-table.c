@@ -0,0 +1,225 @@
+/**
+ * A "Swiss table" layout: alongside the slots we keep an array of
+ * one control byte per slot, holding either a marker for an empty
+ * or deleted slot, or 7 bits of the hash of the key stored there.
+ *
+ * Searches look at a group of 16 control bytes at a time, comparing
+ * them all against the 7 bits of the key's hash at once, and only
+ * look at a KeyDataPair when its control byte matches.  A search
+ * ends as soon as a group contains an empty slot.
+ *
+ * Groups start at any slot, not just multiples of 16, so the first
+ * 16 control bytes are repeated after the end of the array to let
+ * a group that starts near the end be read in one load.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hashtools.h"
+
+#define	GROUP_WIDTH		16
+
+/** control byte values; full slots hold 7 bits of hash, 0..127 */
+#define	CTRL_EMPTY		((unsigned char) 0x80)
+#define	CTRL_DELETED	((unsigned char) 0xFE)
+
+/** bit i of a GroupMask is set if control byte i of the group matched */
+typedef unsigned int GroupMask;
+
+/** the group positions whose control byte equals the given value */
+static inline GroupMask matchByte(const unsigned char *group, unsigned char value)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+	return (GroupMask) _mm_movemask_epi8(
+			_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) value)));
+#else
+	GroupMask mask = 0;
+	int i;
+
+	for (i = 0; i < GROUP_WIDTH; i++) {
+		if (group[i] == value)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/** the group positions that are empty or deleted (top bit set) */
+static inline GroupMask matchEmptyOrDeleted(const unsigned char *group)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_loadu_si128((const __m128i *) group);
+	return (GroupMask) _mm_movemask_epi8(ctrl);
+#else
+	GroupMask mask = 0;
+	int i;
+
+	for (i = 0; i < GROUP_WIDTH; i++) {
+		if (group[i] & 0x80)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/** split a hash into the part that picks the group and the 7 bit tag */
+static inline HashValue groupHash(HashValue mixed)
+{
+	return mixed >> 7;
+}
+
+static inline unsigned char tagHash(HashValue mixed)
+{
+	return (unsigned char) (mixed & 0x7F);
+}
+
+/** set a control byte, keeping the copy past the end of the array current */
+static inline void setControl(AssociativeArray *aarray, HashIndex index, unsigned char value)
+{
+	aarray->control[index] = value;
+	if (index < GROUP_WIDTH)
+		aarray->control[aarray->size + index] = value;
+}
+
+static int swissAllocate(AssociativeArray *aarray)
+{
+	aarray->control = (unsigned char *) malloc(aarray->size + GROUP_WIDTH);
+	if (aarray->control == NULL)
+		return -1;
+
+	memset(aarray->control, CTRL_EMPTY, aarray->size + GROUP_WIDTH);
+	return 1;
+}
+
+static void swissRelease(AssociativeArray *aarray)
+{
+	free(aarray->control);
+	aarray->control = NULL;
+}
+
+/**
+ * Groups are visited at triangular-number offsets (in units of
+ * the group width), which visits every group of a power of two
+ * sized table exactly once before repeating.
+ */
+static long swissInsert(AssociativeArray *aarray,
+		KeyDataPair *entry, HashValue hash, int *cost)
+{
+	HashValue mixed = mixHash(hash);
+	HashIndex position = reduceHash(&aarray->sizer, groupHash(mixed));
+	HashIndex stride = 0;
+	HashIndex index;
+	GroupMask available;
+
+	while (stride <= aarray->size) {
+		available = matchEmptyOrDeleted(&aarray->control[position]);
+		if (available != 0) {
+			index = (position + __builtin_ctz(available)) & aarray->sizer.mask;
+
+			if (aarray->control[index] == CTRL_DELETED)
+				aarray->nDeleted--;
+			setControl(aarray, index, tagHash(mixed));
+
+			aarray->table[index] = *entry;
+			aarray->table[index].validity = HASH_USED;
+			aarray->nEntries++;
+			return (long) index;
+		}
+
+		stride += GROUP_WIDTH;
+		position = (position + stride) & aarray->sizer.mask;
+		(*cost)++;
+	}
+
+	return -1;
+}
+
+static KeyDataPair *swissFind(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash, int *cost)
+{
+	HashValue mixed = mixHash(hash);
+	unsigned char tag = tagHash(mixed);
+	HashIndex position = reduceHash(&aarray->sizer, groupHash(mixed));
+	HashIndex stride = 0;
+	KeyDataPair *slot;
+	GroupMask match;
+
+	while (stride <= aarray->size) {
+		const unsigned char *group = &aarray->control[position];
+
+		/** only look at the slots whose tag matches */
+		match = matchByte(group, tag);
+		while (match != 0) {
+			slot = &aarray->table[(position + __builtin_ctz(match)) & aarray->sizer.mask];
+			if (slotHoldsKey(slot, key, keylen, hash))
+				return slot;
+			match &= match - 1;
+		}
+
+		/** an empty slot in the group means the key was never placed further on */
+		if (matchByte(group, CTRL_EMPTY) != 0)
+			return NULL;
+
+		stride += GROUP_WIDTH;
+		position = (position + stride) & aarray->sizer.mask;
+		(*cost)++;
+	}
+
+	return NULL;
+}
+
+/** the first group of control bytes, and the slot the group starts at */
+static void swissPrefetch(AssociativeArray *aarray,
+		AAKeyType key, size_t keylen, HashValue hash)
+{
+	HashIndex position = reduceHash(&aarray->sizer, groupHash(mixHash(hash)));
+
+	PREFETCH_READ(&aarray->control[position]);
+	PREFETCH_READ(&aarray->table[position]);
+}
+
+/**
+ * A deleted slot can go straight back to being empty if no search
+ * can ever have passed over it -- that is, if every window of 16
+ * control bytes containing it also contains an empty slot, as a
+ * search would have stopped in that window.  Otherwise it must
+ * become a tombstone.
+ */
+static void swissRemove(AssociativeArray *aarray, KeyDataPair *slot)
+{
+	HashIndex index = (HashIndex) (slot - aarray->table);
+	HashIndex before = (index - GROUP_WIDTH) & aarray->sizer.mask;
+	GroupMask emptyAfter = matchByte(&aarray->control[index], CTRL_EMPTY);
+	GroupMask emptyBefore = matchByte(&aarray->control[before], CTRL_EMPTY);
+
+	/** bit 15 of the "before" window is the slot just before this one */
+	if (emptyAfter != 0 && emptyBefore != 0
+			&& __builtin_ctz(emptyAfter)
+				+ (__builtin_clz(emptyBefore) - (32 - GROUP_WIDTH)) < GROUP_WIDTH) {
+		setControl(aarray, index, CTRL_EMPTY);
+		slot->validity = HASH_EMPTY;
+		return;
+	}
+
+	setControl(aarray, index, CTRL_DELETED);
+	slot->validity = HASH_DELETED;
+	aarray->nDeleted++;
+}
+
+/** the Swiss table layout, which needs at least one full group of slots */
+const TableLayout swissLayout = {
+		"swiss table (16 slot control byte groups)",
+		GROUP_WIDTH,
+		1,
+		swissAllocate,
+		swissRelease,
+		swissInsert,
+		swissFind,
+		swissPrefetch,
+		swissRemove
+	};
@@ -0,0 +1,80 @@
+/**
+ * Table sizing: choose an actual table size for a requested one,
+ * and precompute whatever is needed to map a full hash value onto
+ * that range without a hardware division.
+ *
+ * See reduceHash() in hashtools.h for the other half of this.
+ */
+#include <stdint.h>
+
+#include "hashtools.h"
+
+/** smallest power of two no smaller than the given value, or 0 on overflow */
+static size_t nextPowerOfTwo(size_t value, int *log2)
+{
+	size_t size = 2;
+
+	*log2 = 1;
+	while (size < value) {
+		if (size > SIZE_MAX / 2) return 0;
+		size <<= 1;
+		(*log2)++;
+	}
+	return size;
+}
+
+/**
+ * Set up the sizer for a table of at least the requested size.
+ *
+ *  @param  sizer  the sizer to fill in
+ *  @param  requestedSize  the smallest acceptable table size
+ *  @param  mode  whether to use prime or power of two sizes
+ *  @return the actual table size, or zero if no table of that size
+ *				can be described
+ */
+size_t initTableSizer(TableSizer *sizer, size_t requestedSize, AASizingMode mode)
+{
+	int log2;
+
+	sizer->mode = mode;
+	sizer->mask = 0;
+	sizer->shift = 0;
+	sizer->magic = 0;
+
+	if (mode == AA_SIZE_POW2_MASK || mode == AA_SIZE_POW2_SHIFT) {
+		sizer->size = nextPowerOfTwo(requestedSize, &log2);
+		if (sizer->size == 0) return 0;
+
+		sizer->mask = sizer->size - 1;
+		sizer->shift = 64 - log2;
+		return sizer->size;
+	}
+
+	sizer->mode = AA_SIZE_PRIME;
+	sizer->size = getLargerPrime(requestedSize < 2 ? 2 : requestedSize);
+	if (sizer->size == 0) return 0;
+
+#ifdef __SIZEOF_INT128__
+	/**
+	 * Lemire's fast modulo: with M = ceil(2^64 / d), the remainder
+	 * of a 32-bit value a is the high word of (M * a mod 2^64) * d.
+	 * This is exact for all 32-bit a and d, so larger tables fall
+	 * back to a plain modulo.
+	 */
+	if (sizer->size <= UINT32_MAX) {
+		sizer->magic = UINT64_MAX / sizer->size + 1;
+	}
+#endif
+
+	return sizer->size;
+}
+
+/** printable name of a sizing mode, for the summary */
+const char *tableSizerName(const TableSizer *sizer)
+{
+	switch (sizer->mode) {
+	case AA_SIZE_POW2_MASK:		return "power of two (mask)";
+	case AA_SIZE_POW2_SHIFT:	return "power of two (multiply-shift)";
+	default:					return "prime";
+	}
+}
@@ -2,6 +2,7 @@
 #define	__ASSOCIATIVE_ARRAY_TOOLS_HEADER__
 
 #include <stdio.h>
+#include <stdint.h>
 
 typedef unsigned char *AAKeyType;
 typedef size_t AAIndexType;
@@ -16,6 +17,62 @@ typedef size_t AAIndexType;
  */
 typedef struct AssociativeArray AssociativeArray;
 
+/**
+ * How table sizes are chosen, and so how hash values are mapped
+ * onto table positions: prime sizes use a precomputed fast modulo,
+ * while power of two sizes keep either the low bits of the hash
+ * (mask) or the high bits of a multiply (shift).
+ */
+typedef enum AASizingMode {
+	AA_SIZE_PRIME = 0,
+	AA_SIZE_POW2_MASK,
+	AA_SIZE_POW2_SHIFT
+} AASizingMode;
+
+/**
+ * Where the table keeps its copies of keys too long to fit in a
+ * slot: each in its own heap allocation, or packed into large
+ * chunks owned by the table, which are all released at once
+ * when the table is deleted.
+ */
+typedef enum AAKeyStorage {
+	AA_KEYS_HEAP = 0,
+	AA_KEYS_ARENA
+} AAKeyStorage;
+
+/**
+ * Tunable settings fixed when the array is created.
+ *
+ * The table grows (and rehashes) once the slots in use -- live
+ * entries plus tombstones -- pass maxLoadFactor of the table size,
+ * and shrinks again once the live entries drop below minLoadFactor.
+ * A minLoadFactor of zero disables shrinking.
+ *
+ * The seed is the secret mixed into the keyed hash functions
+ * ("sip", "wyhash", "xxh64" and "int"), so that nobody who does not
+ * know it can choose keys that collide.  A seed of zero, the default,
+ * picks a fresh random seed for every table; any other value gives
+ * the same table layout on every run.
+ *
+ * lockFreeReads only applies to concurrent tables using linear,
+ * quadratic or double hash probing: lookups then take no locks, at
+ * the cost of deleted slots not being reused until the next rehash.
+ */
+typedef struct AAConfig {
+	double maxLoadFactor;
+	double minLoadFactor;
+	AASizingMode sizingMode;
+	AAKeyStorage keyStorage;
+	uint64_t seed;
+	int lockFreeReads;
+} AAConfig;
+
+#define	AA_DEFAULT_MAX_LOAD_FACTOR	0.75
+#define	AA_DEFAULT_MIN_LOAD_FACTOR	0.10
+
+/** fill in a configuration with the default settings */
+void aaInitConfig(AAConfig *config);
+
 /** creator and destructor for the associative array */
 AssociativeArray *aaCreateAssociativeArray(
 			size_t size,
@@ -23,6 +80,13 @@ AssociativeArray *aaCreateAssociativeArray(
 			char *primaryHashAlgorithm,
 			char *secondaryHashAlgorithm
 		);
+AssociativeArray *aaCreateAssociativeArrayWithConfig(
+			size_t size,
+			char *probingStrategy,
+			char *primaryHashAlgorithm,
+			char *secondaryHashAlgorithm,
+			const AAConfig *config
+		);
 void aaDeleteAssociativeArray(AssociativeArray *array);
 
 int aaIterateAction(
@@ -31,12 +95,233 @@ int aaIterateAction(
 		void *userdata);
 
 /** the interface to do the critical work: insert, delete and lookup */
-int aaInsert(AssociativeArray *array,
+long aaInsert(AssociativeArray *array,
 		AAKeyType key, size_t keylength,
 		void *value);
 void *aaLookup(AssociativeArray *array, AAKeyType key, size_t keylength);
+size_t aaLookupBatch(AssociativeArray *array,
+		AAKeyType keys[], size_t keylengths[], size_t nKeys,
+		void *values[]);
 void *aaDelete(AssociativeArray *array, AAKeyType key, size_t keylength);
 
+/**
+ * Probe lengths are counted in steps past the first place looked
+ * at, so an operation settled at its home slot (or home bucket,
+ * or home group) costs zero.  The histogram is bucketed by powers
+ * of two: bucket 0 counts operations of no steps, bucket b those
+ * of 2^(b-1) up to 2^b - 1 steps, and the last bucket everything
+ * longer.
+ */
+#define	AA_PROBE_BUCKETS	16
+
+typedef struct AAOperationStats {
+	uint64_t count;
+	uint64_t probes;		/** total steps over all operations */
+	uint64_t maxProbes;
+	uint64_t histogram[AA_PROBE_BUCKETS];
+} AAOperationStats;
+
+/**
+ * A snapshot of what a table has done, and of its shape now.
+ * Searches are split into those that found their key (hits) and
+ * those that did not (misses); a delete of a missing key is still
+ * counted as a delete.  maxProbeDistance is the longest search
+ * that any entry now in the table would take to be found, and
+ * nEvictions the entries a cache has dropped to stay in capacity.
+ */
+typedef struct AAStats {
+	AAOperationStats inserts;
+	AAOperationStats hits;
+	AAOperationStats misses;
+	AAOperationStats deletes;
+	size_t nEntries;
+	size_t size;
+	size_t nTombstones;
+	double loadFactor;
+	uint64_t nResizes;
+	uint64_t maxProbeDistance;
+	uint64_t nEvictions;
+} AAStats;
+
+/**
+ * The operation counters are kept unless the library is built
+ * with AA_NO_STATS, in which case they stay zero, and aaGetStats()
+ * returns 0 rather than 1 to say so.
+ */
+int aaGetStats(AssociativeArray *array, AAStats *stats);
+void aaPrintStats(FILE *fp, const AAStats *stats);
+
+/**
+ * Snapshots save a table to a file that aaOpenSnapshot() maps back
+ * into memory and searches in place, without reading it through.
+ * The file holds no pointers, so it may be mapped anywhere, and by
+ * many processes at once.  Values are saved as the number of bytes
+ * the AAValueLength function gives for each (or not at all, if it
+ * is NULL).
+ *
+ * A table opened from a snapshot may be searched, iterated over,
+ * printed and saved again, but not changed: aaInsert() and
+ * aaDelete() fail.  The values it returns point into the mapping,
+ * and must not be freed; they remain valid until the table is
+ * deleted.
+ */
+typedef size_t (*AAValueLength)(void *value);
+
+int aaSaveSnapshot(AssociativeArray *array, const char *filename,
+		AAValueLength valueLength);
+AssociativeArray *aaOpenSnapshot(const char *filename);
+
+/**
+ * An operation log records every aaInsert() and aaDelete() made on
+ * a table in a series of files named after the log, so that the
+ * table can be rebuilt with aaRecoverFromLog() after a crash.
+ *
+ * Logging a change only copies it into a buffer; a thread of the
+ * log's own writes the buffer out and syncs it in batches, once it
+ * is half of bufferSize, once a change has waited syncInterval
+ * milliseconds, or when aaLogSync() asks.  So a crash may lose the
+ * last syncInterval milliseconds of changes, unless aaLogSync()
+ * returned since they were made.  Once compactSegments log files
+ * of segmentBytes each have built up, another thread folds them
+ * into a snapshot of the table, and removes them (zero never does).
+ * aaDeleteAssociativeArray() detaches the log, writing out what is
+ * left in its buffer first.
+ */
+typedef struct AALogConfig {
+	size_t bufferSize;
+	int syncInterval;
+	size_t segmentBytes;
+	unsigned int compactSegments;
+} AALogConfig;
+
+void aaInitLogConfig(AALogConfig *config);
+int aaAttachLog(AssociativeArray *array, const char *logname,
+		AAValueLength valueLength, const AALogConfig *config);
+int aaLogSync(AssociativeArray *array);
+int aaDetachLog(AssociativeArray *array);
+AssociativeArray *aaRecoverFromLog(const char *logname,
+			size_t size,
+			char *probingStrategy,
+			char *primaryHashAlgorithm,
+			char *secondaryHashAlgorithm,
+			const AAConfig *config
+		);
+
+/**
+ * A table in cache mode holds at most maxEntries entries, and at
+ * most maxBytes bytes of keys and values, each value counting for
+ * the bytes valueLength() gives; a limit of zero is no limit.  Once
+ * the table is full, aaInsert() makes room by evicting entries
+ * that have not been looked up lately.  Each slot has a reference
+ * bit that aaLookup() sets, and a clock hand sweeps the slots
+ * clearing the bits, evicting the first entry it finds whose bit
+ * is already clear (the CLOCK approximation of LRU).  If evict is
+ * not NULL, it is called with each entry before it is evicted, so
+ * that its value can be freed.  A cache holds one copy of each key:
+ * inserting a key it holds already replaces the old entry, whose
+ * value is handed to evict in the same way.
+ */
+typedef void (*AAEvictCallback)(AAKeyType key, size_t keylength,
+		void *value, void *userdata);
+
+typedef struct AACacheConfig {
+	size_t maxEntries;
+	size_t maxBytes;
+	AAValueLength valueLength;
+	AAEvictCallback evict;
+	void *userdata;
+} AACacheConfig;
+
+int aaSetCacheMode(AssociativeArray *array, const AACacheConfig *config);
+
+/**
+ * A table that may be shared between threads.  It is split into
+ * segments, each locked separately, so that threads working on
+ * different keys rarely wait for one another.  Operations behave
+ * as their single-threaded counterparts above.
+ */
+typedef struct AAConcurrentArray AAConcurrentArray;
+
+AAConcurrentArray *aaCreateConcurrentArray(
+			size_t size,
+			size_t nSegments,
+			char *probingStrategy,
+			char *primaryHashAlgorithm,
+			char *secondaryHashAlgorithm,
+			const AAConfig *config
+		);
+void aaDeleteConcurrentArray(AAConcurrentArray *array);
+long aaConcurrentInsert(AAConcurrentArray *array,
+		AAKeyType key, size_t keylength,
+		void *value);
+void *aaConcurrentLookup(AAConcurrentArray *array, AAKeyType key, size_t keylength);
+void *aaConcurrentDelete(AAConcurrentArray *array, AAKeyType key, size_t keylength);
+int aaConcurrentIterateAction(
+		AAConcurrentArray *array,
+		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
+		void *userdata);
+void aaConcurrentRetire(AAConcurrentArray *array, void *value, void (*release)(void *value));
+void aaConcurrentEnterRead(AAConcurrentArray *array);
+void aaConcurrentExitRead(AAConcurrentArray *array);
+void aaConcurrentPrintSummary(FILE *fp, AAConcurrentArray *array);
+
+/**
+ * A table split into independently sized shards, each key going
+ * to one shard by its hash.  A sharded table may be used directly,
+ * from one thread, or each shard may be handed to a worker thread
+ * of its own, which is then sent requests through a queue.
+ */
+typedef struct AAShardedArray AAShardedArray;
+
+typedef enum AAShardOp {
+	AA_SHARD_INSERT = 0,
+	AA_SHARD_LOOKUP,
+	AA_SHARD_DELETE
+} AAShardOp;
+
+/** called on the worker thread once a submitted request is done */
+typedef void (*AAShardCallback)(void *userdata, AAShardOp op,
+		AAKeyType key, size_t keylength, void *value, long status);
+
+AAShardedArray *aaCreateShardedArray(
+			size_t nShards,
+			size_t size,
+			char *probingStrategy,
+			char *primaryHashAlgorithm,
+			char *secondaryHashAlgorithm,
+			const AAConfig *config
+		);
+void aaDeleteShardedArray(AAShardedArray *array);
+size_t aaShardCount(AAShardedArray *array);
+size_t aaShardOf(AAShardedArray *array, AAKeyType key, size_t keylength);
+AssociativeArray *aaGetShard(AAShardedArray *array, size_t shard);
+long aaShardedInsert(AAShardedArray *array,
+		AAKeyType key, size_t keylength,
+		void *value);
+void *aaShardedLookup(AAShardedArray *array, AAKeyType key, size_t keylength);
+size_t aaShardedLookupBatch(AAShardedArray *array,
+		AAKeyType keys[], size_t keylengths[], size_t nKeys,
+		void *values[]);
+long aaShardedInsertBulk(AAShardedArray *array,
+		AAKeyType keys[], size_t keylengths[], void *values[], size_t nKeys,
+		int nThreads);
+void *aaShardedDelete(AAShardedArray *array, AAKeyType key, size_t keylength);
+int aaShardedIterateAction(
+		AAShardedArray *array,
+		int (*userfunction)(AAKeyType key, size_t keylen, void *datavalue, void *userdata),
+		void *userdata);
+int aaStartShardWorkers(AAShardedArray *array);
+void aaStopShardWorkers(AAShardedArray *array);
+int aaShardedSubmit(AAShardedArray *array, AAShardOp op,
+		AAKeyType key, size_t keylength, void *value,
+		AAShardCallback callback, void *userdata);
+void aaShardedDrain(AAShardedArray *array);
+void aaShardedPrintContents(FILE *fp, AAShardedArray *array, char *tag);
+void aaShardedPrintSummary(FILE *fp, AAShardedArray *array);
+int aaShardedGetStats(AAShardedArray *array, AAStats *stats);
+int aaShardedSaveSnapshot(AAShardedArray *array, const char *filename,
+		AAValueLength valueLength);
+
 /** print out the data, prefixing each line with the lineLeader */
 void aaPrintContents(FILE *fp, AssociativeArray *array, char *lineLeader);
 void aaPrintSummary(FILE *fp, AssociativeArray *array);
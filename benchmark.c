@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <string.h> /* for strtok(), strncmp() */
+#include <stdlib.h> /* for malloc(), free() */
+#include <stdint.h>
+#include <unistd.h> /* for getopt() */
+#include <errno.h>
+#include <math.h> /* for pow() */
+#include <time.h> /* for clock_gettime() */
+
+#include "aarray.h"
+
+/**
+ * Benchmark driver: times insert, hit lookup, miss lookup and
+ * delete over every combination of hash and probing strategy the
+ * library accepts, for several synthetic key sets and load factors,
+ * and writes one CSV row per operation timed.
+ *
+ * Each table is created just big enough to reach the chosen load
+ * factor once all the keys are in, and is not allowed to shrink, so
+ * the rows show the cost of the strategies themselves at that load
+ * rather than of rehashing.  Layouts that round their size up (the
+ * swiss table to a power of two, say) can end up well short of the
+ * chosen load, so each row also gives the load the table actually
+ * reached once the keys were inserted.  Weak hashes can make a
+ * table degrade to a linear search; a timing that passes the time
+ * limit is cut short and the rest of that combination skipped.
+ */
+
+#define	DEFAULT_KEYS		50000
+#define	DEFAULT_TIME_LIMIT	0.25
+#define	DEFAULT_SEED		1
+
+/** how many operations are done between looks at the clock */
+#define	CLOCK_INTERVAL		256
+
+/** the Zipfian skew of the "zipf" key set's lookups */
+#define	ZIPF_EXPONENT		0.99
+
+static char allHashes[] = "sum,len,xor,wyhash,xxh64,int,sip";
+static char allProbes[] = "linear,quadratic,doublehash,robin,swiss,cuckoo";
+static char allKeySets[] = "uniform,zipf,short,long,int";
+static char allLoads[] = "0.50,0.75,0.90";
+
+static const char alphabet[] =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+#define	ALPHABET_SIZE	62
+
+/**
+ * The keys of one key set: the first nKeys are inserted, the next
+ * nKeys never are, and are used for the lookups that miss.  Hits
+ * are looked up in hitOrder, and deleted in deleteOrder.
+ */
+typedef struct KeySet {
+	char *name;
+	size_t nKeys;
+	unsigned char *data;
+	AAKeyType *keys;
+	size_t *lengths;
+	size_t *hitOrder;
+	size_t *deleteOrder;
+} KeySet;
+
+/** the results of timing one operation */
+typedef struct Timing {
+	size_t nDone;
+	size_t nFound;
+	double seconds;
+	char *status;
+} Timing;
+
+/** xorshift64*, which is plenty for making up keys */
+static uint64_t
+nextRandom(uint64_t *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double
+now(void)
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/** a random permutation of 0 .. n-1 */
+static void
+shuffle(size_t *order, size_t n, uint64_t *state)
+{
+	size_t i, j, swap;
+
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n; i > 1; i--) {
+		j = nextRandom(state) % i;
+		swap = order[i - 1];
+		order[i - 1] = order[j];
+		order[j] = swap;
+	}
+}
+
+/**
+ * Lookups where the key of rank r is chosen with probability
+ * proportional to 1 / r^ZIPF_EXPONENT, the ranks being given to the
+ * keys in a random order.
+ */
+static int
+zipfOrder(size_t *order, size_t n, uint64_t *state)
+{
+	double *cumulative, total = 0, target;
+	size_t *rankToKey, i, low, high, middle;
+
+	cumulative = (double *) malloc(n * sizeof(double));
+	rankToKey = (size_t *) malloc(n * sizeof(size_t));
+	if (cumulative == NULL || rankToKey == NULL) {
+		free(cumulative);
+		free(rankToKey);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		total += 1.0 / pow((double) (i + 1), ZIPF_EXPONENT);
+		cumulative[i] = total;
+	}
+	shuffle(rankToKey, n, state);
+
+	for (i = 0; i < n; i++) {
+		target = (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0) * total;
+		low = 0;
+		high = n - 1;
+		while (low < high) {
+			middle = (low + high) / 2;
+			if (cumulative[middle] < target) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		order[i] = rankToKey[low];
+	}
+
+	free(cumulative);
+	free(rankToKey);
+	return 1;
+}
+
+static void
+deleteKeySet(KeySet *set)
+{
+	free(set->data);
+	free(set->keys);
+	free(set->lengths);
+	free(set->hitOrder);
+	free(set->deleteOrder);
+	free(set);
+}
+
+/**
+ * Make up a key set.  String keys are random characters, except
+ * that the first four characters spell out a scrambled key number
+ * in base 62, so no two keys are ever the same.
+ */
+static KeySet *
+makeKeySet(char *name, size_t nKeys, uint64_t seed)
+{
+	uint64_t state = seed * 0x9E3779B97F4A7C15ULL + 1;
+	size_t minLength, maxLength, i, j, offset = 0, number;
+	uint32_t intKey;
+	KeySet *set;
+
+	if (strncmp(name, "uni", 3) == 0 || strncmp(name, "zip", 3) == 0) {
+		minLength = 8;
+		maxLength = 24;
+	} else if (strncmp(name, "sho", 3) == 0) {
+		minLength = 4;
+		maxLength = 8;
+	} else if (strncmp(name, "lon", 3) == 0) {
+		minLength = 64;
+		maxLength = 128;
+	} else if (strncmp(name, "int", 3) == 0) {
+		minLength = maxLength = sizeof(uint32_t);
+	} else {
+		fprintf(stderr, "Error: unknown key set '%s'\n", name);
+		return NULL;
+	}
+
+	set = (KeySet *) calloc(1, sizeof(KeySet));
+	if (set == NULL)
+		return NULL;
+	set->name = name;
+	set->nKeys = nKeys;
+	set->data = (unsigned char *) malloc(2 * nKeys * maxLength);
+	set->keys = (AAKeyType *) malloc(2 * nKeys * sizeof(AAKeyType));
+	set->lengths = (size_t *) malloc(2 * nKeys * sizeof(size_t));
+	set->hitOrder = (size_t *) malloc(nKeys * sizeof(size_t));
+	set->deleteOrder = (size_t *) malloc(nKeys * sizeof(size_t));
+	if (set->data == NULL || set->keys == NULL || set->lengths == NULL
+			|| set->hitOrder == NULL || set->deleteOrder == NULL) {
+		fprintf(stderr, "Error: cannot allocate key set '%s'\n", name);
+		deleteKeySet(set);
+		return NULL;
+	}
+
+	for (i = 0; i < 2 * nKeys; i++) {
+		set->keys[i] = &set->data[offset];
+
+		if (strncmp(name, "int", 3) == 0) {
+			/** an odd multiplier scrambles the numbers without repeating any */
+			intKey = (uint32_t) i * 2654435761U;
+			memcpy(set->keys[i], &intKey, sizeof(intKey));
+			set->lengths[i] = sizeof(intKey);
+
+		} else {
+			set->lengths[i] = minLength + nextRandom(&state) % (maxLength - minLength + 1);
+			for (j = 0; j < set->lengths[i]; j++)
+				set->keys[i][j] = alphabet[nextRandom(&state) % ALPHABET_SIZE];
+
+			/** 1000003 shares no factor with 62^4, so this is one-to-one */
+			number = (i * 1000003) % (ALPHABET_SIZE * ALPHABET_SIZE * ALPHABET_SIZE * ALPHABET_SIZE);
+			for (j = 0; j < 4; j++) {
+				set->keys[i][j] = alphabet[number % ALPHABET_SIZE];
+				number /= ALPHABET_SIZE;
+			}
+		}
+		offset += set->lengths[i];
+	}
+
+	shuffle(set->deleteOrder, nKeys, &state);
+	if (strncmp(name, "zip", 3) == 0) {
+		if (zipfOrder(set->hitOrder, nKeys, &state) < 0) {
+			fprintf(stderr, "Error: cannot allocate key set '%s'\n", name);
+			deleteKeySet(set);
+			return NULL;
+		}
+	} else {
+		shuffle(set->hitOrder, nKeys, &state);
+	}
+
+	return set;
+}
+
+/** the operations timed, in the order they are run */
+typedef enum Operation {
+	OP_INSERT = 0,
+	OP_HIT,
+	OP_MISS,
+	OP_DELETE,
+	N_OPERATIONS
+} Operation;
+
+static const char *operationNames[N_OPERATIONS] = {
+		"insert", "hit-lookup", "miss-lookup", "delete"
+	};
+
+/**
+ * Run one operation over the whole key set, stopping early if the
+ * time limit runs out.
+ */
+static void
+timeOperation(AssociativeArray *table, KeySet *set, Operation operation,
+		double timeLimit, Timing *timing)
+{
+	size_t i, key;
+	double start = now();
+
+	timing->nFound = 0;
+	timing->status = "ok";
+
+	for (i = 0; i < set->nKeys; i++) {
+		if (i % CLOCK_INTERVAL == 0 && i > 0 && now() - start > timeLimit) {
+			timing->status = "timeout";
+			break;
+		}
+
+		switch (operation) {
+		case OP_INSERT:
+			if (aaInsert(table, set->keys[i], set->lengths[i], &set->keys[i]) < 0) {
+				timing->status = "failed";
+				timing->seconds = now() - start;
+				timing->nDone = i;
+				return;
+			}
+			timing->nFound++;
+			break;
+
+		case OP_HIT:
+			key = set->hitOrder[i];
+			if (aaLookup(table, set->keys[key], set->lengths[key]) != NULL)
+				timing->nFound++;
+			break;
+
+		case OP_MISS:
+			key = set->nKeys + i;
+			if (aaLookup(table, set->keys[key], set->lengths[key]) != NULL)
+				timing->nFound++;
+			break;
+
+		default:
+			key = set->deleteOrder[i];
+			if (aaDelete(table, set->keys[key], set->lengths[key]) != NULL)
+				timing->nFound++;
+			break;
+		}
+	}
+
+	timing->seconds = now() - start;
+	timing->nDone = i;
+}
+
+/** time every operation for one combination, writing a row for each */
+static void
+benchmarkOne(FILE *ofp, KeySet *set, char *hash, char *probe, double load,
+		double timeLimit, uint64_t seed)
+{
+	AssociativeArray *table;
+	AAConfig config;
+	Timing timing;
+	AAStats stats;
+	double nsPerOp, actualLoad = 0;
+	int operation;
+
+	aaInitConfig(&config);
+	config.maxLoadFactor = load;
+	config.minLoadFactor = 0;
+	config.seed = seed;
+
+	/** big enough that the last key brings the table up to the load factor */
+	table = aaCreateAssociativeArrayWithConfig((size_t) (set->nKeys / load) + 1,
+			probe, hash, "xxh64", &config);
+	if (table == NULL) {
+		fprintf(stderr, "Error: cannot create table for '%s' hash, '%s' probing\n",
+				hash, probe);
+		return;
+	}
+
+	for (operation = 0; operation < N_OPERATIONS; operation++) {
+		timeOperation(table, set, operation, timeLimit, &timing);
+		if (operation == OP_INSERT) {
+			aaGetStats(table, &stats);
+			actualLoad = stats.loadFactor;
+		}
+
+		nsPerOp = (timing.nDone > 0) ? timing.seconds * 1e9 / timing.nDone : 0;
+		fprintf(ofp, "%s,%s,%s,%.2f,%.3f,%zu,%s,%zu,%.1f,%.3f,%zu,%s\n",
+				set->name, hash, probe, load, actualLoad, set->nKeys,
+				operationNames[operation], timing.nDone, nsPerOp,
+				(nsPerOp > 0) ? 1e3 / nsPerOp : 0, timing.nFound, timing.status);
+		fflush(ofp);
+
+		/** the later operations mean nothing without all of the keys in place */
+		if (operation == OP_INSERT && strcmp(timing.status, "ok") != 0)
+			break;
+	}
+
+	aaDeleteAssociativeArray(table);
+}
+
+#define OPTIONLEN	12
+
+/** print out the help */
+static void
+usage(char *progname)
+{
+	fprintf(stderr, "%s [<OPTIONS>]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Times insert, hit lookup, miss lookup and delete for every combination\n");
+	fprintf(stderr, "of the hashes, probing strategies, key sets and load factors given,\n");
+	fprintf(stderr, "writing the results as CSV.  Lists are separated by commas.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options: \n");
+	fprintf(stderr, "%-*s: Print this help.\n", OPTIONLEN, "-h");
+	fprintf(stderr, "%-*s: Keys inserted per table, default %d.\n",
+			OPTIONLEN, "-n <KEYS>", DEFAULT_KEYS);
+	fprintf(stderr, "%-*s: Hashes, default \"%s\".\n", OPTIONLEN, "-H <LIST>", allHashes);
+	fprintf(stderr, "%-*s: Probing, default \"%s\".\n", OPTIONLEN, "-P <LIST>", allProbes);
+	fprintf(stderr, "%-*s: Key sets, default \"%s\".\n", OPTIONLEN, "-k <LIST>", allKeySets);
+	fprintf(stderr, "%-*s: Load factors, default \"%s\".\n", OPTIONLEN, "-L <LIST>", allLoads);
+	fprintf(stderr, "%-*s: Give up on an operation after this many seconds, default %.2f.\n",
+			OPTIONLEN, "-t <SECONDS>", DEFAULT_TIME_LIMIT);
+	fprintf(stderr, "%-*s: Seed for the keys and the keyed hashes, default %d.\n",
+			OPTIONLEN, "-s <SEED>", DEFAULT_SEED);
+	fprintf(stderr, "%-*s: Output file to write to, default stdout.\n", OPTIONLEN, "-o <FILE>");
+	fprintf(stderr, "\n");
+	exit (1);
+}
+
+/** split a comma separated list into its items, in place */
+static int
+splitList(char *list, char **items, int maxItems)
+{
+	char *item;
+	int nItems = 0;
+
+	for (item = strtok(list, ","); item != NULL && nItems < maxItems; item = strtok(NULL, ","))
+		items[nItems++] = item;
+	return nItems;
+}
+
+#define	MAX_ITEMS	32
+
+/**
+ * Benchmark mainline -- uses getopt(3) to parse arguments, then
+ * runs every combination asked for.
+ */
+int
+main(int argc, char **argv)
+{
+	char *hashes[MAX_ITEMS], *probes[MAX_ITEMS], *keySets[MAX_ITEMS], *loadNames[MAX_ITEMS];
+	int nHashes, nProbes, nKeySets, nLoads, h, p, k, l, c;
+	char *hashList = allHashes, *probeList = allProbes;
+	char *keySetList = allKeySets, *loadList = allLoads;
+	double timeLimit = DEFAULT_TIME_LIMIT, load;
+	uint64_t seed = DEFAULT_SEED;
+	unsigned long long seedArgument;
+	size_t nKeys = DEFAULT_KEYS;
+	FILE *ofp = stdout;
+	KeySet *set;
+
+	while ((c = getopt(argc, argv, "hn:H:P:k:L:t:s:o:")) != -1) {
+		if (c == 'n') {
+			if (sscanf(optarg, "%zu", &nKeys) != 1 || nKeys < 1 || nKeys > 5000000) {
+				fprintf(stderr, "Error: cannot parse number of keys (1 to 5000000) from '%s'\n",
+						optarg);
+				usage(argv[0]);
+			}
+		} else if (c == 'H') {
+			hashList = optarg;
+		} else if (c == 'P') {
+			probeList = optarg;
+		} else if (c == 'k') {
+			keySetList = optarg;
+		} else if (c == 'L') {
+			loadList = optarg;
+		} else if (c == 't') {
+			if (sscanf(optarg, "%lf", &timeLimit) != 1) {
+				fprintf(stderr, "Error: cannot parse time limit from '%s'\n", optarg);
+				usage(argv[0]);
+			}
+		} else if (c == 's') {
+			if (sscanf(optarg, "%llu", &seedArgument) != 1 || seedArgument == 0) {
+				fprintf(stderr, "Error: cannot parse non-zero seed from '%s'\n", optarg);
+				usage(argv[0]);
+			}
+			seed = seedArgument;
+		} else if (c == 'o') {
+			ofp = fopen(optarg, "w");
+			if (ofp == NULL) {
+				fprintf(stderr, "Error: cannot open requested output file '%s' : %s\n",
+						optarg, strerror(errno));
+				usage(argv[0]);
+			}
+		} else {
+			usage(argv[0]);
+		}
+	}
+
+	nHashes = splitList(hashList, hashes, MAX_ITEMS);
+	nProbes = splitList(probeList, probes, MAX_ITEMS);
+	nKeySets = splitList(keySetList, keySets, MAX_ITEMS);
+	nLoads = splitList(loadList, loadNames, MAX_ITEMS);
+
+	fprintf(ofp, "keyset,hash,probe,load_factor,actual_load,keys,operation,ops,ns_per_op,"
+			"mops_per_sec,found,status\n");
+
+	for (k = 0; k < nKeySets; k++) {
+		set = makeKeySet(keySets[k], nKeys, seed);
+		if (set == NULL)
+			return -1;
+
+		for (l = 0; l < nLoads; l++) {
+			if (sscanf(loadNames[l], "%lf", &load) != 1 || load <= 0 || load > 1) {
+				fprintf(stderr, "Error: load factor '%s' is not between 0 and 1\n",
+						loadNames[l]);
+				return -1;
+			}
+
+			for (h = 0; h < nHashes; h++) {
+				for (p = 0; p < nProbes; p++) {
+					benchmarkOne(ofp, set, hashes[h], probes[p], load, timeLimit, seed);
+				}
+			}
+		}
+		deleteKeySet(set);
+	}
+
+	if (ofp != stdout)
+		fclose(ofp);
+	return 0;
+}
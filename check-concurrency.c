@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <string.h> /* for memset() */
+#include <stdlib.h> /* for malloc(), free() */
+#include <pthread.h>
+
+#include "aarray.h"
+
+/**
+ * Concurrency check: a stress driver for the parts of the library
+ * that are used from more than one thread at once, meant to be
+ * built with a sanitizer ("make check-concurrency" builds it with
+ * ThreadSanitizer, and "make check-concurrency SANITIZE=address"
+ * with AddressSanitizer) so that data races and memory used after
+ * it was freed are reported, not just wrong answers.
+ *
+ * Three checks are run:
+ *
+ *  - a concurrent table with locked reads, and
+ *  - one with lock-free reads, in which writers insert and delete
+ *	  their own keys, retiring each deleted value, while readers
+ *	  look keys up and check each value they find against its key;
+ *	  enough keys come and go that the segments are rehashed, and
+ *	  old tables, keys and values all pass through the epochs;
+ *
+ *  - a sharded table with worker threads, to which several threads
+ *	  submit inserts, lookups and deletes at once, and whose
+ *	  callbacks count the results.
+ *
+ * Once the threads are done, each table must hold exactly the keys
+ * that were left in it.  Exits with a non-zero status if any check
+ * fails.
+ */
+
+#define	N_WRITERS			2
+#define	N_READERS			4
+#define	KEYS_PER_WRITER		2048
+#define	WRITER_ROUNDS		8
+#define	N_SEGMENTS			4
+
+#define	N_SUBMITTERS		4
+#define	KEYS_PER_SUBMITTER	4096
+#define	N_SHARDS			4
+
+#define	KEY_LENGTH			8
+
+/** the value stored with each key, which says which key it belongs to */
+typedef struct Item {
+	int key;
+} Item;
+
+static char keys[N_WRITERS * KEYS_PER_WRITER + N_SUBMITTERS * KEYS_PER_SUBMITTER][KEY_LENGTH];
+static int nKeys = (int) (sizeof(keys) / sizeof(keys[0]));
+
+static void
+makeKeys(void)
+{
+	int i;
+
+	for (i = 0; i < nKeys; i++)
+		snprintf(keys[i], KEY_LENGTH, "k%06d", i);
+}
+
+static AAKeyType
+key(int i)
+{
+	return (AAKeyType) keys[i];
+}
+
+/** xorshift32, to pick keys with */
+static unsigned int
+nextRandom(unsigned int *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/** the state shared by the threads of a concurrent table check */
+typedef struct ConcurrentCheck {
+	AAConcurrentArray *table;
+	int writersDone;
+	int nBadValues;
+} ConcurrentCheck;
+
+typedef struct Worker {
+	ConcurrentCheck *check;
+	int id;
+	pthread_t thread;
+} Worker;
+
+static void
+releaseItem(void *value)
+{
+	free(value);
+}
+
+/**
+ * Insert every one of this writer's keys, then delete and insert
+ * them again in turn, round after round, retiring each deleted
+ * value; every key is left in at the end
+ */
+static void *
+concurrentWriter(void *argument)
+{
+	Worker *worker = (Worker *) argument;
+	AAConcurrentArray *table = worker->check->table;
+	int first = worker->id * KEYS_PER_WRITER, round, i;
+	Item *item;
+
+	for (round = 0; round < WRITER_ROUNDS; round++) {
+		for (i = first; i < first + KEYS_PER_WRITER; i++) {
+			if (round > 0) {
+				item = (Item *) aaConcurrentDelete(table, key(i), KEY_LENGTH);
+				if (item == NULL || item->key != i)
+					__atomic_add_fetch(&worker->check->nBadValues, 1, __ATOMIC_RELAXED);
+				if (item != NULL)
+					aaConcurrentRetire(table, item, releaseItem);
+			}
+
+			item = (Item *) malloc(sizeof(Item));
+			item->key = i;
+			if (aaConcurrentInsert(table, key(i), KEY_LENGTH, item) < 0) {
+				__atomic_add_fetch(&worker->check->nBadValues, 1, __ATOMIC_RELAXED);
+				free(item);
+			}
+		}
+	}
+	__atomic_add_fetch(&worker->check->writersDone, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/** look up random keys until the writers are done, checking each value found */
+static void *
+concurrentReader(void *argument)
+{
+	Worker *worker = (Worker *) argument;
+	AAConcurrentArray *table = worker->check->table;
+	unsigned int state = 2463534242u + worker->id;
+	Item *item;
+	int i;
+
+	while (__atomic_load_n(&worker->check->writersDone, __ATOMIC_ACQUIRE) < N_WRITERS) {
+		i = (int) (nextRandom(&state) % (N_WRITERS * KEYS_PER_WRITER));
+
+		aaConcurrentEnterRead(table);
+		item = (Item *) aaConcurrentLookup(table, key(i), KEY_LENGTH);
+		if (item != NULL && item->key != i)
+			__atomic_add_fetch(&worker->check->nBadValues, 1, __ATOMIC_RELAXED);
+		aaConcurrentExitRead(table);
+	}
+	return NULL;
+}
+
+static int
+freeItem(AAKeyType key, size_t keylen, void *value, void *userdata)
+{
+	(*(int *) userdata)++;
+	free(value);
+	return 0;
+}
+
+/**
+ * Run writers and readers on a concurrent table at once, then check
+ * that every key is in the table once, with its own value
+ */
+static int
+checkConcurrentTable(int lockFreeReads)
+{
+	Worker workers[N_WRITERS + N_READERS];
+	ConcurrentCheck check;
+	AAConfig config;
+	Item *item;
+	int i, nLeft = 0;
+
+	aaInitConfig(&config);
+	config.lockFreeReads = lockFreeReads;
+
+	memset(&check, 0, sizeof(check));
+	check.table = aaCreateConcurrentArray(64, N_SEGMENTS, "lin", "wyhash", "xxh64", &config);
+	if (check.table == NULL)
+		return 0;
+
+	for (i = 0; i < N_WRITERS + N_READERS; i++) {
+		workers[i].check = &check;
+		workers[i].id = i;
+		pthread_create(&workers[i].thread, NULL,
+				(i < N_WRITERS) ? concurrentWriter : concurrentReader, &workers[i]);
+	}
+	for (i = 0; i < N_WRITERS + N_READERS; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < N_WRITERS * KEYS_PER_WRITER; i++) {
+		item = (Item *) aaConcurrentLookup(check.table, key(i), KEY_LENGTH);
+		if (item == NULL || item->key != i)
+			check.nBadValues++;
+	}
+
+	aaConcurrentIterateAction(check.table, freeItem, &nLeft);
+	aaDeleteConcurrentArray(check.table);
+
+	if (check.nBadValues > 0 || nLeft != N_WRITERS * KEYS_PER_WRITER) {
+		fprintf(stderr, "  %d wrong values, %d entries left of %d\n",
+				check.nBadValues, nLeft, N_WRITERS * KEYS_PER_WRITER);
+		return 0;
+	}
+	return 1;
+}
+
+/** the state shared by the submitters and the workers' callbacks */
+typedef struct ShardCheck {
+	AAShardedArray *table;
+	int nInserted;
+	int nFound;
+	int nDeleted;
+	int nBadValues;
+} ShardCheck;
+
+typedef struct Submitter {
+	ShardCheck *check;
+	int id;
+	pthread_t thread;
+} Submitter;
+
+/** run on a worker thread as each request finishes */
+static void
+countResult(void *userdata, AAShardOp op,
+		AAKeyType key, size_t keylen, void *value, long status)
+{
+	ShardCheck *check = (ShardCheck *) userdata;
+	int i = (int) ((char (*)[KEY_LENGTH]) key - keys);
+
+	if (op == AA_SHARD_INSERT) {
+		if (status >= 0)
+			__atomic_add_fetch(&check->nInserted, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (value == NULL)
+		return;
+	if (((Item *) value)->key != i)
+		__atomic_add_fetch(&check->nBadValues, 1, __ATOMIC_RELAXED);
+
+	if (op == AA_SHARD_LOOKUP) {
+		__atomic_add_fetch(&check->nFound, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&check->nDeleted, 1, __ATOMIC_RELAXED);
+		free(value);
+	}
+}
+
+/**
+ * Submit an insert for each of this thread's keys, a lookup of each,
+ * and a delete of every other one, all without waiting; the worker
+ * owning a key runs its requests in the order they were queued
+ */
+static void *
+submitRequests(void *argument)
+{
+	Submitter *submitter = (Submitter *) argument;
+	AAShardedArray *table = submitter->check->table;
+	int first = N_WRITERS * KEYS_PER_WRITER + submitter->id * KEYS_PER_SUBMITTER, i;
+	Item *item;
+
+	for (i = first; i < first + KEYS_PER_SUBMITTER; i++) {
+		item = (Item *) malloc(sizeof(Item));
+		item->key = i;
+		aaShardedSubmit(table, AA_SHARD_INSERT, key(i), KEY_LENGTH, item,
+				countResult, submitter->check);
+	}
+	for (i = first; i < first + KEYS_PER_SUBMITTER; i++)
+		aaShardedSubmit(table, AA_SHARD_LOOKUP, key(i), KEY_LENGTH, NULL,
+				countResult, submitter->check);
+	for (i = first; i < first + KEYS_PER_SUBMITTER; i += 2)
+		aaShardedSubmit(table, AA_SHARD_DELETE, key(i), KEY_LENGTH, NULL,
+				countResult, submitter->check);
+	return NULL;
+}
+
+/**
+ * Have several threads submit requests to a sharded table's workers
+ * at once, then check the results and what is left in the table
+ */
+static int
+checkShardWorkers(void)
+{
+	Submitter submitters[N_SUBMITTERS];
+	ShardCheck check;
+	AAConfig config;
+	int i, nLeft = 0, nKeysUsed = N_SUBMITTERS * KEYS_PER_SUBMITTER;
+
+	aaInitConfig(&config);
+	memset(&check, 0, sizeof(check));
+	check.table = aaCreateShardedArray(N_SHARDS, 64, "lin", "wyhash", "xxh64", &config);
+	if (check.table == NULL)
+		return 0;
+	if (aaStartShardWorkers(check.table) < 0) {
+		aaDeleteShardedArray(check.table);
+		return 0;
+	}
+
+	for (i = 0; i < N_SUBMITTERS; i++) {
+		submitters[i].check = &check;
+		submitters[i].id = i;
+		pthread_create(&submitters[i].thread, NULL, submitRequests, &submitters[i]);
+	}
+	for (i = 0; i < N_SUBMITTERS; i++)
+		pthread_join(submitters[i].thread, NULL);
+
+	aaShardedDrain(check.table);
+	aaStopShardWorkers(check.table);
+
+	aaShardedIterateAction(check.table, freeItem, &nLeft);
+	aaDeleteShardedArray(check.table);
+
+	if (check.nBadValues > 0 || check.nInserted != nKeysUsed
+			|| check.nFound != nKeysUsed || check.nDeleted != nKeysUsed / 2
+			|| nLeft != nKeysUsed / 2) {
+		fprintf(stderr, "  %d wrong values; %d inserted, %d found, %d deleted, %d left of %d\n",
+				check.nBadValues, check.nInserted, check.nFound, check.nDeleted,
+				nLeft, nKeysUsed);
+		return 0;
+	}
+	return 1;
+}
+
+static int
+report(int passed, char *description)
+{
+	printf("%s  %s\n", passed ? "ok    " : "FAILED", description);
+	return passed ? 0 : 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nFailed = 0;
+
+	makeKeys();
+
+	nFailed += report(checkConcurrentTable(0), "concurrent table, locked reads");
+	nFailed += report(checkConcurrentTable(1), "concurrent table, lock-free reads");
+	nFailed += report(checkShardWorkers(), "sharded table, worker threads");
+
+	return (nFailed > 0) ? 1 : 0;
+}
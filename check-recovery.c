@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h> /* for strncmp(), strcmp() */
+#include <stdlib.h> /* for malloc(), free(), mkdtemp() */
+#include <unistd.h> /* for unlink(), rmdir(), usleep() */
+#include <dirent.h> /* for opendir() */
+
+#include "aarray.h"
+
+/**
+ * Recovery check: makes changes to a logged table, rebuilds a copy
+ * of it from the log with aaRecoverFromLog(), and checks that the
+ * copy holds what the table does.  Each change is put in a segment
+ * of its own, and where a check asks for it, the segments are
+ * folded into a snapshot before the next change, so that the
+ * changes that follow are replayed over a snapshot rather than over
+ * the changes themselves.
+ *
+ * A key may be in a table more than once, if it was inserted again
+ * without being deleted; a search finds one copy, and a delete
+ * removes that one, uncovering the next.  So the copies of a key
+ * are compared by deleting the key from both tables until it is
+ * gone, and checking that the values come out in the same order.
+ *
+ * Run with no arguments; exits with a non-zero status if any check
+ * fails.
+ */
+
+#define	SNAPSHOT_WAIT		5000	/** milliseconds */
+#define	CACHE_ENTRIES		3
+
+static char *probes[] = { "lin", "qua", "dou", "rob", "swi", "cuc", NULL };
+
+/** the table being checked, and the log it writes to */
+typedef struct Logged {
+	AssociativeArray *table;
+	char *logname;
+	int nChanges;
+} Logged;
+
+static size_t
+stringLength(void *value)
+{
+	return strlen((char *) value) + 1;
+}
+
+/** the highest numbered snapshot of the log, or zero if there is none */
+static unsigned int
+latestSnapshot(const char *directory, const char *base)
+{
+	size_t baselen = strlen(base);
+	struct dirent *entry;
+	unsigned int number, latest = 0;
+	DIR *dir;
+
+	if ((dir = opendir(directory)) == NULL)
+		return 0;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, base, baselen) == 0
+				&& sscanf(entry->d_name + baselen, ".snap.%u", &number) == 1
+				&& number > latest)
+			latest = number;
+	}
+	closedir(dir);
+	return latest;
+}
+
+/**
+ * Wait until every change made so far is on disk and folded into a
+ * snapshot.  With one-byte segments, each synced change closes a
+ * segment of its own, so the n'th change is in segment n.
+ */
+static int
+waitForSnapshot(Logged *logged, const char *directory, const char *base)
+{
+	int waited;
+
+	if (aaLogSync(logged->table) < 0)
+		return -1;
+	for (waited = 0; waited < SNAPSHOT_WAIT; waited++) {
+		if (latestSnapshot(directory, base) >= (unsigned int) logged->nChanges)
+			return 1;
+		usleep(1000);
+	}
+	fprintf(stderr, "Log '%s' was not compacted in time\n", logged->logname);
+	return -1;
+}
+
+static int
+insert(Logged *logged, char *key, char *value)
+{
+	logged->nChanges++;
+	if (aaInsert(logged->table, (AAKeyType) key, strlen(key), value) < 0)
+		return -1;
+	return aaLogSync(logged->table);
+}
+
+static int
+delete(Logged *logged, char *key)
+{
+	logged->nChanges++;
+	aaDelete(logged->table, (AAKeyType) key, strlen(key));
+	return aaLogSync(logged->table);
+}
+
+static int
+lookup(Logged *logged, char *key)
+{
+	aaLookup(logged->table, (AAKeyType) key, strlen(key));
+	return 1;
+}
+
+/**
+ * Delete every copy of the key from both tables, checking that the
+ * same values come out in the same order
+ */
+static int
+sameCopies(AssociativeArray *live, AssociativeArray *recovered, char *key)
+{
+	char *fromLive, *fromRecovered;
+	int nCopies = 0;
+
+	do {
+		fromLive = (char *) aaDelete(live, (AAKeyType) key, strlen(key));
+		fromRecovered = (char *) aaDelete(recovered, (AAKeyType) key, strlen(key));
+		if ((fromLive == NULL) != (fromRecovered == NULL)
+				|| (fromLive != NULL && strcmp(fromLive, fromRecovered) != 0)) {
+			fprintf(stderr, "  copy %d of '%s' is '%s' live, but '%s' recovered\n",
+					nCopies + 1, key,
+					(fromLive == NULL) ? "(null)" : fromLive,
+					(fromRecovered == NULL) ? "(null)" : fromRecovered);
+			free(fromRecovered);
+			return 0;
+		}
+		free(fromRecovered);
+		nCopies++;
+	} while (fromLive != NULL);
+
+	return 1;
+}
+
+/** remove the files of the log, and the directory holding them */
+static void
+removeLog(const char *directory)
+{
+	char path[FILENAME_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	if ((dir = opendir(directory)) != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			if (entry->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+			unlink(path);
+		}
+		closedir(dir);
+	}
+	rmdir(directory);
+}
+
+/**
+ * Create a table of the given layout in a new directory, logging
+ * to a log there with one change to a segment
+ *
+ *  @return      1 on success, or -1 on failure
+ */
+static int
+startLog(Logged *logged, char *directory, char *logname, char *probe,
+		unsigned int compactSegments)
+{
+	AALogConfig config;
+
+	memset(logged, 0, sizeof(Logged));
+	if (mkdtemp(directory) == NULL) {
+		perror("Cannot create directory for log");
+		return -1;
+	}
+	snprintf(logname, FILENAME_MAX, "%s/check.log", directory);
+	logged->logname = logname;
+
+	logged->table = aaCreateAssociativeArray(16, probe, "wyhash", "xxh64");
+	aaInitLogConfig(&config);
+	config.segmentBytes = 1;
+	config.compactSegments = compactSegments;
+	if (logged->table == NULL
+			|| aaAttachLog(logged->table, logname, stringLength, &config) < 0)
+		return -1;
+	return 1;
+}
+
+/**
+ * Insert a key three times, then delete it twice, with a snapshot
+ * taken before each delete, and check that the table rebuilt from
+ * the log holds the same copies in the same order.  (A copy inserted
+ * after a delete may be put in the slot the delete freed, ahead of
+ * the older copies, in some layouts; which slots were freed is not
+ * logged, so that order is not checked.)
+ */
+static int
+checkDuplicatesAcrossCompaction(char *probe)
+{
+	char directory[] = "/tmp/aacheck.XXXXXX";
+	char logname[FILENAME_MAX];
+	AssociativeArray *recovered;
+	Logged logged;
+	int passed = 0;
+
+	if (startLog(&logged, directory, logname, probe, 1) < 0)
+		goto done;
+
+	if (insert(&logged, "key", "v1") < 0
+			|| insert(&logged, "other", "x") < 0
+			|| insert(&logged, "key", "v2") < 0
+			|| insert(&logged, "key", "v3") < 0
+			|| waitForSnapshot(&logged, directory, "check.log") < 0
+			|| delete(&logged, "key") < 0
+			|| waitForSnapshot(&logged, directory, "check.log") < 0
+			|| insert(&logged, "another", "y") < 0
+			|| delete(&logged, "key") < 0
+			|| aaDetachLog(logged.table) < 0)
+		goto done;
+
+	recovered = aaRecoverFromLog(logname, 16, probe, "wyhash", "xxh64", NULL);
+	if (recovered == NULL)
+		goto done;
+
+	passed = sameCopies(logged.table, recovered, "key")
+			&& sameCopies(logged.table, recovered, "other")
+			&& sameCopies(logged.table, recovered, "another");
+	aaDeleteAssociativeArray(recovered);
+
+done:
+	aaDeleteAssociativeArray(logged.table);
+	removeLog(directory);
+	return passed;
+}
+
+/**
+ * Fill a cache of CACHE_ENTRIES entries, inserting one key twice, so
+ * that the clock has to choose between the keys to evict, and check
+ * that the table rebuilt from the log holds the entries the cache
+ * kept, and no others
+ */
+static int
+checkCacheEvictions(char *probe)
+{
+	char directory[] = "/tmp/aacheck.XXXXXX";
+	char logname[FILENAME_MAX];
+	char *keys[] = { "key", "a", "b", "c", "d" };
+	AssociativeArray *recovered;
+	AACacheConfig cache;
+	Logged logged;
+	int passed = 0, i;
+
+	if (startLog(&logged, directory, logname, probe, 0) < 0)
+		goto done;
+	memset(&cache, 0, sizeof(cache));
+	cache.maxEntries = CACHE_ENTRIES;
+	if (aaSetCacheMode(logged.table, &cache) < 0)
+		goto done;
+
+	if (insert(&logged, "key", "v1") < 0
+			|| insert(&logged, "key", "v2") < 0
+			|| ! lookup(&logged, "key")
+			|| insert(&logged, "a", "x") < 0
+			|| ! lookup(&logged, "a")
+			|| insert(&logged, "b", "y") < 0
+			|| insert(&logged, "c", "z") < 0
+			|| ! lookup(&logged, "c")
+			|| insert(&logged, "d", "w") < 0
+			|| aaDetachLog(logged.table) < 0)
+		goto done;
+
+	recovered = aaRecoverFromLog(logname, 16, probe, "wyhash", "xxh64", NULL);
+	if (recovered == NULL)
+		goto done;
+
+	passed = 1;
+	for (i = 0; i < (int) (sizeof(keys) / sizeof(keys[0])); i++)
+		passed = passed && sameCopies(logged.table, recovered, keys[i]);
+	aaDeleteAssociativeArray(recovered);
+
+done:
+	aaDeleteAssociativeArray(logged.table);
+	removeLog(directory);
+	return passed;
+}
+
+/** run a check over every layout, reporting each one */
+static int
+checkLayouts(int (*check)(char *probe), char *description)
+{
+	int i, nFailed = 0;
+
+	for (i = 0; probes[i] != NULL; i++) {
+		if (check(probes[i])) {
+			printf("ok      %s, %s\n", description, probes[i]);
+		} else {
+			printf("FAILED  %s, %s\n", description, probes[i]);
+			nFailed++;
+		}
+	}
+	return nFailed;
+}
+
+int
+main(int argc, char **argv)
+{
+	int nFailed = 0;
+
+	nFailed += checkLayouts(checkDuplicatesAcrossCompaction, "duplicates across compaction");
+	nFailed += checkLayouts(checkCacheEvictions, "cache evictions");
+
+	return (nFailed > 0) ? 1 : 0;
+}
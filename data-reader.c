@@ -1,36 +1,325 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h> /* for malloc()/free() */
-#include <string.h> /* for strlen(), strdup() */
+#include <string.h> /* for memchr(), strerror() */
 #include <ctype.h> /* for isprint() */
+#include <errno.h>
+#include <fcntl.h> /* for open() */
+#include <unistd.h> /* for read(), close() */
+#include <sys/mman.h> /* for mmap() */
+#include <sys/stat.h> /* for fstat() */
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "data-reader.h"
 
+/**
+ * Lines are scanned a block of 64 bytes at a time: each byte of the
+ * block is compared against the character sought in parallel, giving
+ * a 64 bit mask with a bit set for every byte that matched.  The
+ * lowest set bit is then the first match in the block.  With AVX2
+ * this takes two 32 byte compares, with SSE2 four 16 byte compares;
+ * without either, a plain loop builds the same mask.
+ */
+#define	BLOCK_SIZE	64
+
+typedef uint64_t BlockMask;
+
 
 /* forward references */
-static char *stripNonPrinting(char *s);
+static void stripNonPrinting(DataSpan *span);
+static int readWholeFile(int fd, DataFile *file);
+
+
+/** the bytes of the block equal to c */
+static inline BlockMask
+matchBlock(const char *block, char c)
+{
+#if defined(__AVX2__)
+	__m256i target = _mm256_set1_epi8(c);
+	BlockMask low = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *) block), target));
+	BlockMask high = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_loadu_si256((const __m256i *) (block + 32)), target));
+
+	return low | (high << 32);
+#elif defined(__SSE2__)
+	__m128i target = _mm_set1_epi8(c);
+	BlockMask mask = 0;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i += 16) {
+		mask |= (BlockMask) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *) (block + i)), target)) << i;
+	}
+	return mask;
+#else
+	BlockMask mask = 0;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		if (block[i] == c)
+			mask |= (BlockMask) 1 << i;
+	}
+	return mask;
+#endif
+}
+
+/**
+ * The bytes of the block that are data characters, as dataCharacter():
+ * those from '!' to '~'.  As signed bytes, these are the ones greater
+ * than ' ' and less than DEL, as everything from 0x80 up is negative.
+ */
+static inline BlockMask
+dataBlock(const char *block)
+{
+#if defined(__AVX2__)
+	__m256i space = _mm256_set1_epi8(' '), delete = _mm256_set1_epi8(0x7F);
+	__m256i bytes;
+	BlockMask mask = 0;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i += 32) {
+		bytes = _mm256_loadu_si256((const __m256i *) (block + i));
+		mask |= (BlockMask) (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(
+				_mm256_cmpgt_epi8(bytes, space),
+				_mm256_cmpgt_epi8(delete, bytes))) << i;
+	}
+	return mask;
+#elif defined(__SSE2__)
+	__m128i space = _mm_set1_epi8(' '), delete = _mm_set1_epi8(0x7F);
+	__m128i bytes;
+	BlockMask mask = 0;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i += 16) {
+		bytes = _mm_loadu_si128((const __m128i *) (block + i));
+		mask |= (BlockMask) (uint16_t) _mm_movemask_epi8(_mm_and_si128(
+				_mm_cmpgt_epi8(bytes, space), _mm_cmplt_epi8(bytes, delete))) << i;
+	}
+	return mask;
+#else
+	BlockMask mask = 0;
+	int i;
+
+	for (i = 0; i < BLOCK_SIZE; i++) {
+		if (block[i] > ' ' && block[i] < 0x7F)
+			mask |= (BlockMask) 1 << i;
+	}
+	return mask;
+#endif
+}
+
+
+/**
+ * Open a data file for reading.  The whole file is mapped into
+ * memory, and the lines handed back point straight into the mapping,
+ * so lines may be of any length and are never copied.  Anything
+ * that cannot be mapped (a pipe, say) is read into memory instead.
+ *
+ *  @return      the open file, or NULL if it could not be read
+ */
+DataFile *
+openDataFile(const char *filename)
+{
+	DataFile *file;
+	struct stat status;
+	void *mapping;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error: Failed to open input file '%s' : %s\n",
+				filename, strerror(errno));
+		return NULL;
+	}
+
+	file = (DataFile *) malloc(sizeof(DataFile));
+	if (file == NULL) {
+		close(fd);
+		return NULL;
+	}
+	memset(file, 0, sizeof(DataFile));
+
+	if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+		mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			/** we read the file from front to back, once */
+			madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+			file->data = (const char *) mapping;
+			file->length = status.st_size;
+			file->mapped = 1;
+		}
+	}
+
+	if ( ! file->mapped && readWholeFile(fd, file) < 0) {
+		fprintf(stderr, "Error: Failed to read input file '%s' : %s\n",
+				filename, strerror(errno));
+		close(fd);
+		free(file);
+		return NULL;
+	}
+
+	close(fd);
+	file->end = file->length;
+	return file;
+}
+
+/** read everything left in the file into memory */
+static int
+readWholeFile(int fd, DataFile *file)
+{
+	size_t allocated = 64 * 1024;
+	char *buffer, *bigger;
+	ssize_t nRead;
+
+	buffer = (char *) malloc(allocated);
+	if (buffer == NULL)
+		return -1;
+
+	for (;;) {
+		if (file->length == allocated) {
+			bigger = (char *) realloc(buffer, allocated * 2);
+			if (bigger == NULL) {
+				free(buffer);
+				return -1;
+			}
+			buffer = bigger;
+			allocated *= 2;
+		}
+
+		nRead = read(fd, buffer + file->length, allocated - file->length);
+		if (nRead < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buffer);
+			return -1;
+		}
+		if (nRead == 0)
+			break;
+		file->length += nRead;
+	}
+
+	file->data = buffer;
+	return 1;
+}
+
+/**
+ * Close the file.  Any spans handed out for it are no longer valid.
+ */
+void
+closeDataFile(DataFile *file)
+{
+	if (file == NULL)
+		return;
+
+	if (file->mapped) {
+		munmap((void *) file->data, file->length);
+	} else {
+		free((void *) file->data);
+	}
+	free(file);
+}
+
+/**
+ * Set up a reader for part of an open file, from one offset up to
+ * another, so that different parts of a file can be read at once.
+ * The part must start at the beginning of a line, and the reader
+ * must not be closed.
+ */
+void
+dataFilePart(const DataFile *file, size_t start, size_t end, DataFile *part)
+{
+	*part = *file;
+	part->mapped = 0;
+	part->position = start;
+	part->end = end;
+}
+
+/**
+ * Hand back the next line of the file, without its newline.  If
+ * delimiter is not NULL, it is set to the first DELIMITER_CHAR in
+ * the line, or NULL if there is none, found in the same pass.
+ *
+ *  @return      1 if a line was found, or 0 at the end of the file
+ */
+static int
+nextLine(DataFile *file, DataSpan *line, const char **delimiter)
+{
+	const char *start, *scan, *end, *newline = NULL;
+	BlockMask newlines, delimiters;
+
+	if (file->position >= file->end)
+		return 0;
+
+	start = scan = file->data + file->position;
+	end = file->data + file->end;
+	if (delimiter != NULL)
+		*delimiter = NULL;
+
+	/** whole blocks first, looking for both characters at once */
+	for ( ; end - scan >= BLOCK_SIZE; scan += BLOCK_SIZE) {
+		newlines = matchBlock(scan, '\n');
+		if (delimiter != NULL && *delimiter == NULL) {
+			delimiters = matchBlock(scan, DELIMITER_CHAR);
+
+			/** only those before the newline count */
+			if (newlines != 0)
+				delimiters &= newlines ^ (newlines - 1);
+			if (delimiters != 0)
+				*delimiter = scan + __builtin_ctzll(delimiters);
+		}
+		if (newlines != 0) {
+			newline = scan + __builtin_ctzll(newlines);
+			break;
+		}
+	}
+
+	/** then whatever is left over, a byte at a time */
+	for ( ; newline == NULL && scan < end; scan++) {
+		if (*scan == '\n') {
+			newline = scan;
+		} else if (*scan == DELIMITER_CHAR && delimiter != NULL && *delimiter == NULL) {
+			*delimiter = scan;
+		}
+	}
+
+	if (newline == NULL) {
+		line->length = file->end - file->position;
+		file->position = file->end;
+	} else {
+		line->length = newline - start;
+		file->position += line->length + 1;
+	}
+	line->start = start;
+
+	return 1;
+}
 
 
 /**
- * Read in an attribute/value pair from a file
+ * Read in an attribute/value pair from the file
+ *
+ *  @return      1 if a pair was found, 0 at the end of the file,
+ *				 or -1 for a line that is not a pair
  */
 int
-readDataLine(
-			FILE *dataFP,
-			char *line,
-			int maxlinelen,
-			char **key,
-			char **value
+readDataRecord(
+			DataFile *file,
+			DataSpan *key,
+			DataSpan *value
 		)
 {
-	char *delimiterPosition = NULL;
+	DataSpan line;
+	const char *delimiterPosition = NULL;
 
-	/** read the file until empty */
-	if (fgets(line, maxlinelen, dataFP) == NULL) {
+	/** read the file until empty, finding the delimiter on the way */
+	if ( ! nextLine(file, &line, &delimiterPosition)) {
 		return 0;
 	}
 
-	/** find the delimiter */
-	delimiterPosition = strchr(line, DELIMITER_CHAR);
 	if (delimiterPosition == NULL) {
 		/**
 		 * You can "continue" a string in C by simply having
@@ -40,23 +329,19 @@ readDataLine(
 		 */
 		fprintf(stderr,
 				"Error: Input line does not contain"
-				"delimiter char '%c': '%s'\n",
-				DELIMITER_CHAR, line);
+				"delimiter char '%c': '%.*s'\n",
+				DELIMITER_CHAR, (int) line.length, line.start);
 		return -1;
 	}
 
 	/**
-	 * At this point, the string starting one character
-	 * _after_ the delimiter is our value, and the string
-	 * up to the delimiter is our integer key.  If we
-	 * cut the string here, sscanf will give us the key,
-	 * and we can compute the value as simply this position
-	 * plus one
+	 * At this point, the part of the line starting one
+	 * character _after_ the delimiter is our value, and
+	 * the part up to the delimiter is our key.
 	 */
-	*delimiterPosition = '\0';
-
-	/* assign the pointer to the key */
-	(*key) = stripNonPrinting(line);
+	key->start = line.start;
+	key->length = delimiterPosition - line.start;
+	stripNonPrinting(key);
 
 
 	/**
@@ -65,80 +350,134 @@ readDataLine(
 	 * that portion of the line by removing any non-printable
 	 * or 'blank' characters from beginning and end of the string
 	 */
-	(*value) = stripNonPrinting(&delimiterPosition[1]);
+	value->start = delimiterPosition + 1;
+	value->length = (line.start + line.length) - value->start;
+	stripNonPrinting(value);
 
 	return 1;
 }
 
 
 /**
- * Read in an attribute/value pair from a file
+ * Read in a single value from the file, one per line
+ *
+ *  @return      1 if a line was found, or 0 at the end of the file
  */
 int
-readPlainLine(
-			FILE *dataFP,
-			char *line,
-			int maxlinelen,
-			char **value
+readPlainRecord(
+			DataFile *file,
+			DataSpan *value
 		)
 {
 	/** read the file until empty */
-	if (fgets(line, maxlinelen, dataFP) == NULL) {
+	if ( ! nextLine(file, value, NULL)) {
 		return 0;
 	}
 
-	/* assign the pointer to the key */
-	(*value) = stripNonPrinting(line);
+	stripNonPrinting(value);
+
+	return 1;
+}
+
+
+/**
+ * Copy a span out into a string of its own, which the caller must free
+ */
+char *
+spanToString(const DataSpan *span)
+{
+	char *copy;
+
+	copy = (char *) malloc(span->length + 1);
+	if (copy == NULL)
+		return NULL;
+
+	memcpy(copy, span->start, span->length);
+	copy[span->length] = '\0';
+	return copy;
+}
+
+/**
+ * Parse the integer at the start of the span, as sscanf("%d") would
+ * for a span starting with a digit.
+ *
+ *  @return      1 on success, or 0 if the span does not start with a digit
+ */
+int
+spanToInt(const DataSpan *span, int *result)
+{
+	unsigned int total = 0;
+	size_t i;
+
+	if (span->length == 0 || ! isdigit((unsigned char) span->start[0]))
+		return 0;
+
+	for (i = 0; i < span->length && isdigit((unsigned char) span->start[i]); i++)
+		total = total * 10 + (span->start[i] - '0');
 
+	*result = (int) total;
 	return 1;
 }
 
 
 /**
- * Return true (i.e.; nonzero) for characters we want to keep,
- * determined by isprint() and checks for tab and space.
+ * Return true (i.e.; nonzero) for characters we want to keep:
+ * those isprint() accepts, other than the space.
  *
- * Tab and space must be checked for separately, as isprint()
- * considers these "printable" characters.
+ * We never call setlocale(), so isprint() is that of the "C"
+ * locale, which accepts exactly ' ' through '~'.  Checking the
+ * range directly gives the same answer without a call into the
+ * locale tables, and is what dataBlock() does for a whole block.
  *
  * "Wrapping" a function like this to modify its functionality
  * is a great way to make code more readable and collect all
  * of the "fixes" in one place.
  */
-static int
+static inline int
 dataCharacter(char c)
 {
-	/* if a blank or a tab, return false */
-	if ((c == ' ') || (c == '\t'))	return 0;
-
-	/* otherwise, return  isprint() */
-	return ( isprint(c) );
-
+	return (c > ' ' && c < 0x7F);
 }
 
 /**
  * Strip any non-printing characters from the beginning and end of
- * the provided string
- *
- * N.B.: this function modifies the string in place to achieve this
+ * the span.  The data itself is left untouched; only the span moves.
  */
-static char *
-stripNonPrinting(char *s)
+static void
+stripNonPrinting(DataSpan *span)
 {
-	int i;
+	BlockMask keep;
 
-	/** first walk up the string until we come to a printable byte */
-	while ( ( *s != '\0' ) && ( ! dataCharacter(*s) )) {
-		s++;
+	/** skip whole blocks of blanks, then find the first data byte in the block */
+	while (span->length >= BLOCK_SIZE) {
+		keep = dataBlock(span->start);
+		if (keep != 0) {
+			span->start += __builtin_ctzll(keep);
+			span->length -= __builtin_ctzll(keep);
+			break;
+		}
+		span->start += BLOCK_SIZE;
+		span->length -= BLOCK_SIZE;
 	}
 
-	/** walk backwards from end, wiping out all non-printing character */
+	/** likewise backwards from the end */
+	while (span->length >= BLOCK_SIZE) {
+		keep = dataBlock(span->start + span->length - BLOCK_SIZE);
+		if (keep != 0) {
+			span->length -= __builtin_clzll(keep);
+			break;
+		}
+		span->length -= BLOCK_SIZE;
+	}
 
-	i = strlen(s);
-	while ((i >=0) && ( ! dataCharacter(s[i]) ) ) {
-		s[i--] = 0;
+	/** first walk up the span until we come to a printable byte */
+	while ( ( span->length > 0 ) && ( ! dataCharacter(span->start[0]) )) {
+		span->start++;
+		span->length--;
 	}
 
-	return s;
+	/** walk backwards from end, dropping all non-printing characters */
+	while ( ( span->length > 0 ) && ( ! dataCharacter(span->start[span->length - 1]) )) {
+		span->length--;
+	}
 }
-
@@ -2,11 +2,27 @@
 
 #define	DELIMITER_CHAR	'\t'
 
-int readDataLine(FILE *dataFP,
-		char *linebuffer, int maxlinelen,
-		char **key, char **value);
-int readPlainLine(FILE *dataFP,
-		char *linebuffer, int maxlinelen,
-		char **value);
+/** a run of bytes within a data file, which need not end in a NUL */
+typedef struct DataSpan {
+	const char *start;
+	size_t length;
+} DataSpan;
+
+/** a data file held in memory, and how far through it we have read */
+typedef struct DataFile {
+	const char *data;
+	size_t length;
+	size_t position;
+	size_t end;			/** where this reader stops */
+	int mapped;
+} DataFile;
+
+DataFile *openDataFile(const char *filename);
+void closeDataFile(DataFile *file);
+void dataFilePart(const DataFile *file, size_t start, size_t end, DataFile *part);
+int readDataRecord(DataFile *file, DataSpan *key, DataSpan *value);
+int readPlainRecord(DataFile *file, DataSpan *value);
+char *spanToString(const DataSpan *span);
+int spanToInt(const DataSpan *span, int *result);
 	
 #endif
@@ -1,160 +1,398 @@
 #include <stdio.h>
-#include <string.h> /* for strlen(), strdup() */
+#include <string.h> /* for memchr(), memset() */
 #include <stdlib.h> /* for free() */
 #include <unistd.h> /* for getopt() */
 #include <ctype.h>  /* for isdigit() */
 #include <errno.h>
+#include <inttypes.h> /* for SCNu64 */
+#include <pthread.h>
 
 #include "aarray.h"
 #include "data-reader.h"
+#include "result-writer.h"
+#include "perf-counters.h"
 
-#define	LINE_MAX	128
+/** the most threads -j may ask for */
+#define	MAX_JOBS	256
+
+/**
+ * The table being worked on: either a single table, or, when the
+ * data is loaded by several threads (-j), a table split into shards
+ * that the threads can fill without getting in each other's way.
+ */
+typedef struct Table {
+	AssociativeArray *single;
+	AAShardedArray *sharded;
+	int nJobs;
+	int useIntKey;
+} Table;
+
+/**
+ * Work out the key to use for a span read from a file: a pointer
+ * straight into the file, or, for a key of digits when integer
+ * keys were asked for, the integer it holds.
+ *
+ *  @return      1 on success, or -1 if the integer could not be read
+ */
+static int
+spanKey(const DataSpan *span, int useIntKey, int *intkey,
+		AAKeyType *key, size_t *keylen)
+{
+	if (useIntKey && span->length > 0 && isdigit((unsigned char) span->start[0])) {
+		if ( ! spanToInt(span, intkey)) {
+			fprintf(stderr, "Error: Failed extracting integer from '%.*s'\n",
+					(int) span->length, span->start);
+			return -1;
+		}
+		*key = (AAKeyType) intkey;
+		*keylen = sizeof(int);
+	} else {
+		*key = (AAKeyType) span->start;
+		*keylen = span->length;
+	}
+	return 1;
+}
+
+/** one key and value parsed by a loading thread */
+typedef struct LoadRecord {
+	AAKeyType key;			/** NULL for an integer key */
+	size_t keylen;
+	int intkey;
+	char *value;
+} LoadRecord;
+
+/** the part of a data file one loading thread parses */
+typedef struct LoadChunk {
+	DataFile part;
+	int useIntKey;
+	LoadRecord *records;
+	size_t nRecords;
+	size_t nAllocated;
+	int stopped;		/** parsing stopped at a line that was not understood */
+	int status;
+	pthread_t id;
+} LoadChunk;
+
+/** add a record to the chunk, making room as needed */
+static LoadRecord *
+addRecord(LoadChunk *chunk)
+{
+	LoadRecord *records;
+
+	if (chunk->nRecords == chunk->nAllocated) {
+		chunk->nAllocated = (chunk->nAllocated == 0) ? 1024 : chunk->nAllocated * 2;
+		records = (LoadRecord *) realloc(chunk->records,
+				chunk->nAllocated * sizeof(LoadRecord));
+		if (records == NULL)
+			return NULL;
+		chunk->records = records;
+	}
+	return &chunk->records[chunk->nRecords++];
+}
+
+/**
+ * Parse every line of one chunk of a data file.  The keys are left
+ * in the file, and only the values are copied out.  As with loading
+ * a line at a time, parsing stops at the first line without a
+ * delimiter.
+ */
+static void *
+parseChunk(void *argument)
+{
+	LoadChunk *chunk = (LoadChunk *) argument;
+	DataSpan keySpan, valueSpan;
+	LoadRecord *record;
+	int readStatus;
+
+	while ((readStatus = readDataRecord(&chunk->part, &keySpan, &valueSpan)) != 0) {
+		if (readStatus < 0) {
+			chunk->stopped = 1;
+			break;
+		}
+
+		record = addRecord(chunk);
+		if (record == NULL || (record->value = spanToString(&valueSpan)) == NULL) {
+			fprintf(stderr, "Error: cannot allocate space for loaded data\n");
+			chunk->status = -1;
+			break;
+		}
+
+		if (spanKey(&keySpan, chunk->useIntKey, &record->intkey,
+					&record->key, &record->keylen) < 0) {
+			free(record->value);
+			chunk->nRecords--;
+			chunk->status = -1;
+			break;
+		}
+		if (record->key == (AAKeyType) &record->intkey)
+			record->key = NULL;
+	}
+	return NULL;
+}
+
+/**
+ * Load a data file using several threads: the file is split into
+ * chunks at line boundaries, each chunk is parsed by a thread of
+ * its own, and the records are then handed to the sharded table to
+ * be hashed, grouped by shard and inserted in parallel.
+ */
+static int
+loadInParallel(Table *table, DataFile *file)
+{
+	LoadChunk chunks[MAX_JOBS];
+	AAKeyType *keys = NULL;
+	size_t *keylens = NULL;
+	void **values = NULL;
+	size_t start, end, nRecords = 0, nPassed = 0, n, j;
+	const char *newline;
+	int nChunks = table->nJobs, nStarted, i;
+	long status = 1;
+
+	/** each chunk starts just after the first newline past its share of the file */
+	memset(chunks, 0, sizeof(chunks));
+	for (i = 0, start = 0; i < nChunks; i++, start = end) {
+		end = file->length * (i + 1) / nChunks;
+		if (end < start)
+			end = start;
+		if (i < nChunks - 1 && end > 0) {
+			newline = memchr(file->data + end - 1, '\n', file->length - end + 1);
+			end = (newline == NULL) ? file->length : (size_t) (newline + 1 - file->data);
+		}
+		dataFilePart(file, start, end, &chunks[i].part);
+		chunks[i].useIntKey = table->useIntKey;
+		chunks[i].status = 1;
+	}
+
+	for (nStarted = 1; nStarted < nChunks; nStarted++) {
+		if (pthread_create(&chunks[nStarted].id, NULL, parseChunk, &chunks[nStarted]) != 0)
+			break;
+	}
+	parseChunk(&chunks[0]);
+	for (i = nStarted; i < nChunks; i++)
+		parseChunk(&chunks[i]);
+	for (i = 1; i < nStarted; i++)
+		pthread_join(chunks[i].id, NULL);
+
+	/** keep the records up to the first line that was not understood */
+	for (i = 0; i < nChunks; i++) {
+		if (chunks[i].status < 0)
+			status = -1;
+		nRecords += chunks[i].nRecords;
+		if (chunks[i].stopped)
+			break;
+	}
+
+	if (status > 0) {
+		keys = (AAKeyType *) malloc(nRecords * sizeof(AAKeyType));
+		keylens = (size_t *) malloc(nRecords * sizeof(size_t));
+		values = (void **) malloc(nRecords * sizeof(void *));
+		if (nRecords > 0 && (keys == NULL || keylens == NULL || values == NULL)) {
+			fprintf(stderr, "Error: cannot allocate space for loaded data\n");
+			status = -1;
+		}
+	}
+
+	if (status > 0) {
+		for (i = 0, n = 0; n < nRecords; i++) {
+			for (j = 0; j < chunks[i].nRecords; j++, n++) {
+				LoadRecord *record = &chunks[i].records[j];
+
+				keys[n] = (record->key == NULL) ?
+						(AAKeyType) &record->intkey : record->key;
+				keylens[n] = record->keylen;
+				values[n] = record->value;
+			}
+		}
+
+		nPassed = nRecords;
+		status = aaShardedInsertBulk(table->sharded, keys, keylens, values,
+				nRecords, table->nJobs);
+	}
+
+	/** the values of records not handed to the table are still ours to free */
+	free(keys);
+	free(keylens);
+	free(values);
+	for (i = 0, n = 0; i < nChunks; i++) {
+		for (j = 0; j < chunks[i].nRecords; j++, n++) {
+			if (n >= nPassed)
+				free(chunks[i].records[j].value);
+		}
+		free(chunks[i].records);
+	}
+
+	return (status < 0) ? -1 : (int) nRecords;
+}
 
 /**
  * Load the assocArray of attribute value entries
  */
 static int
-loadAssociativeArray(AssociativeArray *assocArray, char *filename, int useIntKey)
+loadAssociativeArray(Table *table, char *filename)
 {
-	char linebuffer[LINE_MAX];
-	char *strkey = NULL, *value = NULL;
+	DataSpan keySpan, valueSpan;
+	AAKeyType key;
+	size_t keylen;
+	char *value = NULL;
 	int nEntries = 0;
 	int intkey;
-	FILE *fp = NULL;
+	DataFile *file = NULL;
 
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error: Failed to open input file '%s' : %s",
-				filename, strerror(errno));
+	file = openDataFile(filename);
+	if (file == NULL) {
 		return -1;
 	}
 
-	while (readDataLine(fp, linebuffer, LINE_MAX, &strkey, &value) > 0) {
-		
-		if (useIntKey && isdigit(strkey[0])) {
-			if (sscanf(strkey, "%d", &intkey) != 1) {
-				fprintf(stderr, "Error: Failed extracting integer from '%s'\n", strkey);
-				return -1;
-			}
-			if (aaInsert(assocArray,
-						(AAKeyType) &intkey, sizeof(int),
-						strdup(value)) < 0) {
-				fprintf(stderr, "Failed to add key '%d' to assocArray\n", intkey);
-				return -1;
-			}
-		} else {
+	if (table->sharded != NULL) {
+		nEntries = loadInParallel(table, file);
+		if (nEntries < 0)
+			fprintf(stderr, "Failed to add keys from '%s' to assocArray\n", filename);
+		closeDataFile(file);
+		return nEntries;
+	}
 
-			if (aaInsert(assocArray,
-						(AAKeyType) strkey, strlen(strkey),
-						strdup(value)) < 0) {
-				fprintf(stderr, "Failed to add key '%s' to assocArray\n", strkey);
-				return -1;
+	while (readDataRecord(file, &keySpan, &valueSpan) > 0) {
+
+		if (spanKey(&keySpan, table->useIntKey, &intkey, &key, &keylen) < 0
+				|| (value = spanToString(&valueSpan)) == NULL) {
+			closeDataFile(file);
+			return -1;
+		}
+
+		if (aaInsert(table->single, key, keylen, value) < 0) {
+			if (key == (AAKeyType) &intkey) {
+				fprintf(stderr, "Failed to add key '%d' to assocArray\n", intkey);
+			} else {
+				fprintf(stderr, "Failed to add key '%.*s' to assocArray\n",
+						(int) keylen, (char *) key);
 			}
+			free(value);
+			closeDataFile(file);
+			return -1;
 		}
 		nEntries++;
 	}
 
-	fclose(fp);
+	closeDataFile(file);
 	return nEntries;
 }
 
+/** how many query keys are read before they are looked up together */
+#define	QUERY_BATCH	64
+
 /**
- * Query the array with all the values in the given file
+ * Query the array with all the values in the given file.  Keys
+ * are read a batch at a time and looked up with aaLookupBatch(),
+ * which overlaps the memory accesses of the different keys.
+ *
+ *  @return      the number of keys queried, or -1 on error
  */
 static int
-queryAssociativeArray(AssociativeArray *assocArray, char *filename, int useIntKey)
+queryAssociativeArray(Table *table, char *filename, ResultWriter *results)
 {
-	char linebuffer[LINE_MAX];
-	char *strkey = NULL, *value = NULL;
-	int intkey;
-	FILE *fp = NULL;
-
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error: Failed to open query input file '%s' : %s",
-				filename, strerror(errno));
+	int intkeys[QUERY_BATCH];
+	AAKeyType keys[QUERY_BATCH];
+	size_t keylens[QUERY_BATCH];
+	void *values[QUERY_BATCH];
+	DataSpan keySpan;
+	int nKeys, i, status = 1;
+	int nQueried = 0;
+	DataFile *file = NULL;
+
+	file = openDataFile(filename);
+	if (file == NULL) {
 		return -1;
 	}
 
-	while (readPlainLine(fp, linebuffer, LINE_MAX, &strkey)) {
-		if (useIntKey && isdigit(strkey[0])) {
-			if (sscanf(strkey, "%d", &intkey) != 1) {
-				fprintf(stderr, "Error: Failed extracting integer from '%s'\n", strkey);
-				return -1;
-			}
+	do {
+		for (nKeys = 0; nKeys < QUERY_BATCH; nKeys++) {
+			if ( ! readPlainRecord(file, &keySpan))
+				break;
 
-			value = aaLookup(assocArray, (AAKeyType) &intkey, sizeof(int));
-			if (value == NULL) {
-				printf("LOOKUP: key (%d) produced no value\n", intkey);
-			} else {
-				printf("LOOKUP: key (%d) produced value '%s'\n", intkey, value);
+			if (spanKey(&keySpan, table->useIntKey, &intkeys[nKeys],
+						&keys[nKeys], &keylens[nKeys]) < 0) {
+				status = -1;
+				break;
 			}
+		}
 
+		if (table->sharded != NULL) {
+			aaShardedLookupBatch(table->sharded, keys, keylens, nKeys, values);
 		} else {
-			value = aaLookup(assocArray, (AAKeyType) strkey, strlen(strkey));
-			if (value == NULL) {
-				printf("LOOKUP: key '%s' produced no value\n", strkey);
-			} else {
-				printf("LOOKUP: key '%s' produced value '%s'\n", strkey, value);
-			}
+			aaLookupBatch(table->single, keys, keylens, nKeys, values);
 		}
-	}
 
-	fclose(fp);
-	return 1;
+		for (i = 0; i < nKeys; i++) {
+			writeResult(results, "LOOKUP", (const char *) keys[i], keylens[i],
+					(keys[i] == (AAKeyType) &intkeys[i]) ? &intkeys[i] : NULL,
+					(const char *) values[i]);
+		}
+		nQueried += nKeys;
+	} while (nKeys == QUERY_BATCH && status > 0);
+
+	endResults(results, "LOOKUP");
+	closeDataFile(file);
+	return (status < 0) ? -1 : nQueried;
+}
+
+/** remove a key from whichever kind of table is in use */
+static void *
+deleteKey(Table *table, AAKeyType key, size_t keylen)
+{
+	if (table->sharded != NULL)
+		return aaShardedDelete(table->sharded, key, keylen);
+	return aaDelete(table->single, key, keylen);
 }
 
 /**
  * Delete the selected values from the array.  Note that we free the values
  * as otherwise they are memory leaks as we are managing the memory for
  * these values outside of the library
+ *
+ *  @return      the number of keys deleted or not found, or -1 on error
  */
 static int
-deleteFromAssociativeArray(AssociativeArray *assocArray, char *filename, int useIntKey)
+deleteFromAssociativeArray(Table *table, char *filename, ResultWriter *results)
 {
-	char linebuffer[LINE_MAX];
-	char *strkey = NULL, *value = NULL;
+	DataSpan keySpan;
+	AAKeyType key;
+	size_t keylen;
+	char *value = NULL;
 	int intkey;
-	FILE *fp = NULL;
+	int nDeleted = 0;
+	DataFile *file = NULL;
 
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Error: Failed to open query input file '%s' : %s",
-				filename, strerror(errno));
+	file = openDataFile(filename);
+	if (file == NULL) {
 		return -1;
 	}
 
-	while (readPlainLine(fp, linebuffer, LINE_MAX, &strkey)) {
-		if (useIntKey && isdigit(strkey[0])) {
-			if (sscanf(strkey, "%d", &intkey) != 1) {
-				fprintf(stderr, "Error: Failed extracting integer from '%s'\n", strkey);
-				return -1;
-			}
-
-			value = aaDelete(assocArray, (AAKeyType) &intkey, sizeof(int));
-			if (value == NULL) {
-				printf("DELETE: key (%d) produced no value\n", intkey);
-			} else {
-				printf("DELETE: key (%d) produced value '%s'\n", intkey, value);
-				free(value);
-			}
-
-		} else {
-			value = aaDelete(assocArray, (AAKeyType) strkey, strlen(strkey));
-			if (value == NULL) {
-				printf("DELETE: key '%s' produced no value\n", strkey);
-			} else {
-				printf("DELETE: key '%s' produced value '%s'\n", strkey, value);
-				free(value);
-			}
+	while (readPlainRecord(file, &keySpan)) {
+		if (spanKey(&keySpan, table->useIntKey, &intkey, &key, &keylen) < 0) {
+			closeDataFile(file);
+			return -1;
 		}
+
+		value = deleteKey(table, key, keylen);
+		writeResult(results, "DELETE", (const char *) key, keylen,
+				(key == (AAKeyType) &intkey) ? &intkey : NULL, value);
+		free(value);
+		nDeleted++;
 	}
 
-	fclose(fp);
-	return 1;
+	endResults(results, "DELETE");
+	closeDataFile(file);
+	return nDeleted;
 }
 
 
+/** how much of a value to save in a snapshot: the string and its NUL */
+static size_t
+valueLength(void *value)
+{
+	return strlen((char *) value) + 1;
+}
+
 static int
 deleteValue(AAKeyType key, size_t keylen, void *value, void *userdata)
 {
@@ -162,6 +400,13 @@ deleteValue(AAKeyType key, size_t keylen, void *value, void *userdata)
 	return 0;
 }
 
+/** a value evicted from a cache is ours to free, as if it were deleted */
+static void
+evictValue(AAKeyType key, size_t keylen, void *value, void *userdata)
+{
+	free(value);
+}
+
 #define	DEFAULT_ARRAY_SIZE	100
 #define OPTIONLEN	10
 
@@ -176,24 +421,83 @@ void usage(char *progname)
 	fprintf(stderr, "Options: \n");
 	fprintf(stderr, "%-*s: Print this help.\n", OPTIONLEN, "-h");
 	fprintf(stderr, "%-*s: If a key is made of digits, store it as an int.\n", OPTIONLEN, "-i");
+	fprintf(stderr, "%-*s: Copy long keys into an arena owned by the table.\n", OPTIONLEN, "-A");
 	fprintf(stderr, "%-*s: Size of table used internally, default %d.\n",
 			OPTIONLEN, "-n <SIZE>", DEFAULT_ARRAY_SIZE);
+	fprintf(stderr, "%-*s: Grow the table past this load factor, default %.2f.\n",
+			OPTIONLEN, "-L <LOAD>", AA_DEFAULT_MAX_LOAD_FACTOR);
+	fprintf(stderr, "%-*s: Shrink the table below this load factor, default %.2f\n",
+			OPTIONLEN, "-l <LOAD>", AA_DEFAULT_MIN_LOAD_FACTOR);
+	fprintf(stderr, "%-*s: (0 never shrinks).\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Table sizing.  Choices are \"prime\" (default), \"mask\"\n",
+			OPTIONLEN, "-S <MODE>");
+	fprintf(stderr, "%-*s: (power of two, low bits) or \"shift\" (power of two, multiply-shift).\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Load the data files using this many threads, into a table\n",
+			OPTIONLEN, "-j <JOBS>");
+	fprintf(stderr, "%-*s: split into as many shards (default 1, a single table).\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Use the table as a cache of at most <N> entries, evicting those\n",
+			OPTIONLEN, "-C <N>");
+	fprintf(stderr, "%-*s: not looked up lately to make room.\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Use the table as a cache of at most <N> bytes of keys and values.\n",
+			OPTIONLEN, "-M <N>");
 	fprintf(stderr, "%-*s: Output file to write to, default stdout.\n",
 			OPTIONLEN, "-o <FILE>");
 	fprintf(stderr, "%-*s: Print out the table after processing.\n", OPTIONLEN, "-p");
+	fprintf(stderr, "%-*s: Save the table to a snapshot after processing.\n",
+			OPTIONLEN, "-w <FILE>");
+	fprintf(stderr, "%-*s: Open the table from a snapshot, read-only, instead of\n",
+			OPTIONLEN, "-r <FILE>");
+	fprintf(stderr, "%-*s: loading data files.\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Rebuild the table from the operation log <LOG>, if there is\n",
+			OPTIONLEN, "-W <LOG>");
+	fprintf(stderr, "%-*s: one, then log every change made to it (data files optional).\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Print probe statistics, with a histogram of probe lengths.\n",
+			OPTIONLEN, "-T");
+	fprintf(stderr, "%-*s: Measure the load, delete and query phases with the hardware\n",
+			OPTIONLEN, "-m");
+	fprintf(stderr, "%-*s: counters (Linux only), and print the cost per operation.\n",
+			OPTIONLEN, "");
 	fprintf(stderr, "%-*s: Hash using the given algorithm.  Choices are \"sum\", \"length\",\n",
 			OPTIONLEN, "-H <ALG>");
-	fprintf(stderr, "%-*s: or your own algorithm.\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: \"xor\", \"sip\" (SipHash-1-3, for untrusted keys), \"wyhash\", \"xxh64\",\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: \"int\" (fast path for 4 or 8 byte integer keys) or your own\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: algorithm.\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Seed for the keyed hashes (\"sip\", \"wyhash\", \"xxh64\",\n",
+			OPTIONLEN, "-s <SEED>");
+	fprintf(stderr, "%-*s: \"int\"), default 0 for a different random seed every run.\n",
+			OPTIONLEN, "");
 	fprintf(stderr, "%-*s: Probe using the given algorithm.  Choices are \"linear\", \"quadratic\",\n",
 			OPTIONLEN, "-P <ALG>");
-	fprintf(stderr, "%-*s: or \"doublehash\".\n", OPTIONLEN, "");
+	fprintf(stderr, "%-*s: \"doublehash\", \"robin\" (Robin Hood linear probing), \"swiss\"\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: (SIMD-searched control byte table) or \"cuckoo\" (4-way\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: buckets chosen by the primary and secondary hash; a keyed hash\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: stands in for a \"sum\", \"length\" or \"xor\" secondary hash).\n",
+			OPTIONLEN, "");
 	fprintf(stderr, "%-*s: Perform queries on all of the keys listed in <FILE> (one per line)\n",
 			OPTIONLEN, "-q <FILE>");
 	fprintf(stderr, "%-*s: Delete all of the keys listed in <FILE> (one per line)\n",
 			OPTIONLEN, "-d <FILE>");
+	fprintf(stderr, "%-*s: How to report each key deleted or queried: \"text\" (default)\n",
+			OPTIONLEN, "-R <MODE>");
+	fprintf(stderr, "%-*s: writes a line per key, \"count\" only how many were found.\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: Also write a bitmap of which keys were found to <FILE>, a bit\n",
+			OPTIONLEN, "-b <FILE>");
+	fprintf(stderr, "%-*s: per key, lowest bit first; deletions then queries, each\n",
+			OPTIONLEN, "");
+	fprintf(stderr, "%-*s: starting on a new byte.\n", OPTIONLEN, "");
 	fprintf(stderr, "\n");
-	fprintf(stderr, "The order of the operations controlled by -d, -q and -p are: deletion first,\n");
-	fprintf(stderr, "followed by any queries, and then finally printing (if indicated)\n");
+	fprintf(stderr, "The order of the operations controlled by -d, -q, -w and -p are: deletion first,\n");
+	fprintf(stderr, "followed by any queries, then saving a snapshot, and then finally printing\n");
+	fprintf(stderr, "(if indicated)\n");
 	fprintf(stderr, "\n");
 	exit (1);
 }
@@ -208,23 +512,47 @@ main(int argc, char **argv)
 	char *programname = NULL;
 	FILE *ofp = stdout;
 	int arraySize = DEFAULT_ARRAY_SIZE;
-	int useIntKey = 0;
 	int printContents = 0;
+	int printStats = 0;
+	AAStats stats;
+	int measure = 0;
+	PerfCounters perf;
+	PerfPhase phases[3];
+	int nPhases = 0, nDone;
+	unsigned long nLoaded = 0;
 	char *queryfile = NULL, *deletefile = NULL;
+	char *bitmapfile = NULL;
+	char *snapshotfile = NULL, *savefile = NULL;
+	char *logname = NULL;
+	AACacheConfig cache;
+	ResultMode resultMode = RESULTS_TEXT;
+	ResultWriter results;
 	int i, c;
 
-	AssociativeArray *assocArray;
+	Table table;
+	AAConfig config;
 	char *hash1 = "sum", *hash2 = "len", *probe = "lin";
 
 	/* save program name before calling getopt() */
 	programname = argv[0];
 
+	aaInitConfig(&config);
+	memset(&cache, 0, sizeof(cache));
+	memset(&table, 0, sizeof(table));
+	table.nJobs = 1;
+
 	/** use getopt(3) to parse command line */
-	while ((c = getopt(argc, argv, "hpin:o:P:H:2:q:d:")) != -1) {
+	while ((c = getopt(argc, argv, "hpTmiAn:o:P:H:2:q:d:L:l:S:s:j:R:b:w:r:W:C:M:")) != -1) {
 		if (c == 'i') {
-			useIntKey = 1;
+			table.useIntKey = 1;
+		} else if (c == 'A') {
+			config.keyStorage = AA_KEYS_ARENA;
 		} else if (c == 'p') {
 			printContents = 1;
+		} else if (c == 'T') {
+			printStats = 1;
+		} else if (c == 'm') {
+			measure = 1;
 		} else if (c == 'n') {
 			if (sscanf(optarg, "%d", &arraySize) != 1) {
 				fprintf(stderr,
@@ -233,6 +561,67 @@ main(int argc, char **argv)
 				usage(programname);
 			}
 
+		} else if (c == 'j') {
+			if (sscanf(optarg, "%d", &table.nJobs) != 1
+					|| table.nJobs < 1 || table.nJobs > MAX_JOBS) {
+				fprintf(stderr,
+						"Error: cannot parse number of jobs (1 to %d) from '%s'\n",
+						MAX_JOBS, optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'C') {
+			if (sscanf(optarg, "%zu", &cache.maxEntries) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse cache capacity from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'M') {
+			if (sscanf(optarg, "%zu", &cache.maxBytes) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse cache capacity in bytes from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'L') {
+			if (sscanf(optarg, "%lf", &config.maxLoadFactor) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse maximum load factor from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'l') {
+			if (sscanf(optarg, "%lf", &config.minLoadFactor) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse minimum load factor from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'S') {
+			if (strncmp(optarg, "pri", 3) == 0) {
+				config.sizingMode = AA_SIZE_PRIME;
+			} else if (strncmp(optarg, "mas", 3) == 0) {
+				config.sizingMode = AA_SIZE_POW2_MASK;
+			} else if (strncmp(optarg, "shi", 3) == 0) {
+				config.sizingMode = AA_SIZE_POW2_SHIFT;
+			} else {
+				fprintf(stderr, "Error: unknown table sizing '%s'\n", optarg);
+				usage(programname);
+			}
+
+		} else if (c == 's') {
+			if (sscanf(optarg, "%" SCNu64, &config.seed) != 1) {
+				fprintf(stderr,
+						"Error: cannot parse hash seed from '%s'\n",
+						optarg);
+				usage(programname);
+			}
+
 		} else if (c == 'H') {
 			hash1 = optarg;
 
@@ -248,6 +637,28 @@ main(int argc, char **argv)
 		} else if (c == 'd') {
 			deletefile = optarg;
 
+		} else if (c == 'R') {
+			if (strncmp(optarg, "tex", 3) == 0) {
+				resultMode = RESULTS_TEXT;
+			} else if (strncmp(optarg, "cou", 3) == 0) {
+				resultMode = RESULTS_COUNT;
+			} else {
+				fprintf(stderr, "Error: unknown result mode '%s'\n", optarg);
+				usage(programname);
+			}
+
+		} else if (c == 'b') {
+			bitmapfile = optarg;
+
+		} else if (c == 'w') {
+			savefile = optarg;
+
+		} else if (c == 'r') {
+			snapshotfile = optarg;
+
+		} else if (c == 'W') {
+			logname = optarg;
+
 		} else if (c == 'o') {
 			ofp = fopen(optarg, "w");
 			if (ofp == NULL) {
@@ -266,48 +677,162 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc < 1) {
+	if (snapshotfile != NULL) {
+		if (argc > 0 || deletefile != NULL || logname != NULL) {
+			fprintf(stderr, "Error: a table opened from a snapshot cannot be changed\n");
+			usage(programname);
+		}
+	} else if (logname != NULL) {
+		if (table.nJobs > 1) {
+			fprintf(stderr, "Error: only a single table (-j 1) can be logged\n");
+			usage(programname);
+		}
+	} else if (argc < 1) {
 		fprintf(stderr, "Error: No data files listed to load!\n");
 		usage(programname);
 	}
 
+	if ((cache.maxEntries > 0 || cache.maxBytes > 0)
+			&& (snapshotfile != NULL || table.nJobs > 1)) {
+		fprintf(stderr, "Error: only a single table that can be changed can be a cache\n");
+		usage(programname);
+	}
+
 	/** allocate the array and fail out if we cannot */
-	assocArray = aaCreateAssociativeArray(arraySize, probe, hash1, hash2);
-	if (assocArray == NULL) {
+	if (snapshotfile != NULL) {
+		table.single = aaOpenSnapshot(snapshotfile);
+	} else if (logname != NULL) {
+		table.single = aaRecoverFromLog(logname, arraySize,
+				probe, hash1, hash2, &config);
+		if (table.single != NULL
+				&& aaAttachLog(table.single, logname, valueLength, NULL) < 0) {
+			fprintf(stderr, "Error: cannot log changes to '%s' - exitting\n", logname);
+			return -1;
+		}
+	} else if (table.nJobs > 1) {
+		table.sharded = aaCreateShardedArray(table.nJobs, arraySize,
+				probe, hash1, hash2, &config);
+	} else {
+		table.single = aaCreateAssociativeArrayWithConfig(arraySize,
+				probe, hash1, hash2, &config);
+	}
+	if (table.single == NULL && table.sharded == NULL) {
 		fprintf(stderr, "Error: cannot allocate associative array - exitting\n");
 		return -1;
 	}
 
+	if (cache.maxEntries > 0 || cache.maxBytes > 0) {
+		cache.valueLength = valueLength;
+		cache.evict = evictValue;
+		if (aaSetCacheMode(table.single, &cache) < 0) {
+			return -1;
+		}
+	}
+
+
+	/** carry on without the counters if none can be had */
+	if (measure && openPerfCounters(&perf) < 0) {
+		measure = 0;
+	}
 
 	/** getopt leaves us only "file" arguments left in argv */
+	if (measure) {
+		startPerfPhase(&perf);
+	}
 	for (i = 0; i < argc; i++) {
-		if (loadAssociativeArray(assocArray, argv[i], useIntKey) < 0) {
+		if ((nDone = loadAssociativeArray(&table, argv[i])) < 0) {
 			fprintf(stderr, "Error: failed loading from file '%s'\n", argv[i]);
 			return -1;
 		}
+		nLoaded += nDone;
+	}
+	if (measure) {
+		endPerfPhase(&perf, &phases[nPhases++], "load", nLoaded);
 	}
 	printf("Associative array loaded\n");
 
+	/** the results are written straight to the file, so stdio must be flushed first */
+	fflush(stdout);
+	if (openResultWriter(&results, STDOUT_FILENO, resultMode, bitmapfile) < 0) {
+		return -1;
+	}
 
 	/** delete anything that we were asked to */
 	if (deletefile != NULL) {
-		deleteFromAssociativeArray(assocArray, deletefile, useIntKey);
+		if (measure) {
+			startPerfPhase(&perf);
+		}
+		nDone = deleteFromAssociativeArray(&table, deletefile, &results);
+		if (measure) {
+			endPerfPhase(&perf, &phases[nPhases++], "delete",
+					(nDone < 0) ? 0 : nDone);
+		}
 	}
 
 	/** perform any queries we were asked to */
 	if (queryfile != NULL) {
-		queryAssociativeArray(assocArray, queryfile, useIntKey);
+		if (measure) {
+			startPerfPhase(&perf);
+		}
+		nDone = queryAssociativeArray(&table, queryfile, &results);
+		if (measure) {
+			endPerfPhase(&perf, &phases[nPhases++], "query",
+					(nDone < 0) ? 0 : nDone);
+		}
 	}
 
-	/* print out what we loaded */
-	aaPrintSummary(ofp, assocArray);
-	if (printContents) {
-		aaPrintContents(ofp, assocArray, "  ");
+	if (closeResultWriter(&results) < 0) {
+		fprintf(stderr, "Error: not all results could be written\n");
 	}
 
-	/* clean up before exit */
-	aaIterateAction(assocArray, deleteValue, NULL);
-	aaDeleteAssociativeArray(assocArray);
+	if (savefile != NULL) {
+		if (table.sharded != NULL) {
+			aaShardedSaveSnapshot(table.sharded, savefile, valueLength);
+		} else {
+			aaSaveSnapshot(table.single, savefile, valueLength);
+		}
+	}
+
+	if (measure) {
+		printPerfPhases(ofp, phases, nPhases);
+		closePerfCounters(&perf);
+	}
+
+	/* print out what we loaded */
+	if (table.sharded != NULL) {
+		aaShardedPrintSummary(ofp, table.sharded);
+		if (printStats) {
+			aaShardedGetStats(table.sharded, &stats);
+			aaPrintStats(ofp, &stats);
+		}
+		if (printContents) {
+			aaShardedPrintContents(ofp, table.sharded, "  ");
+		}
+
+		aaShardedIterateAction(table.sharded, deleteValue, NULL);
+		aaDeleteShardedArray(table.sharded);
+
+	} else {
+		aaPrintSummary(ofp, table.single);
+		if (printStats) {
+			aaGetStats(table.single, &stats);
+			aaPrintStats(ofp, &stats);
+		}
+		if (printContents) {
+			aaPrintContents(ofp, table.single, "  ");
+		}
+
+		/* everything logged must be on disk before we say we are done */
+		if (logname != NULL && aaDetachLog(table.single) < 0) {
+			fprintf(stderr, "Error: not all changes could be logged\n");
+		}
+
+		/* clean up before exit; the values of a snapshot are not ours to free */
+		if (snapshotfile == NULL) {
+			aaIterateAction(table.single, deleteValue, NULL);
+		}
+		aaDeleteAssociativeArray(table.single);
+	}
 
 	/* exit with success if we get here */
 	return 0;
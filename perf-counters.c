@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h> /* for memset(), strerror() */
+#include <errno.h>
+#include <unistd.h> /* for read(), close(), syscall() */
+
+#ifdef	__linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perf-counters.h"
+
+/** column headings, in the order of PerfEvent */
+static const char *eventNames[PERF_N_EVENTS] = {
+		"cycles",
+		"instructions",
+		"L1d-misses",
+		"LLC-misses",
+		"dTLB-misses",
+		"branch-misses"
+	};
+
+#ifdef	__linux__
+
+/** a cache event: which cache, read accesses, and misses */
+#define	CACHE_MISSES(cache)	((cache) \
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+	uint32_t type;
+	uint64_t config;
+} eventTypes[PERF_N_EVENTS] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_L1D) },
+		{ PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_LL) },
+		{ PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_DTLB) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+	};
+
+/**
+ * Open a counter for every event that can be counted here.  The
+ * counters start disabled, count user space only (which needs no
+ * privileges under the default perf_event_paranoid setting) and are
+ * inherited by threads started later, such as those loading with -j.
+ *
+ *  @return      the number of counters opened, or -1 if none could be
+ */
+int
+openPerfCounters(PerfCounters *counters)
+{
+	struct perf_event_attr attr;
+	int errors[PERF_N_EVENTS];
+	int i;
+
+	counters->nOpen = 0;
+	for (i = 0; i < PERF_N_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = eventTypes[i].type;
+		attr.config = eventTypes[i].config;
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+				| PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		counters->fd[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		errors[i] = errno;
+		if (counters->fd[i] >= 0)
+			counters->nOpen++;
+	}
+
+	/** a machine without counters at all only needs saying once */
+	if (counters->nOpen == 0) {
+		fprintf(stderr, "Error: no hardware counters available : %s\n",
+				strerror(errors[0]));
+		return -1;
+	}
+
+	for (i = 0; i < PERF_N_EVENTS; i++) {
+		if (counters->fd[i] < 0)
+			fprintf(stderr, "Warning: cannot count %s : %s\n",
+					eventNames[i], strerror(errors[i]));
+	}
+	return counters->nOpen;
+}
+
+/** zero every counter and start them counting */
+void
+startPerfPhase(PerfCounters *counters)
+{
+	int i;
+
+	for (i = 0; i < PERF_N_EVENTS; i++) {
+		if (counters->fd[i] < 0)
+			continue;
+		ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+/**
+ * Stop the counters and record what they counted since
+ * startPerfPhase(), over the given number of operations
+ */
+void
+endPerfPhase(PerfCounters *counters, PerfPhase *phase,
+		const char *name, unsigned long nOperations)
+{
+	uint64_t values[3];		/** count, time enabled, time running */
+	int i;
+
+	for (i = 0; i < PERF_N_EVENTS; i++) {
+		if (counters->fd[i] >= 0)
+			ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	}
+
+	memset(phase, 0, sizeof(PerfPhase));
+	phase->name = name;
+	phase->nOperations = nOperations;
+
+	for (i = 0; i < PERF_N_EVENTS; i++) {
+		if (counters->fd[i] < 0
+				|| read(counters->fd[i], values, sizeof(values)) != sizeof(values)
+				|| values[2] == 0)
+			continue;
+
+		phase->available[i] = 1;
+		phase->count[i] = (double) values[0];
+		if (values[2] < values[1]) {
+			phase->count[i] *= (double) values[1] / values[2];
+			phase->scaled = 1;
+		}
+	}
+}
+
+void
+closePerfCounters(PerfCounters *counters)
+{
+	int i;
+
+	for (i = 0; i < PERF_N_EVENTS; i++) {
+		if (counters->fd[i] >= 0)
+			close(counters->fd[i]);
+		counters->fd[i] = -1;
+	}
+	counters->nOpen = 0;
+}
+
+#else
+
+/** perf_event_open(2) is only found on Linux */
+int
+openPerfCounters(PerfCounters *counters)
+{
+	int i;
+
+	for (i = 0; i < PERF_N_EVENTS; i++)
+		counters->fd[i] = -1;
+	counters->nOpen = 0;
+	fprintf(stderr, "Error: hardware counters are only supported on Linux\n");
+	return -1;
+}
+
+void
+startPerfPhase(PerfCounters *counters)
+{
+}
+
+void
+endPerfPhase(PerfCounters *counters, PerfPhase *phase,
+		const char *name, unsigned long nOperations)
+{
+	memset(phase, 0, sizeof(PerfPhase));
+	phase->name = name;
+	phase->nOperations = nOperations;
+}
+
+void
+closePerfCounters(PerfCounters *counters)
+{
+}
+
+#endif
+
+/**
+ * Print a table of what each phase cost per operation, with the
+ * instructions per cycle of the phase as a whole
+ */
+void
+printPerfPhases(FILE *fp, const PerfPhase *phases, int nPhases)
+{
+	int scaled = 0;
+	int p, i;
+
+	fprintf(fp, "Hardware counters, per operation:\n");
+	fprintf(fp, "  %-8s %10s", "phase", "operations");
+	for (i = 0; i < PERF_N_EVENTS; i++)
+		fprintf(fp, " %13s", eventNames[i]);
+	fprintf(fp, " %6s\n", "IPC");
+
+	for (p = 0; p < nPhases; p++) {
+		const PerfPhase *phase = &phases[p];
+
+		fprintf(fp, "  %-8s %10lu", phase->name, phase->nOperations);
+		for (i = 0; i < PERF_N_EVENTS; i++) {
+			if ( ! phase->available[i] || phase->nOperations == 0)
+				fprintf(fp, " %13s", "n/a");
+			else
+				fprintf(fp, " %13.2f", phase->count[i] / phase->nOperations);
+		}
+
+		if (phase->available[PERF_CYCLES] && phase->available[PERF_INSTRUCTIONS]
+				&& phase->count[PERF_CYCLES] > 0)
+			fprintf(fp, " %6.2f\n",
+					phase->count[PERF_INSTRUCTIONS] / phase->count[PERF_CYCLES]);
+		else
+			fprintf(fp, " %6s\n", "n/a");
+
+		scaled |= phase->scaled;
+	}
+
+	if (scaled)
+		fprintf(fp, "  (some counts are scaled up, as the counters were shared between events)\n");
+}
@@ -0,0 +1,49 @@
+#ifndef	__PERF_COUNTERS_HEADER__
+#define	__PERF_COUNTERS_HEADER__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** the hardware events counted around each phase of a run */
+typedef enum PerfEvent {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_N_EVENTS
+} PerfEvent;
+
+/**
+ * One counter per event, opened with perf_event_open(2) on this
+ * process and any threads it starts.  Events the machine (or the
+ * kernel's perf_event_paranoid setting) does not allow are left
+ * closed, with an fd of -1, and reported as not available.
+ */
+typedef struct PerfCounters {
+	int fd[PERF_N_EVENTS];
+	int nOpen;
+} PerfCounters;
+
+/**
+ * What was counted over one phase.  If the kernel had to share the
+ * hardware counters out between events, each count is scaled up by
+ * the fraction of the phase it was actually counted for.
+ */
+typedef struct PerfPhase {
+	const char *name;
+	unsigned long nOperations;
+	int available[PERF_N_EVENTS];
+	double count[PERF_N_EVENTS];
+	int scaled;					/** some counts are estimates */
+} PerfPhase;
+
+int openPerfCounters(PerfCounters *counters);
+void startPerfPhase(PerfCounters *counters);
+void endPerfPhase(PerfCounters *counters, PerfPhase *phase,
+		const char *name, unsigned long nOperations);
+void printPerfPhases(FILE *fp, const PerfPhase *phases, int nPhases);
+void closePerfCounters(PerfCounters *counters);
+
+#endif
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h> /* for malloc()/free() */
+#include <string.h> /* for memcpy(), strlen() */
+#include <errno.h>
+#include <fcntl.h> /* for open() */
+#include <unistd.h> /* for write(), close() */
+#include <sys/uio.h> /* for writev() */
+
+#include "result-writer.h"
+
+/** results are handed to the kernel this many bytes at a time */
+#define	RESULT_BUFFER_SIZE	(256 * 1024)
+#define	BITMAP_BUFFER_SIZE	(64 * 1024)
+
+
+/**
+ * Write all of the given pieces, carrying on after short writes
+ */
+static int
+writeAll(int fd, struct iovec *pieces, int nPieces)
+{
+	ssize_t nWritten;
+
+	while (nPieces > 0) {
+		nWritten = writev(fd, pieces, nPieces);
+		if (nWritten < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Error: Failed writing results : %s\n", strerror(errno));
+			return -1;
+		}
+
+		/** step past whatever was written */
+		while (nPieces > 0 && (size_t) nWritten >= pieces->iov_len) {
+			nWritten -= pieces->iov_len;
+			pieces++;
+			nPieces--;
+		}
+		if (nPieces > 0) {
+			pieces->iov_base = (char *) pieces->iov_base + nWritten;
+			pieces->iov_len -= nWritten;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Hand the buffer to the kernel, along with a further piece too big
+ * to be worth copying into it, in one call
+ */
+static void
+flushResults(ResultWriter *writer, const char *extra, size_t extraLength)
+{
+	struct iovec pieces[2];
+	int nPieces = 0;
+
+	if (writer->used > 0) {
+		pieces[nPieces].iov_base = writer->buffer;
+		pieces[nPieces++].iov_len = writer->used;
+	}
+	if (extraLength > 0) {
+		pieces[nPieces].iov_base = (void *) extra;
+		pieces[nPieces++].iov_len = extraLength;
+	}
+
+	if (writer->status > 0 && writeAll(writer->fd, pieces, nPieces) < 0)
+		writer->status = -1;
+	writer->used = 0;
+}
+
+static void
+flushBitmap(ResultWriter *writer)
+{
+	struct iovec piece;
+
+	piece.iov_base = writer->bitmap;
+	piece.iov_len = writer->bitmapUsed;
+	if (writer->bitmapUsed > 0 && writer->status > 0
+			&& writeAll(writer->bitmapFd, &piece, 1) < 0)
+		writer->status = -1;
+	writer->bitmapUsed = 0;
+}
+
+/** add some bytes to the buffer */
+static inline void
+append(ResultWriter *writer, const char *text, size_t length)
+{
+	if (writer->used + length > RESULT_BUFFER_SIZE) {
+		if (length > RESULT_BUFFER_SIZE / 2) {
+			flushResults(writer, text, length);
+			return;
+		}
+		flushResults(writer, NULL, 0);
+	}
+	memcpy(writer->buffer + writer->used, text, length);
+	writer->used += length;
+}
+
+static inline void
+appendString(ResultWriter *writer, const char *text)
+{
+	append(writer, text, strlen(text));
+}
+
+/** add a number in decimal, without going through printf() */
+static void
+appendNumber(ResultWriter *writer, long number)
+{
+	char digits[24];
+	unsigned long magnitude;
+	int position = sizeof(digits);
+
+	magnitude = (number < 0) ? 0UL - (unsigned long) number : (unsigned long) number;
+	do {
+		digits[--position] = '0' + (magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude > 0);
+
+	if (number < 0)
+		digits[--position] = '-';
+
+	append(writer, &digits[position], sizeof(digits) - position);
+}
+
+/** note in the bitmap whether a key was found, lowest bit first */
+static void
+appendBit(ResultWriter *writer, int found)
+{
+	if (writer->nBits == 0)
+		writer->bitmap[writer->bitmapUsed] = 0;
+	if (found)
+		writer->bitmap[writer->bitmapUsed] |= 1 << writer->nBits;
+
+	if (++writer->nBits == 8) {
+		writer->nBits = 0;
+		if (++writer->bitmapUsed == BITMAP_BUFFER_SIZE)
+			flushBitmap(writer);
+	}
+}
+
+
+/**
+ * Set up a writer for the results going to the given file
+ * descriptor.  Anything already written to it through stdio must
+ * have been flushed first.
+ *
+ *  @param  bitmapFile  a file to write the found/not found bitmap
+ *				 to, or NULL for none
+ *  @return      1 on success, or -1 if the writer could not be set up
+ */
+int
+openResultWriter(ResultWriter *writer, int fd, ResultMode mode,
+		const char *bitmapFile)
+{
+	memset(writer, 0, sizeof(ResultWriter));
+	writer->fd = fd;
+	writer->mode = mode;
+	writer->bitmapFd = -1;
+	writer->status = 1;
+
+	writer->buffer = (char *) malloc(RESULT_BUFFER_SIZE);
+	if (writer->buffer == NULL) {
+		fprintf(stderr, "Error: Cannot allocate result buffer\n");
+		return -1;
+	}
+
+	if (bitmapFile != NULL) {
+		writer->bitmap = (unsigned char *) malloc(BITMAP_BUFFER_SIZE);
+		writer->bitmapFd = open(bitmapFile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (writer->bitmap == NULL || writer->bitmapFd < 0) {
+			fprintf(stderr, "Error: cannot open bitmap file '%s' : %s\n",
+					bitmapFile, strerror(errno));
+			closeResultWriter(writer);
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Record the result of one operation on a key, writing the line
+ *
+ *     <operation>: key '<key>' produced value '<value>'
+ *
+ * or "... produced no value" if value is NULL.  A key given as an
+ * integer is written as "key (<intkey>)".  Only the counts and the
+ * bitmap are kept up to date in RESULTS_COUNT mode.
+ */
+void
+writeResult(ResultWriter *writer, const char *operation,
+		const char *key, size_t keylen, const int *intkey, const char *value)
+{
+	writer->nResults++;
+	if (value != NULL)
+		writer->nFound++;
+	if (writer->bitmapFd >= 0)
+		appendBit(writer, value != NULL);
+
+	if (writer->mode != RESULTS_TEXT)
+		return;
+
+	appendString(writer, operation);
+	if (intkey != NULL) {
+		append(writer, ": key (", 7);
+		appendNumber(writer, *intkey);
+		append(writer, ")", 1);
+	} else {
+		append(writer, ": key '", 7);
+		append(writer, key, keylen);
+		append(writer, "'", 1);
+	}
+
+	if (value == NULL) {
+		append(writer, " produced no value\n", 19);
+	} else {
+		append(writer, " produced value '", 17);
+		appendString(writer, value);
+		append(writer, "'\n", 2);
+	}
+}
+
+/**
+ * Finish the results of one operation: write out the count of keys
+ * found in RESULTS_COUNT mode, start the bitmap for the next
+ * operation on a fresh byte, and flush everything out.
+ */
+void
+endResults(ResultWriter *writer, const char *operation)
+{
+	if (writer->mode == RESULTS_COUNT) {
+		appendString(writer, operation);
+		append(writer, ": ", 2);
+		appendNumber(writer, (long) writer->nFound);
+		append(writer, " of ", 4);
+		appendNumber(writer, (long) writer->nResults);
+		append(writer, " keys produced a value\n", 23);
+	}
+	writer->nResults = 0;
+	writer->nFound = 0;
+
+	if (writer->bitmapFd >= 0) {
+		if (writer->nBits > 0) {
+			writer->nBits = 0;
+			writer->bitmapUsed++;
+		}
+		flushBitmap(writer);
+	}
+	flushResults(writer, NULL, 0);
+}
+
+/**
+ * Flush anything left and release the writer
+ *
+ *  @return      1 if everything was written, or -1 if not
+ */
+int
+closeResultWriter(ResultWriter *writer)
+{
+	if (writer->buffer != NULL)
+		flushResults(writer, NULL, 0);
+	if (writer->bitmapFd >= 0) {
+		flushBitmap(writer);
+		if (close(writer->bitmapFd) < 0)
+			writer->status = -1;
+	}
+
+	free(writer->buffer);
+	free(writer->bitmap);
+	writer->buffer = NULL;
+	writer->bitmap = NULL;
+	writer->bitmapFd = -1;
+	return writer->status;
+}
@@ -0,0 +1,36 @@
+#ifndef	__RESULT_WRITER_HEADER__
+#define	__RESULT_WRITER_HEADER__
+
+/** what is written out for each key queried or deleted */
+typedef enum ResultMode {
+	RESULTS_TEXT = 0,		/** a line per key, as printf() used to write */
+	RESULTS_COUNT			/** only how many keys were found, per operation */
+} ResultMode;
+
+/**
+ * Collects the lines of results in a private buffer, formatted by
+ * hand, and hands them to write(2) a buffer at a time.  Optionally,
+ * a bitmap of which keys were found is written to a file as well.
+ */
+typedef struct ResultWriter {
+	int fd;
+	ResultMode mode;
+	char *buffer;
+	size_t used;
+	int bitmapFd;				/** -1 if no bitmap was asked for */
+	unsigned char *bitmap;
+	size_t bitmapUsed;			/** whole bytes of bitmap waiting */
+	unsigned int nBits;			/** bits in the byte being filled */
+	unsigned long nResults;		/** keys in the current operation */
+	unsigned long nFound;
+	int status;					/** -1 once a write has failed */
+} ResultWriter;
+
+int openResultWriter(ResultWriter *writer, int fd, ResultMode mode,
+		const char *bitmapFile);
+void writeResult(ResultWriter *writer, const char *operation,
+		const char *key, size_t keylen, const int *intkey, const char *value);
+void endResults(ResultWriter *writer, const char *operation);
+int closeResultWriter(ResultWriter *writer);
+
+#endif